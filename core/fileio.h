@@ -64,15 +64,17 @@ const char* getFileExtension(const char* filePath) {
 #include <sys/types.h>
 #include <sys/stat.h>
 #ifdef _WIN32
+	#include <direct.h>
 	#define stat _stat
 #else
 	#include <unistd.h>
 #endif
 
 #define FILETIME time_t
+// 0 if the file doesn't exist
 time_t LastModifiedOfFile(const char* filename) {
 	struct stat result;
-	stat(filename, &result);
+	if(stat(filename, &result) != 0) return 0;
 	return result.st_mtime;
 }
 
@@ -81,4 +83,15 @@ u32 CompareFileTime(FILETIME* a, FILETIME* b) {
 		return 0;
 	else
 		return 1;
-}
\ No newline at end of file
+}
+
+// true if the directory exists afterwards, whether or not it had to be made
+bool MakeDirectory(const char* path) {
+#ifdef _WIN32
+	_mkdir(path);
+#else
+	mkdir(path, 0755);
+#endif
+	struct stat result;
+	return stat(path, &result) == 0 && (result.st_mode & S_IFDIR);
+}
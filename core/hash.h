@@ -0,0 +1,21 @@
+#pragma once
+#include <string.h>
+#include "types.h"
+
+// 64 bit FNV-1a, for cache keys (it's quick to compute but nowhere near collision resistant against crafted input)
+// pass the previous result as the seed to hash several things together
+
+#define HASH_SEED 0xcbf29ce484222325ull
+
+u64 HashBytes(const void* data, u32 size, u64 hash = HASH_SEED) {
+	const u8* bytes = (const u8*)data;
+	for(u32 i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+u64 HashString(const char* s, u64 hash = HASH_SEED) {
+	return HashBytes(s, strlen(s), hash);
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include "types.h"
+#include "profiler.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// fork/join helpers
+// ParallelFor hands its ranges to a pool of threads started once by InitJobPool, rather than spawning threads every call
+// the pool is a global of the game dll instead of living in game memory, its threads run dll code, so the dll has to
+// DeinitJobPool before it's unloaded (see Unload in game.cpp) and InitJobPool again after it's reloaded
+// without a running pool ParallelFor runs everything on the calling thread
+
+#define MAX_JOB_THREADS 64 // including the calling thread
+
+u32 GetNumWorkerThreads() {
+	u32 numThreads = std::thread::hardware_concurrency();
+	return numThreads == 0 ? 1 : numThreads;
+}
+
+typedef void (*JobFunc)(void* data, u32 start, u32 end, u32 threadIndex);
+
+struct JobPool {
+	std::thread threads[MAX_JOB_THREADS - 1];
+	u32 nThreads; // workers, the calling thread takes the first range itself
+	bool running;
+	bool busy; // a ParallelFor is in flight, one started from inside it runs serially instead of waiting on itself
+
+	std::mutex mutex;
+	std::condition_variable workReady;
+	std::condition_variable workDone;
+	u64 generation; // bumped every ParallelFor, so workers can tell new work from a spurious wakeup
+	JobFunc func;
+	void* data;
+	u32 count;
+	u32 itemsPerThread;
+	u32 nRanges;
+	u32 nPending; // worker ranges not finished yet
+};
+
+JobPool gJobPool;
+
+void RunJobWorker(JobPool* pool, u32 threadIndex) {
+	// so the profiler puts each worker's zones on its own track
+	gProfileThreadIndex = threadIndex;
+	u64 seen = 0;
+	std::unique_lock<std::mutex> lock(pool->mutex);
+	for(;;) {
+		pool->workReady.wait(lock, [&]() { return !pool->running || pool->generation != seen; });
+		if(!pool->running) return;
+		seen = pool->generation;
+		// the range count can't change until every worker with a range has finished it, so one without can skip a generation
+		if(threadIndex >= pool->nRanges) continue;
+		u32 start = threadIndex * pool->itemsPerThread;
+		u32 end = start + pool->itemsPerThread > pool->count ? pool->count : start + pool->itemsPerThread;
+		JobFunc func = pool->func;
+		void* data = pool->data;
+		lock.unlock();
+		if(start < end) func(data, start, end, threadIndex);
+		lock.lock();
+		if(--pool->nPending == 0) pool->workDone.notify_one();
+	}
+}
+
+/** starts one worker per hardware thread past the calling one, nThreads 0 for as many as there are */
+void InitJobPool(JobPool& pool, u32 nThreads = 0) {
+	if(pool.running) return;
+	if(nThreads == 0) nThreads = GetNumWorkerThreads() - 1;
+	if(nThreads > MAX_JOB_THREADS - 1) nThreads = MAX_JOB_THREADS - 1;
+	pool.nThreads = nThreads;
+	pool.running = true;
+	pool.busy = false;
+	pool.generation = 0;
+	pool.nRanges = 0;
+	pool.nPending = 0;
+	for(u32 t = 0; t < nThreads; t++) {
+		pool.threads[t] = std::thread(RunJobWorker, &pool, t + 1);
+	}
+}
+
+/** wakes the workers up to exit and joins them, nothing is left running after it returns */
+void DeinitJobPool(JobPool& pool) {
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		if(!pool.running) return;
+		pool.running = false;
+	}
+	pool.workReady.notify_all();
+	for(u32 t = 0; t < pool.nThreads; t++) {
+		pool.threads[t].join();
+	}
+	pool.nThreads = 0;
+}
+
+// how many threads ParallelFor will split count items across (use it to size per-thread scratch memory)
+u32 GetNumParallelForThreads(u32 count, u32 minItemsPerThread) {
+	if(minItemsPerThread == 0) minItemsPerThread = 1;
+	u32 maxThreads = gJobPool.running ? gJobPool.nThreads + 1 : 1;
+	u32 numThreads = count / minItemsPerThread;
+	if(numThreads > maxThreads) numThreads = maxThreads;
+	return numThreads == 0 ? 1 : numThreads;
+}
+
+template<typename Func>
+void RunParallelForRange(void* data, u32 start, u32 end, u32 threadIndex) {
+	(*(Func*)data)(start, end, threadIndex);
+}
+
+/**
+ * splits [0, count) into one contiguous range per thread and calls func(start, end, threadIndex) for each range
+ * threadIndex is in [0, GetNumParallelForThreads(count, minItemsPerThread))
+ * the calling thread runs the first range itself, so small workloads never leave the calling thread
+ */
+template<typename Func>
+void ParallelFor(u32 count, u32 minItemsPerThread, Func func) {
+	u32 numThreads = GetNumParallelForThreads(count, minItemsPerThread);
+	if(numThreads == 1) {
+		func(0u, count, 0u);
+		return;
+	}
+	JobPool& pool = gJobPool;
+	u32 itemsPerThread = (count + numThreads - 1) / numThreads;
+	{
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		if(pool.busy) {
+			// called from inside another ParallelFor's range, the workers are taken
+			func(0u, count, 0u);
+			return;
+		}
+		pool.busy = true;
+		pool.func = RunParallelForRange<Func>;
+		pool.data = &func;
+		pool.count = count;
+		pool.itemsPerThread = itemsPerThread;
+		pool.nRanges = numThreads;
+		pool.nPending = numThreads - 1;
+		pool.generation++;
+	}
+	pool.workReady.notify_all();
+	func(0u, itemsPerThread > count ? count : itemsPerThread, 0u);
+	std::unique_lock<std::mutex> lock(pool.mutex);
+	pool.workDone.wait(lock, [&]() { return pool.nPending == 0; });
+	pool.busy = false;
+}
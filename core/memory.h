@@ -7,6 +7,7 @@ typedef struct {
 	u8* start;
 	u8* curLocation;
 	u32 maxSize;
+	u32 nAllocs; // for the profiler's per frame counters
 } Memory;
 
 // maxSize is in bytes of how much memory to allocate
@@ -18,6 +19,7 @@ void InitMemory(Memory& mem, u32 maxSize) {
 		exit(1);
 	}
 	mem.curLocation = mem.start;
+	mem.nAllocs = 0;
 }
 
 void DeinitMemory(Memory& mem) {
@@ -34,6 +36,7 @@ void* Alloc(Memory& mem, u32 size) {
 
 	u8* lastLocation = mem.curLocation;
 	mem.curLocation += size;
+	mem.nAllocs++;
 
 	return (void*) lastLocation;
 }
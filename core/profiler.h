@@ -0,0 +1,184 @@
+#pragma once
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include "types.h"
+
+/**
+ * cpu zones (PROFILE_SCOPE), gpu zones (see gfx/gpu_profiler.h) and per frame counters go into ring buffers
+ * holding the last MAX_PROFILE_EVENTS zones and MAX_PROFILE_FRAMES frames, WriteChromeTrace dumps them as
+ * chrome://tracing / ui.perfetto.dev json
+ * the profiler lives in game memory, so point gProfiler at it again after the dll is reloaded
+ * define DISABLE_PROFILER to compile the zones out
+ */
+
+#define MAX_PROFILE_EVENTS (64 * 1024)
+#define MAX_PROFILE_FRAMES 256
+#define MAX_PROFILE_NAME 32 // longer zone names are cut off
+
+struct ProfileEvent {
+	char name[MAX_PROFILE_NAME]; // copied, the string literals and pass names it's from go away when the dll is reloaded
+	u64 start; // ns since InitProfiler
+	u64 duration;
+	u32 threadIndex; // 0 for the main thread, ParallelFor workers get their range's thread index
+	bool gpu;
+};
+
+// filled in by whoever knows them, the renderer's stats and the memory arena
+struct ProfileCounters {
+	u32 drawCalls;
+	u32 triangles;
+	u32 stateChanges; // program, texture and buffer binds and uniform uploads that reached gl
+	u32 allocations;
+	u32 allocatedBytes;
+};
+
+struct ProfileFrame {
+	u32 frame;
+	u64 start;
+	u64 duration;
+	ProfileCounters counters;
+};
+
+struct Profiler {
+	u64 startTime; // steady clock ns
+
+	std::atomic<u32> nEvents; // total ever recorded, the ring slot is nEvents % MAX_PROFILE_EVENTS
+	ProfileEvent events[MAX_PROFILE_EVENTS];
+
+	u32 frame;
+	u64 frameStart;
+	u32 nFrames; // total ever recorded
+	ProfileFrame frames[MAX_PROFILE_FRAMES];
+};
+
+Profiler* gProfiler = NULL;
+thread_local u32 gProfileThreadIndex = 0;
+
+u64 GetProfileClockNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** ns since the profiler started */
+u64 GetProfileTime(Profiler& profiler) {
+	return GetProfileClockNs() - profiler.startTime;
+}
+
+void InitProfiler(Profiler& profiler) {
+	profiler.startTime = GetProfileClockNs();
+	profiler.nEvents = 0;
+	profiler.frame = 0;
+	profiler.frameStart = 0;
+	profiler.nFrames = 0;
+	gProfiler = &profiler;
+}
+
+void CopyProfileName(char* dest, const char* name) {
+	strncpy(dest, name, MAX_PROFILE_NAME - 1);
+	dest[MAX_PROFILE_NAME - 1] = '\0';
+}
+
+// safe to call from any thread
+void RecordProfileEvent(Profiler& profiler, const char* name, u64 start, u64 duration, u32 threadIndex, bool gpu = false) {
+	u32 slot = profiler.nEvents.fetch_add(1) % MAX_PROFILE_EVENTS;
+	ProfileEvent& event = profiler.events[slot];
+	CopyProfileName(event.name, name);
+	event.start = start;
+	event.duration = duration;
+	event.threadIndex = threadIndex;
+	event.gpu = gpu;
+}
+
+struct ProfileScope {
+	const char* name;
+	u64 start;
+
+	ProfileScope(const char* name) : name(name) {
+		start = gProfiler != NULL ? GetProfileTime(*gProfiler) : 0;
+	}
+	~ProfileScope() {
+		if(gProfiler == NULL) return;
+		RecordProfileEvent(*gProfiler, name, start, GetProfileTime(*gProfiler) - start, gProfileThreadIndex);
+	}
+};
+
+#ifndef DISABLE_PROFILER
+	#define PROFILE_CONCAT_(a, b) a##b
+	#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+	// times the rest of the enclosing scope
+	#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+	#define PROFILE_FUNCTION() PROFILE_SCOPE(__FUNCTION__)
+#else
+	#define PROFILE_SCOPE(name)
+	#define PROFILE_FUNCTION()
+#endif
+
+void BeginProfileFrame(Profiler& profiler) {
+	profiler.frameStart = GetProfileTime(profiler);
+}
+
+void EndProfileFrame(Profiler& profiler, ProfileCounters& counters) {
+	ProfileFrame& frame = profiler.frames[profiler.nFrames++ % MAX_PROFILE_FRAMES];
+	frame.frame = profiler.frame++;
+	frame.start = profiler.frameStart;
+	frame.duration = GetProfileTime(profiler) - profiler.frameStart;
+	frame.counters = counters;
+	RecordProfileEvent(profiler, "frame", frame.start, frame.duration, 0);
+}
+
+/** writes what's still in the rings as a chrome trace, returns false if the file can't be opened */
+bool WriteChromeTrace(Profiler& profiler, const char* path) {
+	FILE* file = fopen(path, "w");
+	if(file == NULL) {
+		printf("Unable to open trace file: %s\n", path);
+		return false;
+	}
+	fprintf(file, "{\"traceEvents\":[\n");
+	fprintf(file, "{\"ph\":\"M\",\"pid\":0,\"name\":\"process_name\",\"args\":{\"name\":\"cpu\"}},\n");
+	fprintf(file, "{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\",\"args\":{\"name\":\"gpu\"}}");
+
+	u32 nEvents = profiler.nEvents;
+	u32 first = nEvents > MAX_PROFILE_EVENTS ? nEvents - MAX_PROFILE_EVENTS : 0;
+	for(u32 i = first; i < nEvents; i++) {
+		ProfileEvent& event = profiler.events[i % MAX_PROFILE_EVENTS];
+		// chrome wants microseconds
+		fprintf(file, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+			event.name, event.gpu ? 1 : 0, event.threadIndex, event.start / 1000.0, event.duration / 1000.0);
+	}
+
+	u32 firstFrame = profiler.nFrames > MAX_PROFILE_FRAMES ? profiler.nFrames - MAX_PROFILE_FRAMES : 0;
+	for(u32 i = firstFrame; i < profiler.nFrames; i++) {
+		ProfileFrame& frame = profiler.frames[i % MAX_PROFILE_FRAMES];
+		ProfileCounters& counters = frame.counters;
+		fprintf(file, ",\n{\"ph\":\"C\",\"name\":\"render\",\"pid\":0,\"ts\":%.3f,\"args\":{\"drawCalls\":%d,\"triangles\":%d,\"stateChanges\":%d}}",
+			frame.start / 1000.0, counters.drawCalls, counters.triangles, counters.stateChanges);
+		fprintf(file, ",\n{\"ph\":\"C\",\"name\":\"memory\",\"pid\":0,\"ts\":%.3f,\"args\":{\"allocations\":%d,\"allocatedBytes\":%d}}",
+			frame.start / 1000.0, counters.allocations, counters.allocatedBytes);
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+	printf("wrote %d events and %d frames to %s\n", nEvents - first, profiler.nFrames - firstFrame, path);
+	return true;
+}
+
+// simple unit test
+// #include "jobs.h"
+// int main() {
+// 	static Profiler profiler;
+// 	InitProfiler(profiler);
+// 	for(u32 f = 0; f < 3; f++) {
+// 		BeginProfileFrame(profiler);
+// 		{
+// 			PROFILE_SCOPE("update");
+// 			ParallelFor(1000, 100, [&](u32 start, u32 end, u32 threadIndex) {
+// 				PROFILE_SCOPE("work");
+// 				volatile r32 x = 0;
+// 				for(u32 i = start * 1000; i < end * 1000; i++) x += i;
+// 			});
+// 		}
+// 		ProfileCounters counters = { 10, 1000, 20, 1, 64 };
+// 		EndProfileFrame(profiler, counters);
+// 	}
+// 	return WriteChromeTrace(profiler, "trace.json") ? 0 : 1;
+// }
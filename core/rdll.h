@@ -1,6 +1,7 @@
 #pragma once
 #include "dll.h"
 #include "fileio.h"
+#include "memory.h"
 
 #define MAX_DLL_SIZE 1 MB
 
@@ -38,12 +39,22 @@ void DeinitReloadableDLL(ReloadableDLL& rdll) {
 	UnloadDLL(rdll.dll_handle);
 }
 
-// returns 0 on error, 1 if reloaded, 2 if not reloaded
-int ReloadDLLIfUpdated(ReloadableDLL& rdll) {
+typedef void (*DLLUnloadFunc)(Memory&);
+
+/**
+ * returns 0 on error, 1 if reloaded, 2 if not reloaded
+ * the old dll's optional "Unload" export is called with mem right before it's unloaded, so it can stop threads still
+ * running its code
+ */
+int ReloadDLLIfUpdated(ReloadableDLL& rdll, Memory& mem) {
 #ifndef DISABLE_LIVE_UPDATING
 	FILETIME newModifyTime = LastModifiedOfFile(rdll.dll_filename.c_str());
 	if(CompareFileTime(&rdll.lastModifyTime, &newModifyTime) == 0)
 		return 2; // no error, just didn't need to reload
+	if(rdll.dll_handle != NULL) {
+		DLLUnloadFunc unloadFunc = (DLLUnloadFunc) GetFuncFromDLL(rdll.dll_handle, "Unload");
+		if(unloadFunc != NULL) unloadFunc(mem);
+	}
 	UnloadDLL(rdll.dll_handle);
 	rdll.dll_handle = NULL;
 	if(!MakeCopyOfFile(rdll.dll_filename.c_str(), rdll.open_dll_filename.c_str())) {
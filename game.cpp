@@ -15,7 +15,10 @@
 	#include "gfx/dae_loader.h"
 	#include "gfx/material.h"
 	#include "gfx/default_renderer.h"
+	#include "gfx/deferred_renderer.h"
 	#include "gfx/raymarch_renderer.h"
+	#include "gfx/render_graph.h"
+	#include "gfx/gpu_profiler.h"
 	#include "gfx/assets.h"
 #else
 	// since the server doesn't need these definitions, just declare them so we can use render_obj.h
@@ -24,6 +27,7 @@
 #endif
 #include "gfx/render_obj.h"
 #include "core/memory.h"
+#include "core/profiler.h"
 #include "game/game_input.h"
 #include "physics/collision.h"
 #include "physics/othergjk.h"
@@ -94,24 +98,6 @@ idea for making layered equipment/clothes not clip weirdly
 		if there's a currently equipped pair of clothing that had some faces stored in the pre-processing step
 		render the subset of faces that exclude vertices that go outside
 
-instanced rendering - example in OldAttempts/final_modularity/src/graphics.cpp
-	InstanceData class
-	gl_buffers.h
-		instance data vbo
-		instance data array
-		MAX_INSTANCES
-		instancesOffset
-	add instancesOffset, numInstances and maxInstances to Model
-		fill when we load model
-	add instanceIndex to renderObj
-		when creating renderObj, check the numInstances and maxInstances of the model to see if it can get a valid instanceIndex and increment numInstances if so
-		when rendering, first loop through the renderObjs and fill the instance data array for at the model's instancesOffset
-			then fill the instance data vbo with that instance data array (might have to have the vbo just have that model's data)
-			then loop through the models and glDrawElementsInstanced
-	when filling the instance data vbo, loop through all renderObjs and fill the instance data array at the instanceIndex with the matrix from its Transform
-		also calculate and store the normal matrix
-		also any other instance data we want to store
-
 physics
 	fix gjk or just do a custom version
 		can maybe just find the 3 vertices closest to the origin
@@ -269,8 +255,8 @@ Physics Engine
 	*/
 
 // graphics defines
-#define MAX_RENDER_OBJS 32
-#define MAX_LIGHTS 5
+#define MAX_RENDER_OBJS 4096
+#define MAX_LIGHTS 256 // point / spot lights, they're binned into clusters so lots of them is fine
 
 /// collision defines
 #define MAX_COLLISION_OBJS 100
@@ -303,6 +289,7 @@ Physics Engine
 #define SNAPSHOT_BUFFER_SIZE 20
 
 #define DISABLE_TICK_COUNTER
+// #define PROFILE_DUMP_FRAME 600 // writes trace.json on this frame, for runs nobody is around to press F3 in
 
 // #include <thread>
 // void LimitTickRate(u64 millisPerTick, u64& lastTickTime) {
@@ -328,16 +315,28 @@ struct Game {
 
 	//// renderers
 	DefaultRenderer renderer;
+	DeferredRenderer deferredRenderer;
+	bool deferredShading; // F1 switches between DeferredRender and DefaultRender
 	RaymarchRenderer raymarchRenderer;
+	bool raymarching; // F2 merges the fractal into the scene
+	RenderGraph renderGraph; // rebuilt every frame from the passes above
+
+	//// profiling, F3 writes trace.json
+	Profiler profiler;
+	GpuProfiler gpuProfiler;
+	u32 profiledAllocs; // mem.nAllocs and bytes allocated at the start of the frame
+	u32 profiledBytes;
 	TextRenderer text_renderer;
 
 	//// gl buffers
 	VBO vbo;
 	IBO ibo;
 	JointBuffers jointBuffers;
+	MeshletBuffers meshletBuffers;
 
 	//// assets
 	Assets assets;
+	TextureLoader textureLoader;
 
 	u32 nSounds;
 	u32 nSoundBuffers;
@@ -347,7 +346,6 @@ struct Game {
 	DirLight dirLight;
 	u32 nRenderObjs;
 	RenderObj renderObjs[MAX_RENDER_OBJS];
-	Map* characters;
 	u32 nLights;
 	Light lights[MAX_LIGHTS];
 
@@ -411,11 +409,6 @@ void InitGameRenderObj(Memory& mem, Game* game, Model* model, Material* material
 	game->nRenderObjs++;
 }
 
-void InitCharacters(Map*& map, Memory& mem) {
-	map = InitMap(mem, 130, 3);
-	return loadCharacters(map, mem);
-}
-
 void CreateBoneCollisionBBox(Memory& mem, Game* game, RenderObj& renderObj, CollisionObj& collisionObj) {
 	// psuedocode
 	/*
@@ -506,20 +499,32 @@ extern "C" void Init(Memory& mem) {
 	Game* game = (Game*) myDLL->mem;
 	game->window = (Window*) mem.start;
 	game->window->sfml_window->setFramerateLimit(60);
+	InitProfiler(game->profiler);
+	InitGpuProfiler(game->gpuProfiler);
+	InitJobPool(gJobPool);
 	game->sound_buffers = (sf::SoundBuffer**) (mem.start + sizeof(Window) + sizeof(sf::RenderWindow) + sizeof(ReloadableDLL));
 
-	InitCharacters(game->characters, mem);
 	InitGLBuffers(game->vbo, game->ibo);
+	InitMeshletBuffers(game->meshletBuffers);
 
 	// init renderers and shaders
-	InitDefaultRenderer(game->renderer, game->vbo, game->ibo, false, game->window->sfml_window->getSize().x, game->window->sfml_window->getSize().y);
-	InitTextRenderer(game->text_renderer);
-	InitRaymarchRenderer(game->raymarchRenderer, game->vbo, game->ibo, &game->renderer.fbo);
+	InitShaderCache();
+	InitDefaultRenderer(game->renderer, game->vbo, game->ibo, &game->meshletBuffers);
+	InitDeferredRenderer(game->deferredRenderer, game->renderer, game->window->sfml_window->getSize().x, game->window->sfml_window->getSize().y);
+	game->deferredShading = false;
+	InitTextRenderer(game->text_renderer, game->renderer.state);
+	InitRaymarchRenderer(game->raymarchRenderer, game->vbo, game->ibo);
+	game->raymarching = false;
+	InitRenderGraph(game->renderGraph);
+	game->renderGraph.gpuProfiler = &game->gpuProfiler;
 	InitShader(game->testShader, "shaders/simpleVS.glsl", "shaders/simpleFS.glsl");
 
-	InitDefaultAssets(game->assets, game->vbo, game->ibo, game->jointBuffers);
+	InitTextureLoader(game->textureLoader);
+	InitDefaultAssets(game->assets, game->vbo, game->ibo, game->jointBuffers, game->textureLoader);
+	BuildAssetMeshlets(game->assets, game->vbo, game->ibo, game->meshletBuffers);
 
 	FillGLBuffers(game->vbo, game->ibo);
+	UploadMaterialTable(game->renderer.uniformBuffers, game->assets.materials, game->assets.nMaterials);
 
 	// init render objs
 	game->nRenderObjs = 0;
@@ -527,6 +532,7 @@ extern "C" void Init(Memory& mem) {
 	InitGameRenderObj(mem, game, &game->assets.models[1], &game->assets.materials[1], v3(-0.897014,0.364757,0.959163), v3(0,0,0), v3(0.1f,0.1f,0.1f)); // 0
 	// floor
 	InitGameRenderObj(mem, game, &game->assets.models[0], &game->assets.materials[2], v3(0,-1.0f,0), v3(-3.14159265f / 2.0f, 0.0f, 3.14159265f), v3(500,500,1.0f)); // 1
+	game->renderObjs[1].isOccluder = true; // two triangles hiding everything below ground
 	// ike quad
 	InitGameRenderObj(mem, game, &game->assets.models[0], &game->assets.materials[3], v3(2,1,0)); // 2
 	// bricks1 cube
@@ -546,6 +552,15 @@ extern "C" void Init(Memory& mem) {
 	game->lookAtDir = vec3(0,0,1);
 	game->renderObjs[5].curAnimation = 0;
 
+	// everything but the player controlled cubes (6, 7) and the animated models stays put, so their shadows can be cached
+	for(u32 i = 0; i <= 4; i++) {
+		game->renderObjs[i].isStatic = true;
+	}
+
+	// every shader variant the scene needs compiles at once rather than on first sight
+	PrecompileShaders(game->renderer, game->renderer.shaders, game->renderObjs, game->nRenderObjs);
+	PrecompileDeferredShaders(game->deferredRenderer, game->renderer, game->renderObjs, game->nRenderObjs);
+
 	// init bounding box collision around each bone (optional)
 	CollisionObj collisionObj;
 	CreateBoneCollisionBBox(mem, game, game->renderObjs[5], collisionObj);
@@ -565,8 +580,14 @@ extern "C" void Init(Memory& mem) {
 	InitGameSound(mem, game, "sounds/noice.wav");
 	LoadSound(mem, game, 0);
 
-	// init point / spot lights
+	// init point / spot lights, a grid of small colored ones just above the floor
 	game->nLights = 0;
+	for(s32 x = -4; x < 4; x++) {
+		for(s32 z = -4; z < 4; z++) {
+			v3 color = v3((x + 4) / 8.0f, 0.5f, (z + 4) / 8.0f);
+			InitLight(game->lights[game->nLights++], v3(x * 3.0f, -0.5f, z * 3.0f), v3(0, -1, 0), color, 0, 1.0f, 0.7f, 1.8f);
+		}
+	}
 
 	// init camera
 	InitCamera(game->camera, v3(0, 1, 3), normalize(v3(0.0f, -0.5f, -1.0f)));
@@ -582,16 +603,17 @@ extern "C" void Reinit(Memory& mem) {
 	Game* game = (Game*) myDLL->mem;
 
 	printf("%f,%f,%f\n", game->camera.pos.x, game->camera.pos.y, game->camera.pos.z);
-	
-	DeinitShader(game->raymarchRenderer.shader);
-	InitShader(game->raymarchRenderer.shader, "shaders/simpleVS.glsl", "shaders/fractalFS3.glsl");
+	// globals start over with the new dll
+	gProfiler = &game->profiler;
+	InitJobPool(gJobPool);
 
 	// game->camera.dir = normalize(v3(0.0f, -0.75f, -1.0f));
 	// UpdateMatrices(game->camera);
 	// game->renderObjs[5].transform.pos = v3(4,-0.5f,0);
 	// UpdateMatrices(game->renderObjs[5]);
 
-    glUniform1i(game->renderer.shader.pcf_enabled, 0);
+	InvalidateBindings(game->renderer.state);
+	game->renderer.shaderFeatures &= ~VARIANT_PCF;
 
 	printf("reinit called\n");
 }
@@ -612,17 +634,50 @@ vec3 getInputXZYAxis(Input& input, sf::Keyboard::Key up, sf::Keyboard::Key left,
 	return { getInputAxis(input, left, right), getInputAxis(input, zdown, zup), getInputAxis(input, down, up) };
 }
 
+//// render graph passes, data is the Game
+
+void ScenePass(RenderGraph& graph, RenderGraphPass& pass, void* data) {
+	Game* game = (Game*)data;
+	u32 windowWidth = game->window->sfml_window->getSize().x;
+	u32 windowHeight = game->window->sfml_window->getSize().y;
+	game->renderer.targetFBO = GetRenderGraphFBO(graph, pass.writes[0]);
+	if(game->deferredShading) {
+		DeferredRender(game->deferredRenderer, game->renderer, game->camera, game->renderObjs, game->nRenderObjs, game->dirLight, game->lights, game->nLights, game->jointBuffers, windowWidth, windowHeight);
+	}
+	else {
+		DefaultRender(game->renderer, game->camera, game->renderObjs, game->nRenderObjs, game->dirLight, game->lights, game->nLights, game->jointBuffers, windowWidth, windowHeight);
+	}
+}
+
+void RaymarchPass(RenderGraph& graph, RenderGraphPass& pass, void* data) {
+	Game* game = (Game*)data;
+	RenderGraphResource& target = graph.resources[pass.writes[0]];
+	RaymarchRender(game->raymarchRenderer, game->renderer.state, game->camera, target.width, target.height);
+}
+
+void RaymarchCompositePass(RenderGraph& graph, RenderGraphPass& pass, void* data) {
+	Game* game = (Game*)data;
+	RaymarchComposite(game->raymarchRenderer, game->renderer.state, GetRenderGraphTexture(graph, pass.reads[0]), GetRenderGraphTexture(graph, pass.reads[1]));
+}
+
 extern "C" void Update(Memory& mem) {
 	ReloadableDLL* myDLL = (ReloadableDLL*) (mem.start + sizeof(Window) + sizeof(sf::RenderWindow));
 	Game* game = (Game*) myDLL->mem;
 
 	Window* window = game->window;
 	Input& input = window->input;
+	BeginProfileFrame(game->profiler);
+	BeginGpuProfilerFrame(game->gpuProfiler, game->profiler);
+	game->profiledAllocs = mem.nAllocs;
+	game->profiledBytes = mem.curLocation - mem.start;
 
 	//// update
 
 	// update input
-	UpdateWindowInput(window);
+	{
+		PROFILE_SCOPE("input");
+		UpdateWindowInput(window);
+	}
 	if(window->input.keys.down[sf::Keyboard::Escape]) {
 		window->sfml_window->close();
 		return;
@@ -631,6 +686,17 @@ extern "C" void Update(Memory& mem) {
 		game->camera.aspect = game->window->sfml_window->getSize().x / (r32) game->window->sfml_window->getSize().y;
 	}
 
+	if(window->input.keys.pressed[sf::Keyboard::F1]) {
+		game->deferredShading = !game->deferredShading;
+		printf("deferred shading %s\n", game->deferredShading ? "on" : "off");
+	}
+	if(window->input.keys.pressed[sf::Keyboard::F2]) {
+		game->raymarching = !game->raymarching;
+	}
+	if(window->input.keys.pressed[sf::Keyboard::F3]) {
+		WriteChromeTrace(game->profiler, "trace.json");
+	}
+
 	// sound stuff
 	if(window->input.keys.down[sf::Keyboard::Space]) {
 		game->sounds[0]->play();
@@ -768,31 +834,103 @@ extern "C" void Update(Memory& mem) {
 #endif
 
 	//// render
-	DefaultRender(game->renderer, game->camera, game->renderObjs, game->nRenderObjs, game->dirLight, game->lights, game->nLights, game->jointBuffers, game->window->sfml_window->getSize().x, game->window->sfml_window->getSize().y);
-	// RaymarchRender(game->raymarchRenderer, game->camera);
+	// shaders whose files changed are recompiled, a shader that doesn't compile keeps drawing with its old program
+	ReloadShadersIfUpdated(game->renderer);
+	ReloadDeferredShadersIfUpdated(game->deferredRenderer, game->renderer);
+	ReloadRaymarchShaderIfUpdated(game->raymarchRenderer, game->renderer.state);
+	if(PumpTextureLoader(game->textureLoader, game->renderer.state) > 0) {
+		// textures that finished loading moved from their placeholder to their own array layer
+		UploadMaterialTable(game->renderer.uniformBuffers, game->assets.materials, game->assets.nMaterials);
+	}
+	u32 windowWidth = game->window->sfml_window->getSize().x;
+	u32 windowHeight = game->window->sfml_window->getSize().y;
+	RenderGraph& graph = game->renderGraph;
+	BeginRenderGraph(graph);
+	u32 windowTarget = ImportRenderTarget(graph, "window", 0, 0, windowWidth, windowHeight);
+	MarkRenderGraphOutput(graph, windowTarget);
+	// every pass clears or overwrites its whole target itself
+	u32 scenePass = AddRenderPass(graph, "scene", ScenePass, game);
+	if(game->raymarching) {
+		// the fractal's resolution follows how long its pass took on the gpu a few frames ago
+		DynamicResolution& resolution = game->raymarchRenderer.resolution;
+		UpdateDynamicResolution(resolution, GetGpuZoneTime(game->gpuProfiler, "raymarch"));
+		u32 raymarchWidth, raymarchHeight;
+		GetDynamicResolutionSize(resolution, windowWidth, windowHeight, raymarchWidth, raymarchHeight);
+		// the scene goes to its own target, with depth in alpha, for the fractal to be merged with
+		u32 sceneTarget = CreateRenderTarget(graph, "scene", windowWidth, windowHeight);
+		WriteRenderResource(graph, scenePass, sceneTarget, RENDER_GRAPH_DONT_CARE);
+		// float so the distance along the ray in alpha isn't clamped to [0, 1]
+		u32 raymarchTarget = CreateRenderTarget(graph, "raymarch", raymarchWidth, raymarchHeight, GL_RGBA16F);
+		u32 raymarchPass = AddRenderPass(graph, "raymarch", RaymarchPass, game);
+		WriteRenderResource(graph, raymarchPass, raymarchTarget, RENDER_GRAPH_DONT_CARE);
+		u32 compositePass = AddRenderPass(graph, "raymarch composite", RaymarchCompositePass, game);
+		ReadRenderResource(graph, compositePass, sceneTarget);
+		ReadRenderResource(graph, compositePass, raymarchTarget);
+		WriteRenderResource(graph, compositePass, windowTarget, RENDER_GRAPH_DONT_CARE);
+	}
+	else {
+		WriteRenderResource(graph, scenePass, windowTarget, RENDER_GRAPH_DONT_CARE);
+	}
+	if(CompileRenderGraph(graph)) {
+		ExecuteRenderGraph(graph);
+	}
 	// printf("CAMERA POS: %d %d %d", game->camera.pos.x, game->camera.pos.y, game->camera.pos.z);
-	// TextRender(game->text_renderer, "I FIGHT FOR MY FRIENDS", game->camera, vec3(0,1, 0), vec3(0, 4, 0), .01, 0, 0, 0, game->characters);
+	// everything queued over the frame goes out in one draw
+	// QueueText(game->text_renderer, "I FIGHT FOR MY FRIENDS", v2(16, windowHeight - 48), 1.0f, vec4(0, 1, 0, 1));
+	// mat4 textMatrix = GetTextScreenMatrix(windowWidth, windowHeight);
+	// DrawQueuedText(game->text_renderer, game->renderer.state, textMatrix);
 
 	// glUseProgram(game->testShader);
 	// GLuint u_mvpMatrix = glGetUniformLocation(game->testShader, "u_mvpMatrix");
 	// glUniformMatrix4fv(u_mvpMatrix, 1, GL_FALSE, &game->camera.vpMatrix[0][0]);
 	// glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)(0 * sizeof(IndexType)));
 
-	UpdateWindowDisplay(window);
+	{
+		PROFILE_SCOPE("display");
+		UpdateWindowDisplay(window);
+	}
+
+	RenderStats& stats = game->renderer.state.stats;
+	ProfileCounters counters;
+	counters.drawCalls = stats.drawCalls;
+	counters.triangles = stats.triangles;
+	counters.stateChanges = stats.programBinds + stats.textureBinds + stats.bufferBinds + stats.uniformUploads;
+	counters.allocations = mem.nAllocs - game->profiledAllocs;
+	counters.allocatedBytes = (mem.curLocation - mem.start) - game->profiledBytes;
+	EndProfileFrame(game->profiler, counters);
+#ifdef PROFILE_DUMP_FRAME
+	if(game->profiler.frame == PROFILE_DUMP_FRAME) {
+		WriteChromeTrace(game->profiler, "trace.json");
+	}
+#endif
+}
+// called on the old dll right before it's unloaded for a reload, Reinit starts things up again in the new one
+extern "C" void Unload(Memory& mem) {
+	ReloadableDLL* myDLL = (ReloadableDLL*) (mem.start + sizeof(Window) + sizeof(sf::RenderWindow));
+	Game* game = (Game*) myDLL->mem;
+
+	JoinTextureLoaderWorkers(game->textureLoader);
+	DeinitJobPool(gJobPool);
 }
 extern "C" void Deinit(Memory& mem) {
 	ReloadableDLL* myDLL = (ReloadableDLL*) (mem.start + sizeof(Window) + sizeof(sf::RenderWindow));
 	Game* game = (Game*) myDLL->mem;
 
+	DeinitTextureLoader(game->textureLoader);
 	DeinitAssets(game->assets);
-	DeinitTexture(game->dirLight.shadowMap.texture);
+	DeinitDirLight(game->dirLight);
 	for(u32 i = 0; i < game->nLights; i++) {
 		DeinitTexture(game->lights[i].shadowMap.texture);
 	}
 
 	DeinitGLBuffers(game->vbo, game->ibo);
+	DeinitDeferredRenderer(game->deferredRenderer, game->renderer);
+	DeinitRaymarchRenderer(game->raymarchRenderer, game->renderer.state);
 	DeinitDefaultRenderer(game->renderer);
-	DeinitRaymarchRenderer(game->raymarchRenderer);
+	DeinitTextRenderer(game->text_renderer);
+	DeinitRenderGraph(game->renderGraph);
+	DeinitGpuProfiler(game->gpuProfiler);
+	DeinitJobPool(gJobPool);
 }
 
 /*
@@ -3,6 +3,8 @@
 #include "obj_loader.h"
 #include "dae_loader.h"
 #include "gl_buffers.h"
+#include "meshlet.h"
+#include "texture_loader.h"
 #include "../core/fileio.h"
 
 #define MAX_MODELS 16
@@ -25,8 +27,9 @@ void InitAssets(Assets& assets) {
 }
 
 void DeinitAssets(Assets& assets) {
+	// the texture loader owns the texture arrays
 	for(u32 i = 0; i < assets.nTextures; i++) {
-		DeinitTexture(assets.textures[i].texture);
+		if(assets.textures[i].layer < 0) DeinitTexture(assets.textures[i].texture);
 	}
 }
 
@@ -48,9 +51,11 @@ void LoadModelAsset(Assets& assets, const char* modelPath, VBO& vbo, IBO& ibo, J
 		return;
 	}
 	LoadModelToBuffers(assets.models[assets.nModels], &riggedModel, vbo, ibo, jointBuffers);
+	assets.models[assets.nModels].id = assets.nModels;
 	assets.nModels++;
 }
 
+// a plain GL_TEXTURE_2D, materials need theirs in a texture array (LoadTextureAssetAsync)
 void LoadTextureAsset(Assets& assets, const char* texturePath) {
 	if(assets.nTextures >= MAX_TEXTURES) {
 		printf("exceeded max textures\n");
@@ -60,6 +65,16 @@ void LoadTextureAsset(Assets& assets, const char* texturePath) {
 	assets.nTextures++;
 }
 
+// same as LoadTextureAsset, but the texture is a placeholder until textureLoader has decoded and uploaded it
+void LoadTextureAssetAsync(Assets& assets, TextureLoader& textureLoader, const char* texturePath, TextureUsage usage = TEXTURE_USAGE_COLOR) {
+	if(assets.nTextures >= MAX_TEXTURES) {
+		printf("exceeded max textures\n");
+		return;
+	}
+	LoadTextureAsync(textureLoader, assets.textures[assets.nTextures], texturePath, usage);
+	assets.nTextures++;
+}
+
 void CreateMaterialAsset(Assets& assets, Texture* texture = NULL, Texture* normalMap = NULL, Texture* dispMap = NULL,
 v3 color = v3(1,1,1), r32 shininess = 100.0f, r32 dispMapScale = 0.04f, r32 dispMapOffset = 0.0f, r32 friction = 1.0f) {
 	if(assets.nMaterials > MAX_MATERIALS) {
@@ -67,16 +82,27 @@ v3 color = v3(1,1,1), r32 shininess = 100.0f, r32 dispMapScale = 0.04f, r32 disp
 			return;
 	}
 	InitMaterial(assets.materials[assets.nMaterials], texture, normalMap, dispMap, color, shininess, dispMapScale, dispMapOffset, friction);
+	assets.materials[assets.nMaterials].id = assets.nMaterials;
 	assets.nMaterials++;
 }
 
+// splits every large static model into meshlets, call after loading models and before FillGLBuffers
+void BuildAssetMeshlets(Assets& assets, VBO& vbo, IBO& ibo, MeshletBuffers& meshletBuffers) {
+	for(u32 i = 0; i < assets.nModels; i++) {
+		Model& model = assets.models[i];
+		if(model.numJoints > 0 || model.numIndices / 3 < MESHLET_MIN_TRIANGLES)
+			continue;
+		BuildMeshlets(model, ibo, vbo.vertices, meshletBuffers);
+	}
+}
+
 #ifdef _WIN32
 	#define EXTERNAL_MODELS_FOLDER "C:\\Users\\Noxide\\Downloads\\game_assets\\"
 #else
 	#define EXTERNAL_MODELS_FOLDER "/Users/wyatt/Downloads/"
 #endif
 
-void InitDefaultAssets(Assets& assets, VBO& vbo, IBO& ibo, JointBuffers& jointBuffers) {
+void InitDefaultAssets(Assets& assets, VBO& vbo, IBO& ibo, JointBuffers& jointBuffers, TextureLoader& textureLoader) {
 	// init models
 	LoadModelAsset(assets, "models/square.obj", vbo, ibo, jointBuffers); // 0
 	LoadModelAsset(assets, "models/cube.obj", vbo, ibo, jointBuffers); // 1
@@ -90,18 +116,18 @@ void InitDefaultAssets(Assets& assets, VBO& vbo, IBO& ibo, JointBuffers& jointBu
 	// LoadModelAsset(assets, (string(EXTERNAL_MODELS_FOLDER) + "millenium-falcon.obj").c_str(), vbo, ibo, jointBuffers); // 5
 	// LoadModelAsset(assets, (string(EXTERNAL_MODELS_FOLDER) + "star-wars-vader-tie-fighter.obj").c_str(), vbo, ibo, jointBuffers); // 6
 
-	// init textures
-	LoadTextureAsset(assets, "textures/bark.jpg"); // 0
-	LoadTextureAsset(assets, "textures/bark_normalMap.jpg"); // 1
-	LoadTextureAsset(assets, "textures/pebbles.jpg"); // 2
-	LoadTextureAsset(assets, "textures/pebbles_normalMap.jpg"); // 3
-	LoadTextureAsset(assets, "textures/ike.jpg"); // 4
-	LoadTextureAsset(assets, "textures/bricks.jpg"); // 5
-	LoadTextureAsset(assets, "textures/bricks_normal.jpg"); // 6
-	LoadTextureAsset(assets, "textures/bricks_disp.png"); // 7
-	LoadTextureAsset(assets, "textures/bricks2.jpg"); // 8
-	LoadTextureAsset(assets, "textures/bricks2_normal.jpg"); // 9
-	LoadTextureAsset(assets, "textures/bricks2_disp.jpg"); // 10
+	// init textures, cooked or read in the background and uploaded with their mips over the first frames
+	LoadTextureAssetAsync(assets, textureLoader, "textures/bark.jpg"); // 0
+	LoadTextureAssetAsync(assets, textureLoader, "textures/bark_normalMap.jpg", TEXTURE_USAGE_NORMAL_MAP); // 1
+	LoadTextureAssetAsync(assets, textureLoader, "textures/pebbles.jpg"); // 2
+	LoadTextureAssetAsync(assets, textureLoader, "textures/pebbles_normalMap.jpg", TEXTURE_USAGE_NORMAL_MAP); // 3
+	LoadTextureAssetAsync(assets, textureLoader, "textures/ike.jpg"); // 4
+	LoadTextureAssetAsync(assets, textureLoader, "textures/bricks.jpg"); // 5
+	LoadTextureAssetAsync(assets, textureLoader, "textures/bricks_normal.jpg", TEXTURE_USAGE_NORMAL_MAP); // 6
+	LoadTextureAssetAsync(assets, textureLoader, "textures/bricks_disp.png", TEXTURE_USAGE_DISP_MAP); // 7
+	LoadTextureAssetAsync(assets, textureLoader, "textures/bricks2.jpg"); // 8
+	LoadTextureAssetAsync(assets, textureLoader, "textures/bricks2_normal.jpg", TEXTURE_USAGE_NORMAL_MAP); // 9
+	LoadTextureAssetAsync(assets, textureLoader, "textures/bricks2_disp.jpg", TEXTURE_USAGE_DISP_MAP); // 10
 	//LoadTextureAsset(assets, (string(EXTERNAL_MODELS_FOLDER) + "Monk_Texture.png").c_str()); // 11
 
 	// LoadTextureAsset(assets, (string(EXTERNAL_MODELS_FOLDER) + "falcon.jpg").c_str()"C:\\Users\\Noxide\\Downloads\\falcon.jpg"); // 11
@@ -0,0 +1,347 @@
+#pragma once
+#include <string.h>
+#include <math.h>
+#include "../core/types.h"
+
+/**
+ * cpu block compression for cooking textures, 4x4 texel blocks
+ * BC1: rgb in 8 bytes, two 565 endpoints and 2 bit indices, for opaque color maps
+ * BC3: BC1 color plus a BC4 alpha block, 16 bytes, for color maps with alpha
+ * BC4: one channel in 8 bytes, two 8 bit endpoints and 3 bit indices, for displacement maps
+ * BC5: two BC4 blocks, 16 bytes, for normal maps (z is rebuilt in the shader)
+ * the decoders follow the gpu's interpolation so PSNR can be measured without one
+ */
+
+enum BCFormat {
+	BC1,
+	BC3,
+	BC4,
+	BC5
+};
+
+u32 GetBCBlockSize(BCFormat format) {
+	return format == BC1 || format == BC4 ? 8 : 16;
+}
+
+/** bytes of a width x height image, partial blocks at the edges take a whole block */
+u32 GetBCImageSize(BCFormat format, u32 width, u32 height) {
+	return ((width + 3) / 4) * ((height + 3) / 4) * GetBCBlockSize(format);
+}
+
+// the 4x4 texels of a block as rgba8, texels past the edge repeat the last row / column
+void LoadBCBlock(const u8* pixels, u32 width, u32 height, u32 blockX, u32 blockY, u8 block[16 * 4]) {
+	for(u32 y = 0; y < 4; y++) {
+		u32 py = blockY * 4 + y < height ? blockY * 4 + y : height - 1;
+		for(u32 x = 0; x < 4; x++) {
+			u32 px = blockX * 4 + x < width ? blockX * 4 + x : width - 1;
+			memcpy(block + (y * 4 + x) * 4, pixels + (py * width + px) * 4, 4);
+		}
+	}
+}
+
+//// BC4
+
+// the 8 values a BC4 block's indices pick from
+void GetBC4Palette(u8 r0, u8 r1, u8 palette[8]) {
+	palette[0] = r0;
+	palette[1] = r1;
+	if(r0 > r1) {
+		for(u32 i = 2; i < 8; i++) palette[i] = (u8)(((8 - i) * r0 + (i - 1) * r1 + 3) / 7);
+	}
+	else {
+		for(u32 i = 2; i < 6; i++) palette[i] = (u8)(((6 - i) * r0 + (i - 1) * r1 + 2) / 5);
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+/** channel is which of the 4 bytes of each texel to encode */
+void EncodeBC4Block(const u8 block[16 * 4], u32 channel, u8* out) {
+	u8 minValue = 255, maxValue = 0;
+	for(u32 i = 0; i < 16; i++) {
+		u8 v = block[i * 4 + channel];
+		if(v < minValue) minValue = v;
+		if(v > maxValue) maxValue = v;
+	}
+	// max first so the 8 value mode is used, its evenly spaced values beat the mode with explicit 0 and 255
+	out[0] = maxValue;
+	out[1] = minValue;
+	u8 palette[8];
+	GetBC4Palette(maxValue, minValue, palette);
+	u64 indices = 0;
+	if(maxValue != minValue) {
+		for(u32 i = 0; i < 16; i++) {
+			s32 v = block[i * 4 + channel];
+			u32 best = 0;
+			s32 bestError = 256;
+			for(u32 p = 0; p < 8; p++) {
+				s32 error = abs(v - (s32)palette[p]);
+				if(error < bestError) {
+					bestError = error;
+					best = p;
+				}
+			}
+			indices |= (u64)best << (i * 3);
+		}
+	}
+	for(u32 i = 0; i < 6; i++) {
+		out[2 + i] = (u8)(indices >> (i * 8));
+	}
+}
+
+void DecodeBC4Block(const u8* in, u32 channel, u8 block[16 * 4]) {
+	u8 palette[8];
+	GetBC4Palette(in[0], in[1], palette);
+	u64 indices = 0;
+	for(u32 i = 0; i < 6; i++) {
+		indices |= (u64)in[2 + i] << (i * 8);
+	}
+	for(u32 i = 0; i < 16; i++) {
+		block[i * 4 + channel] = palette[(indices >> (i * 3)) & 7];
+	}
+}
+
+//// BC1
+
+u16 PackRGB565(const r32 color[3]) {
+	u32 r = (u32)(color[0] < 0.0f ? 0.0f : color[0] > 255.0f ? 31.0f : color[0] * 31.0f / 255.0f + 0.5f);
+	u32 g = (u32)(color[1] < 0.0f ? 0.0f : color[1] > 255.0f ? 63.0f : color[1] * 63.0f / 255.0f + 0.5f);
+	u32 b = (u32)(color[2] < 0.0f ? 0.0f : color[2] > 255.0f ? 31.0f : color[2] * 31.0f / 255.0f + 0.5f);
+	return (u16)((r << 11) | (g << 5) | b);
+}
+
+void UnpackRGB565(u16 packed, s32 color[3]) {
+	s32 r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+// 4 color mode when c0 > c1, otherwise 3 colors and transparent black, which the encoder only hits for flat blocks
+void GetBC1Palette(u16 c0, u16 c1, s32 palette[4][3]) {
+	UnpackRGB565(c0, palette[0]);
+	UnpackRGB565(c1, palette[1]);
+	for(u32 c = 0; c < 3; c++) {
+		if(c0 > c1) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+		}
+		else {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+}
+
+// picks the nearest of the first nColors palette colors for each texel, returns the total squared error
+u32 FindBC1Indices(const u8 block[16 * 4], s32 palette[4][3], u32 nColors, u32& indices) {
+	u32 totalError = 0;
+	indices = 0;
+	for(u32 i = 0; i < 16; i++) {
+		u32 best = 0, bestError = 0xffffffff;
+		for(u32 p = 0; p < nColors; p++) {
+			s32 dr = block[i * 4] - palette[p][0], dg = block[i * 4 + 1] - palette[p][1], db = block[i * 4 + 2] - palette[p][2];
+			u32 error = dr * dr + dg * dg + db * db;
+			if(error < bestError) {
+				bestError = error;
+				best = p;
+			}
+		}
+		indices |= best << (i * 2);
+		totalError += bestError;
+	}
+	return totalError;
+}
+
+#define BC1_REFINE_ITERATIONS 2
+
+/**
+ * endpoints start at the ends of the block's principal axis, then get least squares fit to the indices they pick
+ * BC1_REFINE_ITERATIONS times, keeping whichever pair had the least error
+ */
+void EncodeBC1Block(const u8 block[16 * 4], u8* out) {
+	r32 mean[3] = { 0, 0, 0 };
+	for(u32 i = 0; i < 16; i++) {
+		for(u32 c = 0; c < 3; c++) mean[c] += block[i * 4 + c];
+	}
+	for(u32 c = 0; c < 3; c++) mean[c] /= 16.0f;
+	r32 cov[6] = { 0, 0, 0, 0, 0, 0 }; // rr rg rb gg gb bb
+	for(u32 i = 0; i < 16; i++) {
+		r32 r = block[i * 4] - mean[0], g = block[i * 4 + 1] - mean[1], b = block[i * 4 + 2] - mean[2];
+		cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+		cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+	}
+	// power iteration for the principal axis
+	r32 axis[3] = { 1.0f, 1.0f, 1.0f };
+	for(u32 i = 0; i < 8; i++) {
+		r32 x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		r32 y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		r32 z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		r32 len = sqrtf(x * x + y * y + z * z);
+		if(len < 1e-6f) break; // flat block
+		axis[0] = x / len; axis[1] = y / len; axis[2] = z / len;
+	}
+	r32 minT = 0.0f, maxT = 0.0f;
+	for(u32 i = 0; i < 16; i++) {
+		r32 t = (block[i * 4] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] + (block[i * 4 + 2] - mean[2]) * axis[2];
+		if(t < minT) minT = t;
+		if(t > maxT) maxT = t;
+	}
+	r32 e0[3], e1[3];
+	for(u32 c = 0; c < 3; c++) {
+		e0[c] = mean[c] + axis[c] * maxT;
+		e1[c] = mean[c] + axis[c] * minT;
+	}
+
+	u16 bestC0 = 0, bestC1 = 0;
+	u32 bestIndices = 0, bestError = 0xffffffff;
+	for(u32 iteration = 0; iteration <= BC1_REFINE_ITERATIONS; iteration++) {
+		u16 c0 = PackRGB565(e0), c1 = PackRGB565(e1);
+		if(c0 < c1) {
+			u16 temp = c0; c0 = c1; c1 = temp;
+		}
+		s32 palette[4][3];
+		GetBC1Palette(c0, c1, palette);
+		u32 indices;
+		// equal endpoints mean 3 color mode, where index 3 is transparent black
+		u32 error = FindBC1Indices(block, palette, c0 > c1 ? 4 : 3, indices);
+		if(error < bestError) {
+			bestError = error;
+			bestC0 = c0;
+			bestC1 = c1;
+			bestIndices = indices;
+		}
+		if(error == 0 || iteration == BC1_REFINE_ITERATIONS) break;
+
+		// least squares endpoints for these indices, each texel is w * e0 + (1 - w) * e1
+		const r32 weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+		r32 aa = 0, bb = 0, ab = 0;
+		r32 ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+		for(u32 i = 0; i < 16; i++) {
+			r32 w = weights[(indices >> (i * 2)) & 3];
+			aa += w * w;
+			bb += (1 - w) * (1 - w);
+			ab += w * (1 - w);
+			for(u32 c = 0; c < 3; c++) {
+				ax[c] += w * block[i * 4 + c];
+				bx[c] += (1 - w) * block[i * 4 + c];
+			}
+		}
+		r32 det = aa * bb - ab * ab;
+		if(fabsf(det) < 1e-6f) break; // every texel picked the same endpoint
+		for(u32 c = 0; c < 3; c++) {
+			e0[c] = (bb * ax[c] - ab * bx[c]) / det;
+			e1[c] = (aa * bx[c] - ab * ax[c]) / det;
+		}
+	}
+	out[0] = (u8)bestC0; out[1] = (u8)(bestC0 >> 8);
+	out[2] = (u8)bestC1; out[3] = (u8)(bestC1 >> 8);
+	for(u32 i = 0; i < 4; i++) {
+		out[4 + i] = (u8)(bestIndices >> (i * 8));
+	}
+}
+
+void DecodeBC1Block(const u8* in, u8 block[16 * 4]) {
+	u16 c0 = in[0] | (in[1] << 8), c1 = in[2] | (in[3] << 8);
+	s32 palette[4][3];
+	GetBC1Palette(c0, c1, palette);
+	u32 indices = in[4] | (in[5] << 8) | (in[6] << 16) | ((u32)in[7] << 24);
+	for(u32 i = 0; i < 16; i++) {
+		u32 index = (indices >> (i * 2)) & 3;
+		for(u32 c = 0; c < 3; c++) block[i * 4 + c] = (u8)palette[index][c];
+		block[i * 4 + 3] = c0 <= c1 && index == 3 ? 0 : 255;
+	}
+}
+
+//// images
+
+void EncodeBCBlock(BCFormat format, const u8 block[16 * 4], u8* out) {
+	switch(format) {
+		case BC1: EncodeBC1Block(block, out); break;
+		case BC3: EncodeBC4Block(block, 3, out); EncodeBC1Block(block, out + 8); break;
+		case BC4: EncodeBC4Block(block, 0, out); break;
+		case BC5: EncodeBC4Block(block, 0, out); EncodeBC4Block(block, 1, out + 8); break;
+	}
+}
+
+/** decodes to rgba8, channels a format doesn't store come back as 0 for g and b and 255 for alpha */
+void DecodeBCBlock(BCFormat format, const u8* in, u8 block[16 * 4]) {
+	for(u32 i = 0; i < 16; i++) {
+		block[i * 4] = block[i * 4 + 1] = block[i * 4 + 2] = 0;
+		block[i * 4 + 3] = 255;
+	}
+	switch(format) {
+		case BC1: DecodeBC1Block(in, block); break;
+		case BC3: DecodeBC1Block(in + 8, block); DecodeBC4Block(in, 3, block); break;
+		case BC4: DecodeBC4Block(in, 0, block); break;
+		case BC5: DecodeBC4Block(in, 0, block); DecodeBC4Block(in + 8, 1, block); break;
+	}
+}
+
+/** out has to hold GetBCImageSize bytes, blocks are stored row by row starting at the bottom left like the pixels */
+void EncodeBCImage(BCFormat format, const u8* pixels, u32 width, u32 height, u8* out) {
+	u32 blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+	u32 blockSize = GetBCBlockSize(format);
+	u8 block[16 * 4];
+	for(u32 by = 0; by < blocksHigh; by++) {
+		for(u32 bx = 0; bx < blocksWide; bx++) {
+			LoadBCBlock(pixels, width, height, bx, by, block);
+			EncodeBCBlock(format, block, out + (by * blocksWide + bx) * blockSize);
+		}
+	}
+}
+
+void DecodeBCImage(BCFormat format, const u8* in, u32 width, u32 height, u8* pixels) {
+	u32 blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+	u32 blockSize = GetBCBlockSize(format);
+	u8 block[16 * 4];
+	for(u32 by = 0; by < blocksHigh; by++) {
+		for(u32 bx = 0; bx < blocksWide; bx++) {
+			DecodeBCBlock(format, in + (by * blocksWide + bx) * blockSize, block);
+			for(u32 y = 0; y < 4 && by * 4 + y < height; y++) {
+				for(u32 x = 0; x < 4 && bx * 4 + x < width; x++) {
+					memcpy(pixels + ((by * 4 + y) * width + bx * 4 + x) * 4, block + (y * 4 + x) * 4, 4);
+				}
+			}
+		}
+	}
+}
+
+/** peak signal to noise ratio in dB over the channels set in channelMask (bit 0 is r), higher is better */
+r64 ComputePSNR(const u8* a, const u8* b, u32 nTexels, u32 channelMask) {
+	r64 squaredError = 0;
+	u32 nValues = 0;
+	for(u32 i = 0; i < nTexels; i++) {
+		for(u32 c = 0; c < 4; c++) {
+			if(!(channelMask & (1 << c))) continue;
+			r64 d = (r64)a[i * 4 + c] - b[i * 4 + c];
+			squaredError += d * d;
+			nValues++;
+		}
+	}
+	if(squaredError == 0) return 99.0;
+	return 10.0 * log10(255.0 * 255.0 / (squaredError / nValues));
+}
+
+// simple unit test, measures quality and speed of each format on a texture, no gpu needed
+// #include <chrono>
+// #include "texture.h"
+// int main(int argc, char** argv) {
+// 	const char* path = argc > 1 ? argv[1] : "textures/bricks.jpg";
+// 	int width, height, numComponents;
+// 	u8* pixels = stbi_load(path, &width, &height, &numComponents, 4);
+// 	if(pixels == NULL) return 1;
+// 	u8* encoded = (u8*)malloc(GetBCImageSize(BC3, width, height));
+// 	u8* decoded = (u8*)malloc(width * height * 4);
+// 	const char* names[] = { "BC1", "BC3", "BC4", "BC5" };
+// 	const u32 channels[] = { 0x7, 0xf, 0x1, 0x3 };
+// 	for(u32 format = BC1; format <= BC5; format++) {
+// 		auto start = std::chrono::steady_clock::now();
+// 		EncodeBCImage((BCFormat)format, pixels, width, height, encoded);
+// 		r64 seconds = std::chrono::duration<r64>(std::chrono::steady_clock::now() - start).count();
+// 		DecodeBCImage((BCFormat)format, encoded, width, height, decoded);
+// 		printf("%s: %.2f dB, %.1f Mtexels/s\n", names[format], ComputePSNR(pixels, decoded, width * height, channels[format]),
+// 			width * height / seconds / 1000000.0);
+// 	}
+// 	return 0;
+// }
@@ -0,0 +1,331 @@
+#pragma once
+#include "../core/types.h"
+#include "render_obj.h"
+#include "frustum.h"
+
+// dynamic aabb tree over render objs (same idea as box2d's b2DynamicTree)
+// leaves store a "fat" aabb grown by BVH_FAT_MARGIN, so objects that move a little don't touch the tree at all
+// and ones that leave their fat aabb get removed and reinserted, refitting and rebalancing their ancestors
+
+#define MAX_BVH_OBJECTS 8192
+#define MAX_BVH_NODES (2 * MAX_BVH_OBJECTS)
+#define BVH_NULL_NODE -1
+#define BVH_FAT_MARGIN 0.1f
+
+struct BVHNode {
+	vec3 minExtents, maxExtents;
+	s32 parent; // next free node while the node is on the free list
+	s32 left, right; // BVH_NULL_NODE for leaves
+	s32 height; // 0 for leaves
+	s32 objIndex; // leaves only
+};
+
+struct BVH {
+	s32 root;
+	s32 freeList;
+	u32 nNodes; // nodes handed out so far, free ones included
+	BVHNode nodes[MAX_BVH_NODES];
+
+	u32 nObjs;
+	s32 leafOfObj[MAX_BVH_OBJECTS];
+};
+
+void InitBVH(BVH& bvh) {
+	bvh.root = BVH_NULL_NODE;
+	bvh.freeList = BVH_NULL_NODE;
+	bvh.nNodes = 0;
+	bvh.nObjs = 0;
+}
+
+s32 AllocBVHNode(BVH& bvh) {
+	s32 index;
+	if(bvh.freeList != BVH_NULL_NODE) {
+		index = bvh.freeList;
+		bvh.freeList = bvh.nodes[index].parent;
+	}
+	else {
+		if(bvh.nNodes >= MAX_BVH_NODES) {
+			printf("exceeded max bvh nodes\n");
+			exit(1);
+		}
+		index = bvh.nNodes++;
+	}
+	BVHNode& node = bvh.nodes[index];
+	node.parent = BVH_NULL_NODE;
+	node.left = BVH_NULL_NODE;
+	node.right = BVH_NULL_NODE;
+	node.height = 0;
+	node.objIndex = -1;
+	return index;
+}
+
+void FreeBVHNode(BVH& bvh, s32 index) {
+	bvh.nodes[index].parent = bvh.freeList;
+	bvh.nodes[index].height = -1;
+	bvh.freeList = index;
+}
+
+r32 AABBSurfaceArea(vec3 minExtents, vec3 maxExtents) {
+	vec3 d = maxExtents - minExtents;
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+bool AABBContains(vec3 outerMin, vec3 outerMax, vec3 innerMin, vec3 innerMax) {
+	return outerMin.x <= innerMin.x && outerMin.y <= innerMin.y && outerMin.z <= innerMin.z
+		&& outerMax.x >= innerMax.x && outerMax.y >= innerMax.y && outerMax.z >= innerMax.z;
+}
+
+void FitBVHNode(BVH& bvh, s32 index) {
+	BVHNode& node = bvh.nodes[index];
+	BVHNode& left = bvh.nodes[node.left];
+	BVHNode& right = bvh.nodes[node.right];
+	node.minExtents = min(left.minExtents, right.minExtents);
+	node.maxExtents = max(left.maxExtents, right.maxExtents);
+	node.height = 1 + (left.height > right.height ? left.height : right.height);
+}
+
+// rotates the taller grandchild up if a's children are out of balance, returns the index of the new subtree root
+s32 BalanceBVHNode(BVH& bvh, s32 iA) {
+	BVHNode& a = bvh.nodes[iA];
+	if(a.left == BVH_NULL_NODE) {
+		return iA;
+	}
+	s32 iB = a.left;
+	s32 iC = a.right;
+	s32 balance = bvh.nodes[iC].height - bvh.nodes[iB].height;
+	if(balance > 1 || balance < -1) {
+		// rotate the taller child (iUp) up, a becomes its child
+		s32 iUp = balance > 1 ? iC : iB;
+		s32 iOther = balance > 1 ? iB : iC;
+		BVHNode& up = bvh.nodes[iUp];
+		s32 iF = up.left;
+		s32 iG = up.right;
+
+		up.left = iA;
+		up.parent = a.parent;
+		a.parent = iUp;
+		if(up.parent != BVH_NULL_NODE) {
+			BVHNode& parent = bvh.nodes[up.parent];
+			if(parent.left == iA) parent.left = iUp;
+			else parent.right = iUp;
+		}
+		else {
+			bvh.root = iUp;
+		}
+
+		// the taller grandchild stays under up, the shorter one replaces up under a
+		s32 iKeep = bvh.nodes[iF].height > bvh.nodes[iG].height ? iF : iG;
+		s32 iMove = iKeep == iF ? iG : iF;
+		up.right = iKeep;
+		a.left = iOther;
+		a.right = iMove;
+		bvh.nodes[iMove].parent = iA;
+		FitBVHNode(bvh, iA);
+		FitBVHNode(bvh, iUp);
+		return iUp;
+	}
+	return iA;
+}
+
+// refits and rebalances from index up to the root
+void RefitBVHAncestors(BVH& bvh, s32 index) {
+	while(index != BVH_NULL_NODE) {
+		index = BalanceBVHNode(bvh, index);
+		FitBVHNode(bvh, index);
+		index = bvh.nodes[index].parent;
+	}
+}
+
+void InsertBVHLeaf(BVH& bvh, s32 leaf) {
+	if(bvh.root == BVH_NULL_NODE) {
+		bvh.root = leaf;
+		bvh.nodes[leaf].parent = BVH_NULL_NODE;
+		return;
+	}
+
+	// walk down to the sibling that grows the tree's surface area the least
+	vec3 leafMin = bvh.nodes[leaf].minExtents;
+	vec3 leafMax = bvh.nodes[leaf].maxExtents;
+	s32 index = bvh.root;
+	while(bvh.nodes[index].left != BVH_NULL_NODE) {
+		BVHNode& node = bvh.nodes[index];
+		r32 area = AABBSurfaceArea(node.minExtents, node.maxExtents);
+		r32 combinedArea = AABBSurfaceArea(min(node.minExtents, leafMin), max(node.maxExtents, leafMax));
+		// cost of making a new parent for this node and the leaf
+		r32 cost = 2.0f * combinedArea;
+		// minimum cost of pushing the leaf further down
+		r32 inheritanceCost = 2.0f * (combinedArea - area);
+
+		r32 childCosts[2];
+		s32 children[2] = { node.left, node.right };
+		for(u32 c = 0; c < 2; c++) {
+			BVHNode& child = bvh.nodes[children[c]];
+			r32 childArea = AABBSurfaceArea(min(child.minExtents, leafMin), max(child.maxExtents, leafMax));
+			if(child.left == BVH_NULL_NODE) {
+				childCosts[c] = childArea + inheritanceCost;
+			}
+			else {
+				childCosts[c] = childArea - AABBSurfaceArea(child.minExtents, child.maxExtents) + inheritanceCost;
+			}
+		}
+		if(cost < childCosts[0] && cost < childCosts[1]) {
+			break;
+		}
+		index = childCosts[0] < childCosts[1] ? children[0] : children[1];
+	}
+
+	// new parent for the sibling and the leaf
+	s32 sibling = index;
+	s32 oldParent = bvh.nodes[sibling].parent;
+	s32 newParent = AllocBVHNode(bvh);
+	bvh.nodes[newParent].parent = oldParent;
+	bvh.nodes[newParent].left = sibling;
+	bvh.nodes[newParent].right = leaf;
+	bvh.nodes[sibling].parent = newParent;
+	bvh.nodes[leaf].parent = newParent;
+	if(oldParent != BVH_NULL_NODE) {
+		if(bvh.nodes[oldParent].left == sibling) bvh.nodes[oldParent].left = newParent;
+		else bvh.nodes[oldParent].right = newParent;
+	}
+	else {
+		bvh.root = newParent;
+	}
+	RefitBVHAncestors(bvh, newParent);
+}
+
+void RemoveBVHLeaf(BVH& bvh, s32 leaf) {
+	if(leaf == bvh.root) {
+		bvh.root = BVH_NULL_NODE;
+		return;
+	}
+	// the sibling takes the parent's place
+	s32 parent = bvh.nodes[leaf].parent;
+	s32 grandParent = bvh.nodes[parent].parent;
+	s32 sibling = bvh.nodes[parent].left == leaf ? bvh.nodes[parent].right : bvh.nodes[parent].left;
+	bvh.nodes[sibling].parent = grandParent;
+	if(grandParent != BVH_NULL_NODE) {
+		if(bvh.nodes[grandParent].left == parent) bvh.nodes[grandParent].left = sibling;
+		else bvh.nodes[grandParent].right = sibling;
+		RefitBVHAncestors(bvh, grandParent);
+	}
+	else {
+		bvh.root = sibling;
+	}
+	FreeBVHNode(bvh, parent);
+}
+
+void InsertBVHObject(BVH& bvh, u32 objIndex, vec3 minExtents, vec3 maxExtents) {
+	if(objIndex >= MAX_BVH_OBJECTS) {
+		printf("exceeded max bvh objects\n");
+		exit(1);
+	}
+	s32 leaf = AllocBVHNode(bvh);
+	BVHNode& node = bvh.nodes[leaf];
+	node.objIndex = objIndex;
+	node.minExtents = minExtents - vec3(BVH_FAT_MARGIN);
+	node.maxExtents = maxExtents + vec3(BVH_FAT_MARGIN);
+	bvh.leafOfObj[objIndex] = leaf;
+	InsertBVHLeaf(bvh, leaf);
+}
+
+/** returns true if the object left its fat aabb and had to be reinserted */
+bool UpdateBVHObject(BVH& bvh, u32 objIndex, vec3 minExtents, vec3 maxExtents) {
+	s32 leaf = bvh.leafOfObj[objIndex];
+	BVHNode& node = bvh.nodes[leaf];
+	if(AABBContains(node.minExtents, node.maxExtents, minExtents, maxExtents)) {
+		return false;
+	}
+	RemoveBVHLeaf(bvh, leaf);
+	node.minExtents = minExtents - vec3(BVH_FAT_MARGIN);
+	node.maxExtents = maxExtents + vec3(BVH_FAT_MARGIN);
+	InsertBVHLeaf(bvh, leaf);
+	return true;
+}
+
+/** inserts render objs the tree hasn't seen yet and updates the ones that moved since the last sync */
+void SyncBVH(BVH& bvh, RenderObj* renderObjs, u32 nRenderObjs) {
+	for(u32 i = 0; i < bvh.nObjs && i < nRenderObjs; i++) {
+		RenderObj& obj = renderObjs[i];
+		if(obj.moved) {
+			UpdateBVHObject(bvh, i, obj.minExtents, obj.maxExtents);
+			obj.moved = false;
+		}
+	}
+	for(u32 i = bvh.nObjs; i < nRenderObjs; i++) {
+		InsertBVHObject(bvh, i, renderObjs[i].minExtents, renderObjs[i].maxExtents);
+		renderObjs[i].moved = false;
+	}
+	if(nRenderObjs > bvh.nObjs) {
+		bvh.nObjs = nRenderObjs;
+	}
+}
+
+void AddBVHSubtree(BVH& bvh, s32 index, u32* visible, u32& nVisible) {
+	BVHNode& node = bvh.nodes[index];
+	if(node.left == BVH_NULL_NODE) {
+		visible[nVisible++] = node.objIndex;
+		return;
+	}
+	AddBVHSubtree(bvh, node.left, visible, nVisible);
+	AddBVHSubtree(bvh, node.right, visible, nVisible);
+}
+
+/**
+ * fills visible with the indices of objects whose fat aabbs touch the frustum, returns how many there are
+ * visible has to fit MAX_BVH_OBJECTS
+ */
+u32 CullBVH(BVH& bvh, const Frustum& frustum, u32* visible) {
+	u32 nVisible = 0;
+	if(bvh.root == BVH_NULL_NODE) {
+		return 0;
+	}
+	FrustumSoA soa;
+	ToFrustumSoA(frustum, soa);
+
+	// tree height stays around log2 of the object count thanks to balancing, so this is plenty
+	s32 stack[256];
+	u32 stackSize = 0;
+	stack[stackSize++] = bvh.root;
+	while(stackSize > 0) {
+		s32 index = stack[--stackSize];
+		BVHNode& node = bvh.nodes[index];
+		FrustumTestResult result = TestAABBFrustum(soa, node.minExtents, node.maxExtents);
+		if(result == FRUSTUM_OUTSIDE) {
+			continue;
+		}
+		if(result == FRUSTUM_INSIDE || node.left == BVH_NULL_NODE) {
+			AddBVHSubtree(bvh, index, visible, nVisible);
+			continue;
+		}
+		stack[stackSize++] = node.left;
+		stack[stackSize++] = node.right;
+	}
+	return nVisible;
+}
+
+// simple unit test (no gl context needed)
+
+// int main() {
+// 	static BVH bvh; static RenderObj objs[1000]; static u32 visible[MAX_BVH_OBJECTS];
+// 	Model model = {};
+// 	model.minExtents = vec3(-0.5f);
+// 	model.maxExtents = vec3(0.5f);
+// 	for(u32 i = 0; i < 1000; i++) {
+// 		objs[i].model = &model;
+// 		objs[i].transform.scale = vec3(1);
+// 		objs[i].transform.pos = vec3((i % 32) * 3.0f - 48.0f, 0, (i / 32) * 3.0f - 48.0f);
+// 		UpdateMatrices(objs[i]);
+// 	}
+// 	InitBVH(bvh);
+// 	SyncBVH(bvh, objs, 1000);
+// 	Frustum frustum;
+// 	ExtractFrustumPlanes(frustum, perspective(radians(60.0f), 1.0f, 0.1f, 50.0f) * lookAt(vec3(0, 1, 0), vec3(0, 1, -1), vec3(0, 1, 0)));
+// 	u32 nVisible = CullBVH(bvh, frustum, visible);
+// 	u32 nBruteForce = 0;
+// 	for(u32 i = 0; i < 1000; i++) {
+// 		BVHNode& leaf = bvh.nodes[bvh.leafOfObj[i]];
+// 		nBruteForce += AABBInFrustum(frustum, leaf.minExtents, leaf.maxExtents);
+// 	}
+// 	printf("visible: %d brute force: %d (should match)\n", nVisible, nBruteForce);
+// 	return 0;
+// }
@@ -1,11 +0,0 @@
-
-#pragma once
-#include <glm/glm.hpp>
-
-struct Character
-{
-    unsigned int TextureID;  // ID handle of the glyph texture
-    glm::ivec2   Size;       // Size of glyph
-    glm::ivec2   Bearing;    // Offset from baseline to left/top of glyph
-    unsigned int Advance;    // Offset to advance to next glyph
-};
\ No newline at end of file
@@ -0,0 +1,345 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../core/types.h"
+#include "bc_encoder.h"
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define COOKED_TEXTURE_SSE
+#endif
+
+/**
+ * a .ctex file is a texture ready to upload, its whole mip chain in the format it gets uploaded in
+ * textures are cooked next to the image they come from (bricks.jpg -> bricks.jpg.ctex) the first time they're loaded,
+ * and again whenever the image is newer, see LoadCookedTexture in texture.h
+ * mips are 2x2 box filtered in linear space, gamma correct for color maps and renormalized for normal maps,
+ * then block compressed by usage: BC1 (BC3 with alpha) for color maps, BC5 for normal maps and BC4 for displacement maps
+ */
+
+#define CTEX_MAGIC 0x58455443 // "CTEX"
+#define CTEX_VERSION 2
+#define CTEX_EXTENSION ".ctex"
+#define MAX_TEXTURE_MIPS 16 // enough for 32k x 32k
+
+// what a texture is used for, picks how it's filtered, cooked and what stands in for it while loading
+enum TextureUsage {
+	TEXTURE_USAGE_COLOR, // srgb encoded
+	TEXTURE_USAGE_NORMAL_MAP, // tangent space normals in rgb
+	TEXTURE_USAGE_DISP_MAP, // height in r
+	NUM_TEXTURE_USAGES
+};
+
+// the block compressed ones are in the same order as BCFormat
+enum CookedTextureFormat {
+	CTEX_FORMAT_RGBA8,
+	CTEX_FORMAT_BC1,
+	CTEX_FORMAT_BC3,
+	CTEX_FORMAT_BC4,
+	CTEX_FORMAT_BC5
+};
+
+struct CookedTextureHeader {
+	u32 magic;
+	u32 version;
+	u32 format; // CookedTextureFormat
+	u32 usage; // TextureUsage
+	u32 width, height;
+	u32 nMips;
+	u32 mipOffsets[MAX_TEXTURE_MIPS]; // into data
+	u32 mipSizes[MAX_TEXTURE_MIPS];
+};
+
+struct CookedTexture {
+	CookedTextureHeader header;
+	u8* data; // malloced, the mips back to back starting with the largest
+};
+
+u32 GetMipSize(u32 size, u32 mip) {
+	u32 mipSize = size >> mip;
+	return mipSize == 0 ? 1 : mipSize;
+}
+
+u32 GetNumMips(u32 width, u32 height) {
+	u32 nMips = 1;
+	while((width >> nMips) > 0 || (height >> nMips) > 0) nMips++;
+	return nMips;
+}
+
+bool IsBlockCompressed(u32 format) {
+	return format != CTEX_FORMAT_RGBA8;
+}
+
+// texel rows in a row of data, block compressed formats store rows of 4x4 blocks
+u32 GetCookedRowTexels(u32 format) {
+	return IsBlockCompressed(format) ? 4 : 1;
+}
+
+u32 GetCookedRowSize(u32 format, u32 width) {
+	return IsBlockCompressed(format) ? GetBCImageSize((BCFormat)(format - CTEX_FORMAT_BC1), width, 1) : width * 4;
+}
+
+u32 GetCookedNumRows(u32 format, u32 height) {
+	return (height + GetCookedRowTexels(format) - 1) / GetCookedRowTexels(format);
+}
+
+// srgb <-> linear lookups, built the first time any thread asks for them
+#define LINEAR_TO_SRGB_TABLE_SIZE 8192
+struct SrgbTables {
+	r32 toLinear[256];
+	u8 fromLinear[LINEAR_TO_SRGB_TABLE_SIZE];
+
+	SrgbTables() {
+		for(u32 i = 0; i < 256; i++) {
+			r32 c = i / 255.0f;
+			toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for(u32 i = 0; i < LINEAR_TO_SRGB_TABLE_SIZE; i++) {
+			r32 l = i / (r32)(LINEAR_TO_SRGB_TABLE_SIZE - 1);
+			r32 c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+			fromLinear[i] = (u8)(c * 255.0f + 0.5f);
+		}
+	}
+};
+
+SrgbTables& GetSrgbTables() {
+	static SrgbTables tables;
+	return tables;
+}
+
+// one row of rgba8 texels to floats, rgb through the srgb table for color maps
+void DecodeTexelRow(const u8* src, r32* dst, u32 width, TextureUsage usage) {
+	const r32* toLinear = GetSrgbTables().toLinear;
+	for(u32 x = 0; x < width * 4; x += 4) {
+		for(u32 c = 0; c < 3; c++) {
+			dst[x + c] = usage == TEXTURE_USAGE_COLOR ? toLinear[src[x + c]] : src[x + c] / 255.0f;
+		}
+		dst[x + 3] = src[x + 3] / 255.0f;
+	}
+}
+
+void EncodeTexelRow(const r32* src, u8* dst, u32 width, TextureUsage usage) {
+	const u8* fromLinear = GetSrgbTables().fromLinear;
+	for(u32 x = 0; x < width * 4; x += 4) {
+		r32 texel[4] = { src[x], src[x + 1], src[x + 2], src[x + 3] };
+		if(usage == TEXTURE_USAGE_NORMAL_MAP) {
+			// averaging shortens the normals, which would darken the lighting on distant surfaces
+			vec3 n = vec3(texel[0], texel[1], texel[2]) * 2.0f - 1.0f;
+			r32 len = length(n);
+			n = len > 0.0f ? n / len : vec3(0, 0, 1);
+			texel[0] = n.x * 0.5f + 0.5f;
+			texel[1] = n.y * 0.5f + 0.5f;
+			texel[2] = n.z * 0.5f + 0.5f;
+		}
+		for(u32 c = 0; c < 4; c++) {
+			r32 v = texel[c] < 0.0f ? 0.0f : texel[c] > 1.0f ? 1.0f : texel[c];
+			if(usage == TEXTURE_USAGE_COLOR && c < 3)
+				dst[x + c] = fromLinear[(u32)(v * (LINEAR_TO_SRGB_TABLE_SIZE - 1) + 0.5f)];
+			else
+				dst[x + c] = (u8)(v * 255.0f + 0.5f);
+		}
+	}
+}
+
+/** averages 2x2 texels of the src rows into dst, odd sizes repeat the last row / column */
+void DownsampleTexelRows(const r32* row0, const r32* row1, r32* dst, u32 srcWidth, u32 dstWidth) {
+	for(u32 x = 0; x < dstWidth; x++) {
+		u32 x0 = 2 * x * 4;
+		u32 x1 = (2 * x + 1 < srcWidth ? 2 * x + 1 : srcWidth - 1) * 4;
+#ifdef COOKED_TEXTURE_SSE
+		__m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(row0 + x0), _mm_loadu_ps(row0 + x1)),
+			_mm_add_ps(_mm_loadu_ps(row1 + x0), _mm_loadu_ps(row1 + x1)));
+		_mm_storeu_ps(dst + x * 4, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+		for(u32 c = 0; c < 4; c++) {
+			dst[x * 4 + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]) * 0.25f;
+		}
+#endif
+	}
+}
+
+// fills in the mip offsets and sizes of the header's format, returns the total size
+u32 LayoutCookedMips(CookedTextureHeader& header) {
+	u32 dataSize = 0;
+	for(u32 mip = 0; mip < MAX_TEXTURE_MIPS; mip++) {
+		header.mipOffsets[mip] = dataSize;
+		header.mipSizes[mip] = mip < header.nMips ?
+			GetCookedRowSize(header.format, GetMipSize(header.width, mip)) * GetCookedNumRows(header.format, GetMipSize(header.height, mip)) : 0;
+		dataSize += header.mipSizes[mip];
+	}
+	return dataSize;
+}
+
+/** block compresses every mip of an rgba8 cooked texture */
+void CompressCookedTexture(CookedTexture& cooked, CookedTextureFormat format) {
+	CookedTextureHeader& header = cooked.header;
+	CookedTextureHeader rgbaHeader = header;
+	header.format = format;
+	u8* data = (u8*)malloc(LayoutCookedMips(header));
+	for(u32 mip = 0; mip < header.nMips; mip++) {
+		EncodeBCImage((BCFormat)(format - CTEX_FORMAT_BC1), cooked.data + rgbaHeader.mipOffsets[mip],
+			GetMipSize(header.width, mip), GetMipSize(header.height, mip), data + header.mipOffsets[mip]);
+	}
+	free(cooked.data);
+	cooked.data = data;
+}
+
+/** back to rgba8, for when the gpu can't sample the compressed format */
+void DecompressCookedTexture(CookedTexture& cooked) {
+	CookedTextureHeader& header = cooked.header;
+	CookedTextureHeader compressedHeader = header;
+	header.format = CTEX_FORMAT_RGBA8;
+	u8* data = (u8*)malloc(LayoutCookedMips(header));
+	for(u32 mip = 0; mip < header.nMips; mip++) {
+		DecodeBCImage((BCFormat)(compressedHeader.format - CTEX_FORMAT_BC1), cooked.data + compressedHeader.mipOffsets[mip],
+			GetMipSize(header.width, mip), GetMipSize(header.height, mip), data + header.mipOffsets[mip]);
+	}
+	free(cooked.data);
+	cooked.data = data;
+}
+
+// rgba8 mips 1 and up of a cooked texture whose mip 0 is pixels
+void GenerateCookedMips(CookedTexture& cooked, const u8* pixels, TextureUsage usage) {
+	CookedTextureHeader& header = cooked.header;
+	u32 width = header.width, height = header.height;
+	// mip 1 from the source rows, then each mip from the float copy of the one above it
+	u32 mipWidth = GetMipSize(width, 1), mipHeight = GetMipSize(height, 1);
+	r32* srcRows = (r32*)malloc(width * 2 * 4 * sizeof(r32));
+	r32* mipTexels = (r32*)malloc(mipWidth * mipHeight * 4 * sizeof(r32));
+	r32* nextMipTexels = (r32*)malloc(mipWidth * mipHeight * 4 * sizeof(r32));
+	for(u32 y = 0; y < mipHeight; y++) {
+		u32 y1 = 2 * y + 1 < height ? 2 * y + 1 : height - 1;
+		DecodeTexelRow(pixels + 2 * y * width * 4, srcRows, width, usage);
+		DecodeTexelRow(pixels + y1 * width * 4, srcRows + width * 4, width, usage);
+		DownsampleTexelRows(srcRows, srcRows + width * 4, mipTexels + y * mipWidth * 4, width, mipWidth);
+	}
+	for(u32 mip = 1; mip < header.nMips; mip++) {
+		u32 w = GetMipSize(width, mip), h = GetMipSize(height, mip);
+		if(mip > 1) {
+			u32 srcWidth = GetMipSize(width, mip - 1), srcHeight = GetMipSize(height, mip - 1);
+			for(u32 y = 0; y < h; y++) {
+				u32 y1 = 2 * y + 1 < srcHeight ? 2 * y + 1 : srcHeight - 1;
+				DownsampleTexelRows(mipTexels + 2 * y * srcWidth * 4, mipTexels + y1 * srcWidth * 4, nextMipTexels + y * w * 4, srcWidth, w);
+			}
+			r32* temp = mipTexels;
+			mipTexels = nextMipTexels;
+			nextMipTexels = temp;
+		}
+		for(u32 y = 0; y < h; y++) {
+			EncodeTexelRow(mipTexels + y * w * 4, cooked.data + header.mipOffsets[mip] + y * w * 4, w, usage);
+		}
+	}
+	free(srcRows);
+	free(mipTexels);
+	free(nextMipTexels);
+}
+
+/**
+ * cooks rgba8 pixels into a full mip chain, mips are filtered from the float mip above them so rounding doesn't add up
+ * compress picks the block compressed format for the usage, free with DeinitCookedTexture
+ */
+void CookTexture(CookedTexture& cooked, const u8* pixels, u32 width, u32 height, TextureUsage usage, bool compress = true) {
+	CookedTextureHeader& header = cooked.header;
+	header.magic = CTEX_MAGIC;
+	header.version = CTEX_VERSION;
+	header.format = CTEX_FORMAT_RGBA8;
+	header.usage = usage;
+	header.width = width;
+	header.height = height;
+	header.nMips = GetNumMips(width, height);
+	cooked.data = (u8*)malloc(LayoutCookedMips(header));
+	memcpy(cooked.data, pixels, header.mipSizes[0]);
+	if(header.nMips > 1) {
+		GenerateCookedMips(cooked, pixels, usage);
+	}
+	if(!compress) return;
+
+	CookedTextureFormat format = CTEX_FORMAT_BC1;
+	if(usage == TEXTURE_USAGE_NORMAL_MAP) {
+		format = CTEX_FORMAT_BC5;
+	}
+	else if(usage == TEXTURE_USAGE_DISP_MAP) {
+		format = CTEX_FORMAT_BC4;
+	}
+	else {
+		for(u32 i = 0; i < width * height; i++) {
+			if(pixels[i * 4 + 3] != 255) {
+				format = CTEX_FORMAT_BC3;
+				break;
+			}
+		}
+	}
+	CompressCookedTexture(cooked, format);
+}
+
+void DeinitCookedTexture(CookedTexture& cooked) {
+	free(cooked.data);
+	cooked.data = NULL;
+}
+
+u32 GetCookedTextureDataSize(CookedTexture& cooked) {
+	CookedTextureHeader& header = cooked.header;
+	return header.mipOffsets[header.nMips - 1] + header.mipSizes[header.nMips - 1];
+}
+
+bool WriteCookedTexture(CookedTexture& cooked, const char* path) {
+	FILE* file = fopen(path, "wb");
+	if(file == NULL) {
+		printf("Unable to write cooked texture: %s\n", path);
+		return false;
+	}
+	u32 dataSize = GetCookedTextureDataSize(cooked);
+	bool written = fwrite(&cooked.header, sizeof(CookedTextureHeader), 1, file) == 1 && fwrite(cooked.data, 1, dataSize, file) == dataSize;
+	fclose(file);
+	if(!written) {
+		printf("Unable to write cooked texture: %s\n", path);
+		remove(path);
+	}
+	return written;
+}
+
+/** false if the file is missing or from an older version of the cooker, free with DeinitCookedTexture */
+bool ReadCookedTexture(CookedTexture& cooked, const char* path) {
+	cooked.data = NULL;
+	FILE* file = fopen(path, "rb");
+	if(file == NULL) return false;
+	CookedTextureHeader& header = cooked.header;
+	if(fread(&header, sizeof(CookedTextureHeader), 1, file) != 1 || header.magic != CTEX_MAGIC || header.version != CTEX_VERSION
+	|| header.nMips == 0 || header.nMips > MAX_TEXTURE_MIPS) {
+		fclose(file);
+		return false;
+	}
+	u32 dataSize = GetCookedTextureDataSize(cooked);
+	cooked.data = (u8*)malloc(dataSize);
+	bool read = fread(cooked.data, 1, dataSize, file) == dataSize;
+	fclose(file);
+	if(!read) {
+		DeinitCookedTexture(cooked);
+	}
+	return read;
+}
+
+// simple unit test
+// int main() {
+// 	// a 1 pixel checkerboard averages to 50% linear, which is 188 in srgb rather than 128
+// 	u8 pixels[8 * 8 * 4];
+// 	for(u32 i = 0; i < 8 * 8; i++) {
+// 		u8 v = ((i % 8) + (i / 8)) % 2 == 0 ? 255 : 0;
+// 		pixels[i * 4] = pixels[i * 4 + 1] = pixels[i * 4 + 2] = v;
+// 		pixels[i * 4 + 3] = 255;
+// 	}
+// 	CookedTexture cooked;
+// 	CookTexture(cooked, pixels, 8, 8, TEXTURE_USAGE_COLOR, false);
+// 	for(u32 mip = 0; mip < cooked.header.nMips; mip++) {
+// 		u8* texel = cooked.data + cooked.header.mipOffsets[mip];
+// 		printf("mip %d: %dx%d first texel %d\n", mip, GetMipSize(8, mip), GetMipSize(8, mip), texel[0]);
+// 	}
+// 	WriteCookedTexture(cooked, "test.ctex");
+// 	CookedTexture read;
+// 	bool same = ReadCookedTexture(read, "test.ctex") && memcmp(read.data, cooked.data, GetCookedTextureDataSize(cooked)) == 0;
+// 	printf("read back %s\n", same ? "matches" : "differs");
+// 	DeinitCookedTexture(cooked);
+// 	DeinitCookedTexture(read);
+// 	return 0;
+// }
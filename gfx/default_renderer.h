@@ -1,45 +1,99 @@
 #pragma once
 #include "default_shader.h"
+#include "shadow_shader.h"
+#include "render_state.h"
 #include "render_obj.h"
 #include "material.h"
 #include "light.h"
 #include "gl_buffers.h"
+#include "meshlet.h"
+#include "frustum.h"
+#include "render_queue.h"
+#include "uniform_buffers.h"
+#include "bvh.h"
+#include "occlusion.h"
+#include "light_clusters.h"
+#include "../core/profiler.h"
 
 struct DefaultRenderer {
 	GLuint vao;
 	// GLuint shadowVao;
 
-    DefaultShader shader;
-    GLuint shadowShader;
-	FBO fbo;
-    bool drawToFBO;
+    // shader variants are compiled the first time something is drawn with them, see GetDrawVariant
+    DefaultShaderVariants shaders;
+    ShadowShaderVariants shadowShaders;
+	u32 shaderFeatures; // VARIANT_* bits, the settings to draw with, mappings left out here are skipped for every object
+	RenderState state; // all gl calls in DefaultRender go through this, see state.lastFrameStats for per frame counts
+	GLuint targetFBO; // the camera's view is drawn here, 0 for the window (render graph passes point it at their target)
+
+	// optional, models with meshlets get cluster culled when this is set
+	MeshletBuffers* meshletBuffers;
+	DrawRanges drawRanges;
+
+	// render objs are culled against each pass' camera with the bvh before they're queued
+	BVH bvh;
+	u32 nVisibleObjs;
+	u32 visibleObjs[MAX_BVH_OBJECTS];
+	RenderQueue queue; // rebuilt and sorted for every pass
+
+	// the opaque pass also drops objects hidden behind render objs marked isOccluder,
+	// which are rasterized on the cpu from the vertices and indices still in vbo and ibo
+	bool occlusionCulling;
+	VBO* vbo;
+	IBO* ibo;
+	OcclusionBuffer occlusionBuffer;
+
+	InstanceBuffer instanceBuffer; // matrices of the instanced batches in queue
+
+	// when the driver supports it (multi draw indirect and base instance), every instanceable object becomes a command in the indirect buffer
+	// and runs of them go out as one glMultiDrawElementsIndirect
+	bool multiDrawIndirect;
+	IndirectBuffer indirectBuffer;
+
+	// frame constants, material table and the ring the per object constants get written to
+	UniformBuffers uniformBuffers;
+	// identity object constants and joint palette written at the start of every frame,
+	// bound whenever nothing else is so the uniform blocks always have a buffer
+	s32 defaultObjectConstantsOffset;
+	s32 defaultJointPaletteOffset;
+
+	// point / spot lights binned per froxel every frame
+	LightClusters lightClusters;
 };
 
-void InitDefaultRenderer(DefaultRenderer& renderer, VBO& vbo, IBO& ibo, bool drawToFBO, u32 fboWidth, u32 fboHeight) {
-	InitDefaultShader(renderer.shader);
-	InitShader(renderer.shadowShader, "shaders/shadowVS.glsl", "shaders/shadowFS.glsl");
-    renderer.drawToFBO = drawToFBO;
-    InitFBO(renderer.fbo, fboWidth, fboHeight);
+void InitDefaultRenderer(DefaultRenderer& renderer, VBO& vbo, IBO& ibo, MeshletBuffers* meshletBuffers = NULL) {
+	InitRenderState(renderer.state);
+	InitDefaultShaderVariants(renderer.shaders);
+	InitShadowShaderVariants(renderer.shadowShaders);
+	renderer.shaderFeatures = DEFAULT_SHADER_FEATURES;
+	InitUniformBuffers(renderer.uniformBuffers);
+	InitBVH(renderer.bvh);
+	InitOcclusionBuffer(renderer.occlusionBuffer);
+	InitLightClusters(renderer.lightClusters);
+	renderer.occlusionCulling = true;
+	renderer.vbo = &vbo;
+	renderer.ibo = &ibo;
+	renderer.targetFBO = 0;
+	renderer.meshletBuffers = meshletBuffers;
 
 	// create vao for default shader
-	glUseProgram(renderer.shader.program);
 	glGenVertexArrays(1, &renderer.vao);
 	glBindVertexArray(renderer.vao);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo.id);
 	
-	// init attributes for default shader
-	GLint posLoc = glGetAttribLocation(renderer.shader.program, "a_position");
-	GLint uvCoordsLoc = glGetAttribLocation(renderer.shader.program, "a_uvCoords");
-	GLint noramlLoc = glGetAttribLocation(renderer.shader.program, "a_normal");
-	GLint tangentLoc = glGetAttribLocation(renderer.shader.program, "a_tangent");
+	// init attributes for default shader, every variant has them at the same locations (variants can compile some out)
+	GLint posLoc = VERTEX_POSITION_LOC;
+	GLint uvCoordsLoc = VERTEX_UV_COORDS_LOC;
+	GLint noramlLoc = VERTEX_NORMAL_LOC;
+	GLint tangentLoc = VERTEX_TANGENT_LOC;
 	// GLint bitangentLoc = glGetAttribLocation(renderer.shader.program, "a_bitangent");
-	GLint jointIndicesLoc = glGetAttribLocation(renderer.shader.program, "a_jointIndices");
-	GLint jointWeightsLoc = glGetAttribLocation(renderer.shader.program, "a_jointWeights");
+	GLint jointIndicesLoc = VERTEX_JOINT_INDICES_LOC;
+	GLint jointWeightsLoc = VERTEX_JOINT_WEIGHTS_LOC;
 
 	glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*) offsetof(Vertex, pos));
 	glVertexAttribPointer(uvCoordsLoc, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*) offsetof(Vertex, uvCoords));
 	glVertexAttribPointer(noramlLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*) offsetof(Vertex, normal));
-	glVertexAttribPointer(tangentLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*) offsetof(Vertex, tangent));
+	glVertexAttribPointer(tangentLoc, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*) offsetof(Vertex, tangent));
 	// glVertexAttribPointer(bitangentLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*) offsetof(Vertex, bitangent));
 	glVertexAttribPointer(jointIndicesLoc, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*) offsetof(Vertex, jointIndices));
 	glVertexAttribPointer(jointWeightsLoc, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*) offsetof(Vertex, jointWeights));
@@ -51,6 +105,25 @@ void InitDefaultRenderer(DefaultRenderer& renderer, VBO& vbo, IBO& ibo, bool dra
 	// glEnableVertexAttribArray(bitangentLoc);
 	glEnableVertexAttribArray(jointIndicesLoc);
 	glEnableVertexAttribArray(jointWeightsLoc);
+
+	// per instance matrices come from their own buffer and advance once per instance
+	InitInstanceBuffer(renderer.instanceBuffer);
+	for(u32 i = 0; i < 4; i++) {
+		glEnableVertexAttribArray(INSTANCE_MODEL_MATRIX_LOC + i);
+		glVertexAttribDivisor(INSTANCE_MODEL_MATRIX_LOC + i, 1);
+		glEnableVertexAttribArray(INSTANCE_NORMAL_MATRIX_LOC + i);
+		glVertexAttribDivisor(INSTANCE_NORMAL_MATRIX_LOC + i, 1);
+	}
+	glEnableVertexAttribArray(INSTANCE_MATERIAL_INDEX_LOC);
+	glVertexAttribDivisor(INSTANCE_MATERIAL_INDEX_LOC, 1);
+	PointInstanceAttributes(renderer.instanceBuffer, 0);
+
+	// the commands' baseInstance indexes the instance buffer, which is only honored with base instance support,
+	// without it every draw would read instance 0, so those drivers get the per batch PointInstanceAttributes path
+	renderer.multiDrawIndirect = (GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect) && (GLEW_VERSION_4_2 || GLEW_ARB_base_instance);
+	if(renderer.multiDrawIndirect) {
+		InitIndirectBuffer(renderer.indirectBuffer);
+	}
 	
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo.id);
 
@@ -74,44 +147,249 @@ void InitDefaultRenderer(DefaultRenderer& renderer, VBO& vbo, IBO& ibo, bool dra
 	// glEnableVertexAttribArray(shadowJointWeightsLoc);
 	
 	// glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo.id);
+
+	InvalidateBindings(renderer.state);
 }
 
 void DeinitDefaultRenderer(DefaultRenderer& renderer) {
 	glDeleteVertexArrays(1, &renderer.vao);
 	// glDeleteVertexArrays(1, &renderer.shadowVao);
 
-	DeinitShader(renderer.shader.program);
-	DeinitShader(renderer.shadowShader);
-    DeinitTexture(renderer.fbo.texture);
+	DeinitDefaultShaderVariants(renderer.shaders, renderer.state);
+	DeinitShadowShaderVariants(renderer.shadowShaders, renderer.state);
+	DeinitInstanceBuffer(renderer.instanceBuffer);
+	DeinitUniformBuffers(renderer.uniformBuffers);
+	DeinitLightClusters(renderer.lightClusters);
+	if(renderer.multiDrawIndirect) {
+		DeinitIndirectBuffer(renderer.indirectBuffer);
+	}
 }
 
-void ShadowRender(DefaultRenderer& renderer, FBO& shadowMap, Camera& cameraForShadows, RenderObj* renderObjs, u32 nRenderObjs, JointBuffers& jointBuffers, u32 windowWidth, u32 windowHeight) {
-	glViewport(0, 0, shadowMap.width, shadowMap.height);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMap.id);
-	glClear(GL_DEPTH_BUFFER_BIT);
+/**
+ * draws the whole model, or only its visible meshlets if it has any
+ * frustum and cameraPos should come from the camera of the current pass
+ */
+void DrawRenderObj(DefaultRenderer& renderer, RenderObj& obj, Frustum& frustum, vec3 cameraPos, bool coneCulling) {
+	Model& model = *obj.model;
+	if(model.numMeshlets > 0 && renderer.meshletBuffers != NULL) {
+		CullMeshlets(*renderer.meshletBuffers, model, obj.transform.matrix, obj.normalMatrix, frustum, cameraPos, coneCulling, renderer.drawRanges);
+		if(renderer.drawRanges.nRanges > 0) {
+			MultiDrawElements(renderer.state, renderer.drawRanges.counts, renderer.drawRanges.offsets, renderer.drawRanges.nRanges);
+		}
+		return;
+	}
+	DrawElements(renderer.state, model.numIndices, model.indicesOffset);
+}
 
-	// https://learnopengl.com/Advanced-Lighting/Shadows/Shadow-Mapping Peter Panning - for solid objects, use the face closest to the floor
-	glCullFace(GL_FRONT);
+/** one draw for every object in the batch, their matrices are already in the instance buffer */
+void DrawInstancedBatch(DefaultRenderer& renderer, Model& model, RenderBatch& batch) {
+	PointInstanceAttributes(renderer.instanceBuffer, batch.firstInstance);
+	DrawElementsInstanced(renderer.state, model.numIndices, model.indicesOffset, batch.count);
+}
+
+/**
+ * batches the sorted queue and uploads the instances, plus the indirect commands when multi draw indirect is on
+ * (it then needs every instanceable object in the instance buffer, even ones that don't share their model)
+ */
+void PrepareBatches(DefaultRenderer& renderer, RenderObj* renderObjs) {
+	RenderQueue& queue = renderer.queue;
+	BatchRenderQueue(queue, renderObjs, renderer.instanceBuffer, renderer.multiDrawIndirect ? 1 : MIN_INSTANCES_PER_BATCH);
+	UploadInstances(renderer.instanceBuffer);
+	if(renderer.multiDrawIndirect) {
+		FillIndirectCommands(renderer.indirectBuffer, queue, renderObjs);
+		UploadIndirectCommands(renderer.indirectBuffer);
+		// base instance picks each command's instances, so the attributes stay at the start of the buffer
+		PointInstanceAttributes(renderer.instanceBuffer, 0);
+	}
+}
 
-	// TODO: put these locations in a ShadowShader class
-	GLuint u_mvpMatrixShadowPos = glGetUniformLocation(renderer.shadowShader, "u_mvpMatrix");
-	GLuint skeletal_animations_enabledLoc = glGetUniformLocation(renderer.shadowShader, "skeletal_animations_enabled");
-	GLuint jointTransformsLoc = glGetUniformLocation(renderer.shadowShader, "u_jointTransforms");
+/** draws the instanced batch at b and returns the index of the last batch it drew (more than b if it used multi draw indirect) */
+u32 DrawInstanced(DefaultRenderer& renderer, RenderObj* renderObjs, u32 b, bool sameTextures) {
+	RenderQueue& queue = renderer.queue;
+	if(renderer.multiDrawIndirect) {
+		u32 end = GetIndirectRunEnd(queue, renderObjs, b, sameTextures);
+		MultiDrawElementsIndirect(renderer.state, renderer.indirectBuffer.commands, b, end - b);
+		return end - 1;
+	}
+	DrawInstancedBatch(renderer, *renderObjs[queue.objIndices[queue.batches[b].queueStart]].model, queue.batches[b]);
+	return b;
+}
+
+/**
+ * the shader variant to draw objects with the given per object features (see GetShaderVariant) with, the settings come from
+ * renderer.shaderFeatures, which can also switch a mapping off for everything
+ */
+u32 GetDrawVariant(DefaultRenderer& renderer, u32 objVariant, bool instanced) {
+	u32 variant = objVariant | (renderer.shaderFeatures & VARIANT_SETTINGS);
+	variant &= renderer.shaderFeatures | VARIANT_SKELETAL_ANIMATIONS;
+	if(instanced) {
+		variant |= VARIANT_INSTANCING;
+	}
+	return variant;
+}
+
+u32 GetDrawVariant(DefaultRenderer& renderer, RenderBatch& batch) {
+	return GetDrawVariant(renderer, GetSortKeyVariant(renderer.queue.keys[batch.queueStart]), batch.firstInstance >= 0);
+}
+
+/**
+ * starts compiling every variant of shaders and the shadow shader the render objs can be drawn with, so with parallel
+ * shader compiles they build side by side rather than one by one as objects first come into view
+ * call again after changing renderer.shaderFeatures or adding objects that need new variants
+ */
+void PrecompileShaders(DefaultRenderer& renderer, DefaultShaderVariants& shaders, RenderObj* renderObjs, u32 nRenderObjs) {
 	for(u32 i = 0; i < nRenderObjs; i++) {
 		RenderObj& obj = renderObjs[i];
-		mat4 mvpMatrix = cameraForShadows.vpMatrix * obj.transform.matrix;
-		glUniformMatrix4fv(u_mvpMatrixShadowPos, 1, GL_FALSE, &mvpMatrix[0][0]);
+		// instanceable objects drawn on their own use the plain variant
+		for(u32 instanced = 0; instanced <= (u32)CanInstance(obj); instanced++) {
+			u32 shadowVariant = GetDrawVariant(renderer, GetShaderVariant(RENDER_PASS_SHADOW, obj), instanced);
+			PrecompileShaderVariant(renderer.shadowShaders.variants, shadowVariant & SHADOW_SHADER_FEATURES);
+			PrecompileShaderVariant(shaders.variants, GetDrawVariant(renderer, GetShaderVariant(RENDER_PASS_OPAQUE, obj), instanced));
+		}
+	}
+}
+
+/** recompiles the shaders whose files changed since they were read, call once a frame */
+void ReloadShadersIfUpdated(DefaultRenderer& renderer) {
+	ReloadDefaultShaderVariantsIfUpdated(renderer.shaders, renderer.state);
+	ReloadShadowShaderVariantsIfUpdated(renderer.shadowShaders, renderer.state);
+}
+
+/** writes the ObjectConstants (and JointPalette for skinned objects) of every batch that isn't instanced into the uniform ring */
+void WriteObjectConstants(DefaultRenderer& renderer, RenderObj* renderObjs, mat4& vpMatrix, JointBuffers& jointBuffers) {
+	RenderQueue& queue = renderer.queue;
+	UniformRing& ring = renderer.uniformBuffers.ring;
+	BeginUniformWrites(ring);
+	for(u32 b = 0; b < queue.nBatches; b++) {
+		RenderBatch& batch = queue.batches[b];
+		if(batch.firstInstance >= 0) continue;
+		RenderObj& obj = renderObjs[queue.objIndices[batch.queueStart]];
+
+		batch.objectConstantsOffset = AllocUniforms(ring, sizeof(ObjectConstants));
+		if(batch.objectConstantsOffset < 0) break; // out of space, the rest of the batches get skipped
+		ObjectConstants* constants = (ObjectConstants*)GetUniformPtr(ring, batch.objectConstantsOffset);
+		constants->modelMatrix = obj.transform.matrix;
+		constants->normalMatrix = obj.normalMatrix;
+		constants->mvpMatrix = vpMatrix * obj.transform.matrix;
 
 		if(obj.model->numJoints > 0) {
 			CalcJointTransforms(obj, jointBuffers);
-			glUniformMatrix4fv(jointTransformsLoc, MAX_JOINTS_PER_MODEL, GL_FALSE, &jointBuffers.jointTransforms[0][0][0]);
-    		glUniform1i(skeletal_animations_enabledLoc, 1);
+			batch.jointPaletteOffset = AllocUniforms(ring, sizeof(JointPalette));
+			if(batch.jointPaletteOffset < 0) {
+				batch.objectConstantsOffset = -1;
+				break;
+			}
+			memcpy(GetUniformPtr(ring, batch.jointPaletteOffset), jointBuffers.jointTransforms, sizeof(JointPalette));
 		}
-		else {
-    		glUniform1i(skeletal_animations_enabledLoc, 0);
+	}
+	EndUniformWrites(ring);
+}
+
+/** binds the batch's uniform ring ranges, returns false if the batch has none (the ring ran out of space) */
+bool BindObjectConstants(DefaultRenderer& renderer, RenderBatch& batch) {
+	if(batch.objectConstantsOffset < 0) {
+		return false;
+	}
+	GLuint ring = renderer.uniformBuffers.ring.id;
+	BindUniformRange(renderer.state, OBJECT_CONSTANTS_BINDING, ring, batch.objectConstantsOffset, sizeof(ObjectConstants));
+	if(batch.jointPaletteOffset >= 0) {
+		BindUniformRange(renderer.state, JOINT_PALETTE_BINDING, ring, batch.jointPaletteOffset, sizeof(JointPalette));
+	}
+	return true;
+}
+
+/** starts this frame's segment of the uniform ring and binds identity constants so every uniform block has a buffer */
+void BeginObjectConstants(DefaultRenderer& renderer) {
+	UniformRing& ring = renderer.uniformBuffers.ring;
+	BeginUniformRingFrame(ring);
+	BeginUniformWrites(ring);
+	renderer.defaultObjectConstantsOffset = AllocUniforms(ring, sizeof(ObjectConstants));
+	renderer.defaultJointPaletteOffset = AllocUniforms(ring, sizeof(JointPalette));
+	ObjectConstants* constants = (ObjectConstants*)GetUniformPtr(ring, renderer.defaultObjectConstantsOffset);
+	constants->modelMatrix = mat4(1);
+	constants->normalMatrix = mat4(1);
+	constants->mvpMatrix = mat4(1);
+	JointPalette* palette = (JointPalette*)GetUniformPtr(ring, renderer.defaultJointPaletteOffset);
+	for(u32 i = 0; i < MAX_JOINTS_PER_MODEL; i++) {
+		palette->jointTransforms[i] = mat4(1);
+	}
+	EndUniformWrites(ring);
+	BindUniformRange(renderer.state, OBJECT_CONSTANTS_BINDING, ring.id, renderer.defaultObjectConstantsOffset, sizeof(ObjectConstants));
+	BindUniformRange(renderer.state, JOINT_PALETTE_BINDING, ring.id, renderer.defaultJointPaletteOffset, sizeof(JointPalette));
+}
+
+enum ShadowCasters {
+	SHADOW_CASTERS_ALL,
+	SHADOW_CASTERS_STATIC,
+	SHADOW_CASTERS_DYNAMIC, // drawn over a copy of the cached static layer, so the shadow map isn't cleared first
+};
+
+// skinned objects change shape without moving, so they're never cached
+bool IsStaticShadowCaster(RenderObj& obj) {
+	return obj.isStatic && obj.model->numJoints == 0;
+}
+
+/** renders the shadow casters in cameraForShadows' frustum, into the given layer if shadowMap is a texture array */
+void ShadowRender(DefaultRenderer& renderer, FBO& shadowMap, Camera& cameraForShadows, RenderObj* renderObjs, u32 nRenderObjs, JointBuffers& jointBuffers, u32 windowWidth, u32 windowHeight,
+	s32 layer = -1, ShadowCasters casters = SHADOW_CASTERS_ALL) {
+	PROFILE_FUNCTION();
+	glViewport(0, 0, shadowMap.width, shadowMap.height);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMap.id);
+	if(layer >= 0) {
+		glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMap.texture, 0, layer);
+	}
+	if(casters != SHADOW_CASTERS_DYNAMIC) {
+		glClear(GL_DEPTH_BUFFER_BIT);
+	}
+
+	// https://learnopengl.com/Advanced-Lighting/Shadows/Shadow-Mapping Peter Panning - for solid objects, use the face closest to the floor
+	glCullFace(GL_FRONT);
+
+	Frustum frustum;
+	ExtractFrustumPlanes(frustum, cameraForShadows.vpMatrix);
+	// only objects inside the light's frustum (or the cascade's) can end up in its shadow map
+	renderer.nVisibleObjs = CullBVH(renderer.bvh, frustum, renderer.visibleObjs);
+	if(casters != SHADOW_CASTERS_ALL) {
+		u32 nCasters = 0;
+		for(u32 i = 0; i < renderer.nVisibleObjs; i++) {
+			u32 objIndex = renderer.visibleObjs[i];
+			if(IsStaticShadowCaster(renderObjs[objIndex]) == (casters == SHADOW_CASTERS_STATIC)) {
+				renderer.visibleObjs[nCasters++] = objIndex;
+			}
+		}
+		renderer.nVisibleObjs = nCasters;
+	}
+	RenderQueue& queue = renderer.queue;
+	BuildRenderQueue(queue, RENDER_PASS_SHADOW, cameraForShadows, renderObjs, renderer.visibleObjs, renderer.nVisibleObjs);
+	PrepareBatches(renderer, renderObjs);
+	WriteObjectConstants(renderer, renderObjs, cameraForShadows.vpMatrix, jointBuffers);
+	// the queue is sorted by variant, so the program only changes a couple of times
+	ShadowShader* shader = NULL;
+	u32 boundVariant = (u32)-1;
+	for(u32 b = 0; b < queue.nBatches; b++) {
+		RenderBatch& batch = queue.batches[b];
+		RenderObj& obj = renderObjs[queue.objIndices[batch.queueStart]];
+		u32 variant = GetDrawVariant(renderer, batch);
+		if(variant != boundVariant) {
+			boundVariant = variant;
+			// objects whose variant is still compiling cast no shadow until it's done
+			shader = GetShadowShader(renderer.shadowShaders, variant, false);
+			if(shader != NULL) {
+				SetProgram(renderer.state, shader->program);
+				SetUniformMatrix4fv(renderer.state, shader->u_vpMatrix, 1, &cameraForShadows.vpMatrix[0][0]);
+			}
 		}
+		if(shader == NULL) continue;
+		if(batch.firstInstance >= 0) {
+			// depth only, so material changes don't split the run
+			b = DrawInstanced(renderer, renderObjs, b, false);
+			continue;
+		}
+
+		if(!BindObjectConstants(renderer, batch)) continue;
 
-		glDrawElements(GL_TRIANGLES, renderObjs[i].model->numIndices, GL_UNSIGNED_INT, (void*)(renderObjs[i].model->indicesOffset * sizeof(IndexType)));
+		// front faces are culled in the shadow pass, so backface cones don't apply
+		DrawRenderObj(renderer, obj, frustum, cameraForShadows.pos, false);
 	}
 
 	glCullFace(GL_BACK);
@@ -120,100 +398,193 @@ void ShadowRender(DefaultRenderer& renderer, FBO& shadowMap, Camera& cameraForSh
 	glViewport(0, 0, windowWidth, windowHeight);
 }
 
-void BindMaterial(DefaultShader& shader, Material& material) {
+/**
+ * marks the static layers of the dir light's shadow map that have to be re-rendered, those whose cascade moved
+ * and those a static caster moved in or out of
+ * call before SyncBVH, the bvh leaves still have where moved objects used to be
+ */
+void InvalidateStaticShadows(DirLight& dirLight, BVH& bvh, RenderObj* renderObjs, u32 nRenderObjs) {
+	Frustum frustums[MAX_SHADOW_CASCADES];
+	for(u32 i = 0; i < dirLight.nCascades; i++) {
+		mat4& vpMatrix = dirLight.cascadeCameras[i].vpMatrix;
+		if(memcmp(&vpMatrix, &dirLight.staticVpMatrices[i], sizeof(mat4)) != 0) {
+			dirLight.staticLayerDirty[i] = true;
+			dirLight.staticVpMatrices[i] = vpMatrix;
+		}
+		ExtractFrustumPlanes(frustums[i], vpMatrix);
+	}
+	for(u32 o = 0; o < nRenderObjs; o++) {
+		RenderObj& obj = renderObjs[o];
+		if(!obj.moved || !IsStaticShadowCaster(obj)) continue;
+		for(u32 i = 0; i < dirLight.nCascades; i++) {
+			if(dirLight.staticLayerDirty[i]) continue;
+			bool wasInside = o < bvh.nObjs && bvh.leafOfObj[o] != BVH_NULL_NODE
+				&& AABBInFrustum(frustums[i], bvh.nodes[bvh.leafOfObj[o]].minExtents, bvh.nodes[bvh.leafOfObj[o]].maxExtents);
+			if(wasInside || AABBInFrustum(frustums[i], obj.minExtents, obj.maxExtents)) {
+				dirLight.staticLayerDirty[i] = true;
+			}
+		}
+	}
+}
+
+/** binds the texture arrays the material's maps are in, the render state skips them when the last material used the same ones */
+void BindMaterial(RenderState& state, DefaultShader& shader, Material& material) {
 	if(material.texture != NULL) {
-		BindTexture(shader.u_texture, material.texture->texture, 0);
+		SetSampler(state, shader.u_texture, material.texture->texture, 0, GL_TEXTURE_2D_ARRAY);
 	}
 	if(material.normalMap != NULL) {
-		BindTexture(shader.u_normalMap, material.normalMap->texture, 1);
+		SetSampler(state, shader.u_normalMap, material.normalMap->texture, 1, GL_TEXTURE_2D_ARRAY);
 	}
 	if(material.dispMap != NULL) {
-		BindTexture(shader.u_dispMap, material.dispMap->texture, 2);
+		SetSampler(state, shader.u_dispMap, material.dispMap->texture, 2, GL_TEXTURE_2D_ARRAY);
 	}
-	glUniform3fv(shader.u_color, 1, &material.color[0]);
-	glUniform1f(shader.u_dispMapScale, material.dispMapScale);
-	glUniform1f(shader.u_dispMapBias, material.dispMapBias);
+	// everything else about the material, including the layers of its maps, is in the material table
+	// (instanced draws take the index from their instances instead)
+	SetUniform1i(state, shader.u_materialIndex, material.id);
 }
 
-void DefaultRender(DefaultRenderer& renderer, Camera& camera, RenderObj* renderObjs, u32 nRenderObjs, DirLight dirLight, Light* lights, u32 nLights, JointBuffers& jointBuffers, u32 windowWidth, u32 windowHeight) {
-	// init for shadow render
-	glUseProgram(renderer.shadowShader);
+/**
+ * the per frame work both DefaultRender and DeferredRender need before drawing the camera's view:
+ * resets stats, renders the shadow maps, bins the point / spot lights and uploads the frame constants
+ */
+void BeginFrame(DefaultRenderer& renderer, Camera& camera, RenderObj* renderObjs, u32 nRenderObjs, DirLight& dirLight, Light* lights, u32 nLights, JointBuffers& jointBuffers, u32 windowWidth, u32 windowHeight) {
+	PROFILE_FUNCTION();
+	RenderState& state = renderer.state;
+	ResetRenderStats(state);
+	// other renderers bind their own programs, textures and vaos between our frames
+	InvalidateBindings(state);
+	SetVertexArray(state, renderer.vao);
+	BeginObjectConstants(renderer);
+	UpdateShadowCascades(dirLight, camera);
+	InvalidateStaticShadows(dirLight, renderer.bvh, renderObjs, nRenderObjs);
+	SyncBVH(renderer.bvh, renderObjs, nRenderObjs);
+
 	// glBindVertexArray(renderer.shadowVao);
 
-	// shadow render for dir light
-	ShadowRender(renderer, dirLight.shadowMap, dirLight.cameraForShadows, renderObjs, nRenderObjs, jointBuffers, windowWidth, windowHeight);
+	// shadow render for dir light, one layer per cascade
+	// static casters come from the cached layer, only redrawn when InvalidateStaticShadows found a change
+	for(u32 i = 0; i < dirLight.nCascades; i++) {
+		if(dirLight.staticLayerDirty[i]) {
+			ShadowRender(renderer, dirLight.staticShadowMap, dirLight.cascadeCameras[i], renderObjs, nRenderObjs, jointBuffers, windowWidth, windowHeight, i, SHADOW_CASTERS_STATIC);
+			dirLight.staticLayerDirty[i] = false;
+			state.stats.staticShadowUpdates++;
+		}
+		CopyShadowMapLayer(dirLight.staticShadowMap, dirLight.shadowMap, i);
+		ShadowRender(renderer, dirLight.shadowMap, dirLight.cascadeCameras[i], renderObjs, nRenderObjs, jointBuffers, windowWidth, windowHeight, i, SHADOW_CASTERS_DYNAMIC);
+	}
 	// shadow render for point / spot lights
 	for(u32 i = 0; i < nLights; i++) {
+		if(lights[i].shadowMap.id == 0) continue;
 		ShadowRender(renderer, lights[i].shadowMap, lights[i].cameraForShadows, renderObjs, nRenderObjs, jointBuffers, windowWidth, windowHeight);
 	}
 
-	// init for default render
-	glUseProgram(renderer.shader.program);
-	// glBindVertexArray(renderer.vao);
+	FrameConstants frameConstants;
+	frameConstants.vpMatrix = camera.vpMatrix;
+	for(u32 i = 0; i < MAX_SHADOW_CASCADES; i++) {
+		frameConstants.cascadeMatrices[i] = dirLight.cascadeCameras[i].vpMatrix;
+	}
+	frameConstants.cascadeSplits = vec4(dirLight.cascadeSplits[0], dirLight.cascadeSplits[1], dirLight.cascadeSplits[2], dirLight.cascadeSplits[3]);
+	frameConstants.nCascades = dirLight.nCascades;
+	frameConstants.cameraPos = vec4(camera.pos, 1);
+	frameConstants.cameraDir = vec4(camera.dir, 0);
+	frameConstants.lightDir = vec4(dirLight.cameraForShadows.dir, 0);
+	frameConstants.lightColor = vec4(dirLight.color, 1);
+	BinLights(renderer.lightClusters, camera, lights, nLights);
+	UploadLightClusters(renderer.lightClusters);
+	frameConstants.clusterParams = GetClusterParams(renderer.lightClusters, windowWidth, windowHeight);
+	UploadFrameConstants(renderer.uniformBuffers, frameConstants);
+}
 
-	glUniform3fv(renderer.shader.u_cameraPos, 1, &camera.pos[0]);
-	glUniform3fv(renderer.shader.u_lightDir, 1, &dirLight.cameraForShadows.dir[0]);
-	glUniform3fv(renderer.shader.u_lightColor, 1, &dirLight.color[0]);
-	BindTexture(renderer.shader.u_shadowMap, dirLight.shadowMap.texture, 3);
+/** binds the dir light's shadow map and the light clusters to texture units 3 to 6 for the bound program */
+void BindLightSamplers(DefaultRenderer& renderer, DirLight& dirLight, GLint u_shadowMap, GLint u_lightData, GLint u_clusterRanges, GLint u_clusterLightIndices) {
+	RenderState& state = renderer.state;
+	SetSampler(state, u_shadowMap, dirLight.shadowMap.texture, 3, GL_TEXTURE_2D_ARRAY);
+	SetSampler(state, u_lightData, renderer.lightClusters.lightTexture, 4, GL_TEXTURE_BUFFER);
+	SetSampler(state, u_clusterRanges, renderer.lightClusters.rangeTexture, 5, GL_TEXTURE_BUFFER);
+	SetSampler(state, u_clusterLightIndices, renderer.lightClusters.indexTexture, 6, GL_TEXTURE_BUFFER);
+}
 
-    if(renderer.drawToFBO) {
-    	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, renderer.fbo.id);
-    }
+/** fills renderer.visibleObjs with the objects in the camera's frustum that aren't hidden behind occluders */
+void CullObjs(DefaultRenderer& renderer, Camera& camera, Frustum& frustum, RenderObj* renderObjs) {
+	PROFILE_FUNCTION();
+	renderer.nVisibleObjs = CullBVH(renderer.bvh, frustum, renderer.visibleObjs);
+	if(renderer.occlusionCulling) {
+		OcclusionBuffer& occlusionBuffer = renderer.occlusionBuffer;
+		SetupOccluders(occlusionBuffer, camera.vpMatrix, renderObjs, renderer.visibleObjs, renderer.nVisibleObjs, *renderer.vbo, *renderer.ibo);
+		if(occlusionBuffer.nTriangles > 0) {
+			RasterizeOcclusionBuffer(occlusionBuffer);
+			u32 nVisible = CullOccludedObjs(occlusionBuffer, camera.vpMatrix, renderObjs, renderer.visibleObjs, renderer.nVisibleObjs);
+			renderer.state.stats.occludedObjs += renderer.nVisibleObjs - nVisible;
+			renderer.nVisibleObjs = nVisible;
+		}
+	}
+}
 
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	for(u32 i = 0; i < nRenderObjs; i++) {
-		RenderObj& obj = renderObjs[i];
-		BindMaterial(renderer.shader, *renderObjs[i].material);
+/**
+ * queues, batches and draws renderer.visibleObjs with variants of the given shader, which is either the forward shader
+ * or the deferred renderer's geometry pass shader
+ */
+void DrawVisibleObjs(DefaultRenderer& renderer, DefaultShaderVariants& shaders, DirLight& dirLight, Camera& camera, Frustum& frustum, RenderObj* renderObjs, JointBuffers& jointBuffers) {
+	PROFILE_FUNCTION();
+	RenderState& state = renderer.state;
 
-		if(i == 2) {
-			BindTexture(renderer.shader.u_texture, dirLight.shadowMap.texture, 0);
+	// sorted by shader variant and then material, so programs and material state only change between batches
+	RenderQueue& queue = renderer.queue;
+	BuildRenderQueue(queue, RENDER_PASS_OPAQUE, camera, renderObjs, renderer.visibleObjs, renderer.nVisibleObjs);
+	PrepareBatches(renderer, renderObjs);
+	WriteObjectConstants(renderer, renderObjs, camera.vpMatrix, jointBuffers);
+	DefaultShader* shader = NULL;
+	u32 boundVariant = (u32)-1;
+	Material* boundMaterial = NULL;
+	for(u32 b = 0; b < queue.nBatches; b++) {
+		RenderBatch& batch = queue.batches[b];
+		u32 objIndex = queue.objIndices[batch.queueStart];
+		RenderObj& obj = renderObjs[objIndex];
+		u32 variant = GetDrawVariant(renderer, batch);
+		if(variant != boundVariant) {
+			boundVariant = variant;
+			// objects whose variant is still compiling pop in once it's done rather than stalling the frame
+			shader = GetDefaultShader(shaders, variant, false);
+			if(shader != NULL) {
+				SetProgram(state, shader->program);
+				BindLightSamplers(renderer, dirLight, shader->u_shadowMap, shader->u_lightData, shader->u_clusterRanges, shader->u_clusterLightIndices);
+			}
+			// the new program's samplers and material index aren't set yet
+			boundMaterial = NULL;
 		}
-
-		// disable mapping for objects without that map
-		GLint texture_mapping_enabled;
-		glGetUniformiv(renderer.shader.program, renderer.shader.texture_mapping_enabled, &texture_mapping_enabled);
-		if(renderObjs[i].material->texture == NULL)
-			glUniform1i(renderer.shader.texture_mapping_enabled, 0);
-		GLint normal_mapping_enabled;
-		glGetUniformiv(renderer.shader.program, renderer.shader.normal_mapping_enabled, &normal_mapping_enabled);
-		if(renderObjs[i].material->normalMap == NULL)
-			glUniform1i(renderer.shader.normal_mapping_enabled, 0);
-		GLint displacement_mapping_enabled;
-		glGetUniformiv(renderer.shader.program, renderer.shader.displacement_mapping_enabled, &displacement_mapping_enabled);
-		if(renderObjs[i].material->dispMap == NULL)
-			glUniform1i(renderer.shader.displacement_mapping_enabled, 0);
-
-		// update model uniforms
-		glUniformMatrix4fv(renderer.shader.u_modelMatrix, 1, GL_FALSE, &obj.transform.matrix[0][0]);
-		glUniformMatrix4fv(renderer.shader.u_normalMatrix, 1, GL_FALSE, &obj.normalMatrix[0][0]);
-		mat4 mvpMatrix = camera.vpMatrix * obj.transform.matrix;
-		glUniformMatrix4fv(renderer.shader.u_mvpMatrix, 1, GL_FALSE, &mvpMatrix[0][0]);
-
-		// load jointTransforms
-		if(obj.model->numJoints > 0) {
-			CalcJointTransforms(obj, jointBuffers);
-			glUniformMatrix4fv(renderer.shader.u_jointTransforms, MAX_JOINTS_PER_MODEL, GL_FALSE, &jointBuffers.jointTransforms[0][0][0]);
-    		glUniform1i(renderer.shader.skeletal_animations_enabled, 1);
+		if(shader == NULL) continue;
+		if(obj.material != boundMaterial) {
+			BindMaterial(state, *shader, *obj.material);
+			boundMaterial = obj.material;
 		}
-		else {
-    		glUniform1i(renderer.shader.skeletal_animations_enabled, 0);
+
+		if(batch.firstInstance >= 0) {
+			// one multi draw per run of materials sharing texture arrays, each instance picks its own material
+			b = DrawInstanced(renderer, renderObjs, b, true);
+			continue;
 		}
 
-		// update light uniforms
-		mvpMatrix = dirLight.cameraForShadows.vpMatrix * obj.transform.matrix;
-		glUniformMatrix4fv(renderer.shader.u_mvpMatrixFromLight, 1, GL_FALSE, &mvpMatrix[0][0]);
-		// TODO: update point / spot light uniforms
+		// model matrices and joint transforms were written to the uniform ring by WriteObjectConstants
+		if(!BindObjectConstants(renderer, batch)) continue;
 
 		// draw the render obj
 // glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
-		glDrawElements(GL_TRIANGLES, renderObjs[i].model->numIndices, GL_UNSIGNED_INT, (void*)(renderObjs[i].model->indicesOffset * sizeof(IndexType)));
+		DrawRenderObj(renderer, obj, frustum, camera.pos, true);
 // glPolygonMode( GL_FRONT_AND_BACK, GL_FILL );
-		// reset back to what we had for mapping
-		glUniform1i(renderer.shader.normal_mapping_enabled, normal_mapping_enabled);
-		glUniform1i(renderer.shader.texture_mapping_enabled, texture_mapping_enabled);
-		glUniform1i(renderer.shader.displacement_mapping_enabled, displacement_mapping_enabled);
-	}
-    if(renderer.drawToFBO) {
-    	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-    }
+	}
+}
+
+void DefaultRender(DefaultRenderer& renderer, Camera& camera, RenderObj* renderObjs, u32 nRenderObjs, DirLight& dirLight, Light* lights, u32 nLights, JointBuffers& jointBuffers, u32 windowWidth, u32 windowHeight) {
+	BeginFrame(renderer, camera, renderObjs, nRenderObjs, dirLight, lights, nLights, jointBuffers, windowWidth, windowHeight);
+
+	// glBindVertexArray(renderer.vao);
+
+	// the shadow passes left their own fbos bound
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, renderer.targetFBO);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	Frustum frustum;
+	ExtractFrustumPlanes(frustum, camera.vpMatrix);
+	CullObjs(renderer, camera, frustum, renderObjs);
+	DrawVisibleObjs(renderer, renderer.shaders, dirLight, camera, frustum, renderObjs, jointBuffers);
+	EndUniformRingFrame(renderer.uniformBuffers.ring);
 }
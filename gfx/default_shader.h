@@ -1,103 +1,128 @@
 #pragma once
 #include "shader.h"
 #include "vertex.h"
+#include "render_state.h"
+#include "uniform_buffers.h"
 
-struct DefaultShader {
-    GLuint program;
+// feature bits of the default shader's variants, each one is a #define in defaultVS.glsl and the fragment shaders it's used with
+// the low 8 bits are per object and go in the render queue's sort key (see GetShaderVariant in render_queue.h)
+#define VARIANT_TEXTURE_MAPPING      (1 << 0)
+#define VARIANT_NORMAL_MAPPING       (1 << 1)
+#define VARIANT_DISPLACEMENT_MAPPING (1 << 2)
+#define VARIANT_SKELETAL_ANIMATIONS  (1 << 3)
+#define VARIANT_INSTANCING           (1 << 4) // per batch rather than per object, so it isn't in the sort key
+// renderer wide settings, see DefaultRenderer::shaderFeatures
+#define VARIANT_LIGHTING             (1 << 8)
+#define VARIANT_DIFFUSE_LIGHTING     (1 << 9)
+#define VARIANT_SPECULAR_LIGHTING    (1 << 10)
+#define VARIANT_AMBIENT_LIGHTING     (1 << 11)
+#define VARIANT_SHADOW_MAPPING       (1 << 12)
+#define VARIANT_PCF                  (1 << 13)
+#define N_VARIANT_FEATURES 14
+
+#define VARIANT_OBJECT_FEATURES 0xFF
+#define VARIANT_SETTINGS (VARIANT_LIGHTING | VARIANT_DIFFUSE_LIGHTING | VARIANT_SPECULAR_LIGHTING | VARIANT_AMBIENT_LIGHTING \
+    | VARIANT_SHADOW_MAPPING | VARIANT_PCF)
+// what the renderers start out with, the mappings are only used by objects whose material has the map
+#define DEFAULT_SHADER_FEATURES (VARIANT_TEXTURE_MAPPING | VARIANT_NORMAL_MAPPING | VARIANT_DISPLACEMENT_MAPPING | VARIANT_SETTINGS)
 
-    // matrices
-    GLuint u_modelMatrix;
-    GLuint u_normalMatrix;
-    GLuint u_mvpMatrix;
-    GLuint u_mvpMatrixFromLight;
-    
-    GLuint u_cameraPos;
+const char* const VARIANT_FEATURE_NAMES[N_VARIANT_FEATURES] = {
+    "TEXTURE_MAPPING",
+    "NORMAL_MAPPING",
+    "DISPLACEMENT_MAPPING",
+    "SKELETAL_ANIMATIONS",
+    "INSTANCING",
+    NULL,
+    NULL,
+    NULL,
+    "LIGHTING",
+    "DIFFUSE_LIGHTING",
+    "SPECULAR_LIGHTING",
+    "AMBIENT_LIGHTING",
+    "SHADOW_MAPPING",
+    "PCF",
+};
+
+// one compiled variant of the default shader
+struct DefaultShader {
+    GLuint program; // 0 if the variant didn't compile
 
-    GLuint u_jointTransforms;
+    // matrices, camera and light values and joint transforms are in uniform blocks (see uniform_buffers.h)
 
     // material
     GLuint u_texture;
     GLuint u_normalMap;
     GLuint u_dispMap;
-    GLuint u_dispMapScale;
-    GLuint u_dispMapBias;
-    GLuint u_shine;
-    GLuint u_color;
+    GLuint u_materialIndex; // into the material table
 
     // directional light
-    GLuint u_lightDir;
-    GLuint u_lightColor;
     GLuint u_shadowMap;
 
-    // point / spot lights
-    GLuint u_nLights;
-
-    // flags
-    GLuint lighting_enabled;
-    GLuint diffuse_lighting_enabled;
-    GLuint specular_lighting_enabled;
-    GLuint ambient_lighting_enabled;
-    GLuint texture_mapping_enabled;
-    GLuint normal_mapping_enabled;
-    GLuint displacement_mapping_enabled;
-    GLuint shadow_mapping_enabled;
-    GLuint pcf_enabled;
-    GLuint shadow_cube_mapping_enabled;
-    GLuint skeletal_animations_enabled;
+    // point / spot lights, binned into clusters (see light_clusters.h)
+    GLuint u_lightData;
+    GLuint u_clusterRanges;
+    GLuint u_clusterLightIndices;
 };
 
-void InitDefaultShader(DefaultShader& shader) {
-    InitShader(shader.program, "shaders/defaultVS.glsl", "shaders/defaultFS.glsl");
-    
-    shader.u_modelMatrix = glGetUniformLocation(shader.program, "u_modelMatrix");
-    shader.u_normalMatrix = glGetUniformLocation(shader.program, "u_normalMatrix");
-    shader.u_mvpMatrix = glGetUniformLocation(shader.program, "u_mvpMatrix");
-    shader.u_mvpMatrixFromLight = glGetUniformLocation(shader.program, "u_mvpMatrixFromLight");
-    
-    shader.u_cameraPos = glGetUniformLocation(shader.program, "u_cameraPos");
-    
-    shader.u_jointTransforms = glGetUniformLocation(shader.program, "u_jointTransforms");
-    
-    shader.u_texture = glGetUniformLocation(shader.program, "u_texture");
-    shader.u_normalMap = glGetUniformLocation(shader.program, "u_normalMap");
-    shader.u_dispMap = glGetUniformLocation(shader.program, "u_dispMap");
-    shader.u_dispMapScale = glGetUniformLocation(shader.program, "u_dispMapScale");
-    glUniform1f(shader.u_dispMapScale, 0.04f);
-    shader.u_dispMapBias = glGetUniformLocation(shader.program, "u_dispMapBias");
-    glUniform1f(shader.u_dispMapBias, -0.02f);
-    shader.u_shine = glGetUniformLocation(shader.program, "u_shine");
-    glUniform1f(shader.u_shine, 100.0f);
-    shader.u_color = glGetUniformLocation(shader.program, "u_color");
-    v3 defaultColor = v3(1,1,1);
-    glUniform3fv(shader.u_color, 1, &defaultColor[0]);
-
-    shader.u_lightDir = glGetUniformLocation(shader.program, "u_lightDir");
-    shader.u_lightColor = glGetUniformLocation(shader.program, "u_lightColor");
-    shader.u_shadowMap = glGetUniformLocation(shader.program, "u_shadowMap");
-    
-    shader.u_nLights = glGetUniformLocation(shader.program, "u_nLights");
-    glUniform1i(shader.u_nLights, 0);
-
-    shader.lighting_enabled = glGetUniformLocation(shader.program, "lighting_enabled");
-    glUniform1i(shader.lighting_enabled, 1);
-    shader.diffuse_lighting_enabled = glGetUniformLocation(shader.program, "diffuse_lighting_enabled");
-    glUniform1i(shader.diffuse_lighting_enabled, 1);
-    shader.specular_lighting_enabled = glGetUniformLocation(shader.program, "specular_lighting_enabled");
-    glUniform1i(shader.specular_lighting_enabled, 1);
-    shader.ambient_lighting_enabled = glGetUniformLocation(shader.program, "ambient_lighting_enabled");
-    glUniform1i(shader.ambient_lighting_enabled, 1);
-    shader.texture_mapping_enabled = glGetUniformLocation(shader.program, "texture_mapping_enabled");
-    glUniform1i(shader.texture_mapping_enabled, 1);
-    shader.normal_mapping_enabled = glGetUniformLocation(shader.program, "normal_mapping_enabled");
-    glUniform1i(shader.normal_mapping_enabled, 1);
-    shader.displacement_mapping_enabled = glGetUniformLocation(shader.program, "displacement_mapping_enabled");
-    glUniform1i(shader.displacement_mapping_enabled, 1);
-    shader.shadow_mapping_enabled = glGetUniformLocation(shader.program, "shadow_mapping_enabled");
-    glUniform1i(shader.shadow_mapping_enabled, 1);
-    shader.pcf_enabled = glGetUniformLocation(shader.program, "pcf_enabled");
-    glUniform1i(shader.pcf_enabled, 1);
-    shader.shadow_cube_mapping_enabled = glGetUniformLocation(shader.program, "shadow_cube_mapping_enabled");
-    glUniform1i(shader.shadow_cube_mapping_enabled, 0);
-    shader.skeletal_animations_enabled = glGetUniformLocation(shader.program, "skeletal_animations_enabled");
-    glUniform1i(shader.skeletal_animations_enabled, 0);
+struct DefaultShaderVariants {
+    ShaderVariants variants;
+    DefaultShader shaders[MAX_SHADER_VARIANTS]; // same order as variants.programs
+};
+
+// uniforms a variant compiled out come back as -1, which the render state ignores
+void ResolveDefaultShader(DefaultShader& shader, GLuint program) {
+    shader.program = program;
+    if(!program) return;
+
+    BindUniformBlock(program, "FrameConstants", FRAME_CONSTANTS_BINDING);
+    BindUniformBlock(program, "MaterialTable", MATERIAL_TABLE_BINDING);
+    BindUniformBlock(program, "ObjectConstants", OBJECT_CONSTANTS_BINDING);
+    BindUniformBlock(program, "JointPalette", JOINT_PALETTE_BINDING);
+
+    shader.u_texture = glGetUniformLocation(program, "u_texture");
+    shader.u_normalMap = glGetUniformLocation(program, "u_normalMap");
+    shader.u_dispMap = glGetUniformLocation(program, "u_dispMap");
+    shader.u_materialIndex = glGetUniformLocation(program, "u_materialIndex");
+
+    shader.u_shadowMap = glGetUniformLocation(program, "u_shadowMap");
+
+    shader.u_lightData = glGetUniformLocation(program, "u_lightData");
+    shader.u_clusterRanges = glGetUniformLocation(program, "u_clusterRanges");
+    shader.u_clusterLightIndices = glGetUniformLocation(program, "u_clusterLightIndices");
+}
+
+// the deferred renderer's geometry pass swaps in its own fragment shader
+void InitDefaultShaderVariants(DefaultShaderVariants& shaders, const char* fragmentShaderPath = "shaders/defaultFS.glsl") {
+    InitShaderVariants(shaders.variants, "shaders/defaultVS.glsl", fragmentShaderPath, VARIANT_FEATURE_NAMES, N_VARIANT_FEATURES);
+}
+
+void DeinitDefaultShaderVariants(DefaultShaderVariants& shaders, RenderState& state) {
+    for(u32 i = 0; i < shaders.variants.nVariants; i++) {
+        ForgetProgramUniforms(state, shaders.variants.programs[i]);
+    }
+    DeinitShaderVariants(shaders.variants);
+}
+
+/**
+ * the variant with the given feature bits, compiled the first time it's asked for, NULL if it doesn't compile
+ * or, with wait false, while it's still compiling (see LoadShaderVariant)
+ */
+DefaultShader* GetDefaultShader(DefaultShaderVariants& shaders, u32 variant, bool wait = true) {
+    bool compiled;
+    s32 i = LoadShaderVariant(shaders.variants, variant, compiled, wait);
+    if(i < 0) return NULL;
+    if(compiled) {
+        ResolveDefaultShader(shaders.shaders[i], shaders.variants.programs[i]);
+    }
+    return shaders.shaders[i].program ? &shaders.shaders[i] : NULL;
+}
+
+/** hot reloads the variants if their files changed (see ReloadShaderVariantsIfUpdated) and looks up the new programs' uniforms */
+void ReloadDefaultShaderVariantsIfUpdated(DefaultShaderVariants& shaders, RenderState& state) {
+    u64 replaced = ReloadShaderVariantsIfUpdated(shaders.variants, state);
+    for(u32 i = 0; i < shaders.variants.nVariants; i++) {
+        if(replaced & (1ull << i)) {
+            ResolveDefaultShader(shaders.shaders[i], shaders.variants.programs[i]);
+        }
+    }
 }
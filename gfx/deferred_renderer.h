@@ -0,0 +1,90 @@
+#pragma once
+#include "default_renderer.h"
+#include "deferred_shader.h"
+
+// g-buffer texture units, after the material (0 to 2) and light (3 to 6) units so those stay bound
+#define GBUFFER_ALBEDO_UNIT   7
+#define GBUFFER_NORMAL_UNIT   8
+#define GBUFFER_MATERIAL_UNIT 9
+#define GBUFFER_DEPTH_UNIT    10
+
+/**
+ * deferred shading on top of a DefaultRenderer, which it borrows the culling, batching, shadow maps and light clusters from
+ * the geometry pass writes albedo, normals and material indices to the g-buffer and the lighting pass shades every pixel once,
+ * looping over only the lights binned into its screen tile and depth slice
+ * the result goes wherever DefaultRender would put it (renderer.targetFBO) with the same depth in alpha,
+ * so RaymarchRender composites the fractal over it the same way
+ */
+struct DeferredRenderer {
+	DefaultShaderVariants geometryShaders; // defaultVS.glsl with deferredGeometryFS.glsl, so DrawVisibleObjs can draw with them
+	DeferredLightShaderVariants lightShaders;
+	GBuffer gbuffer; // recreated when the window size changes
+};
+
+void InitDeferredRenderer(DeferredRenderer& deferred, DefaultRenderer& renderer, u32 width, u32 height) {
+	InitDefaultShaderVariants(deferred.geometryShaders, "shaders/deferredGeometryFS.glsl");
+	InitDeferredLightShaderVariants(deferred.lightShaders);
+	if(!InitGBuffer(deferred.gbuffer, width, height)) {
+		printf("error with InitGBuffer\n");
+	}
+	InvalidateBindings(renderer.state);
+}
+
+void DeinitDeferredRenderer(DeferredRenderer& deferred, DefaultRenderer& renderer) {
+	DeinitDefaultShaderVariants(deferred.geometryShaders, renderer.state);
+	DeinitDeferredLightShaderVariants(deferred.lightShaders, renderer.state);
+	DeinitGBuffer(deferred.gbuffer);
+}
+
+/** PrecompileShaders for the deferred renderer's shaders */
+void PrecompileDeferredShaders(DeferredRenderer& deferred, DefaultRenderer& renderer, RenderObj* renderObjs, u32 nRenderObjs) {
+	PrecompileShaders(renderer, deferred.geometryShaders, renderObjs, nRenderObjs);
+	PrecompileShaderVariant(deferred.lightShaders.variants, renderer.shaderFeatures & VARIANT_SETTINGS);
+}
+
+void ReloadDeferredShadersIfUpdated(DeferredRenderer& deferred, DefaultRenderer& renderer) {
+	ReloadDefaultShaderVariantsIfUpdated(deferred.geometryShaders, renderer.state);
+	ReloadDeferredLightShaderVariantsIfUpdated(deferred.lightShaders, renderer.state);
+}
+
+/** takes the same arguments as DefaultRender and draws the same image, see DeferredRenderer */
+void DeferredRender(DeferredRenderer& deferred, DefaultRenderer& renderer, Camera& camera, RenderObj* renderObjs, u32 nRenderObjs, DirLight& dirLight, Light* lights, u32 nLights, JointBuffers& jointBuffers, u32 windowWidth, u32 windowHeight) {
+	RenderState& state = renderer.state;
+	GBuffer& gbuffer = deferred.gbuffer;
+	if(gbuffer.width != (int)windowWidth || gbuffer.height != (int)windowHeight) {
+		DeinitGBuffer(gbuffer);
+		InitGBuffer(gbuffer, windowWidth, windowHeight);
+		InvalidateBindings(state);
+	}
+	BeginFrame(renderer, camera, renderObjs, nRenderObjs, dirLight, lights, nLights, jointBuffers, windowWidth, windowHeight);
+
+	// geometry pass, only depth needs clearing since the lighting pass skips pixels nothing was drawn to
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gbuffer.id);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	Frustum frustum;
+	ExtractFrustumPlanes(frustum, camera.vpMatrix);
+	CullObjs(renderer, camera, frustum, renderObjs);
+	DrawVisibleObjs(renderer, deferred.geometryShaders, dirLight, camera, frustum, renderObjs, jointBuffers);
+
+	// lighting pass, one full screen quad that also copies the g-buffer depth over so later passes can depth test against it
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, renderer.targetFBO);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	DeferredLightShader* shader = GetDeferredLightShader(deferred.lightShaders, renderer.shaderFeatures);
+	if(shader == NULL) {
+		EndUniformRingFrame(renderer.uniformBuffers.ring);
+		return;
+	}
+	SetProgram(state, shader->program);
+	BindLightSamplers(renderer, dirLight, shader->u_shadowMap, shader->u_lightData, shader->u_clusterRanges, shader->u_clusterLightIndices);
+	SetSampler(state, shader->u_albedoMap, gbuffer.albedo, GBUFFER_ALBEDO_UNIT);
+	SetSampler(state, shader->u_normalMap, gbuffer.normal, GBUFFER_NORMAL_UNIT);
+	SetSampler(state, shader->u_materialMap, gbuffer.material, GBUFFER_MATERIAL_UNIT);
+	SetSampler(state, shader->u_depthMap, gbuffer.depth, GBUFFER_DEPTH_UNIT);
+	mat4 invVpMatrix = inverse(camera.vpMatrix);
+	SetUniformMatrix4fv(state, shader->u_invVpMatrix, 1, &invVpMatrix[0][0]);
+	glDepthFunc(GL_ALWAYS);
+	// hard coded 6 as the num indices for a square and 0 for the offset (always have square as the first model in the vbo)
+	DrawElements(state, 6, 0);
+	glDepthFunc(GL_LESS);
+	EndUniformRingFrame(renderer.uniformBuffers.ring);
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "shader.h"
+#include "render_state.h"
+#include "uniform_buffers.h"
+#include "default_shader.h"
+
+// one compiled variant of the lighting pass of the deferred renderer, the geometry pass is a DefaultShader (see InitDeferredRenderer)
+// only the renderer wide settings (VARIANT_SETTINGS) change anything in it
+struct DeferredLightShader {
+    GLuint program; // 0 if the variant didn't compile
+
+    // g-buffer
+    GLuint u_albedoMap;
+    GLuint u_normalMap;
+    GLuint u_materialMap;
+    GLuint u_depthMap;
+    GLuint u_invVpMatrix;
+
+    // directional light
+    GLuint u_shadowMap;
+
+    // point / spot lights, binned into clusters (see light_clusters.h)
+    GLuint u_lightData;
+    GLuint u_clusterRanges;
+    GLuint u_clusterLightIndices;
+};
+
+struct DeferredLightShaderVariants {
+    ShaderVariants variants;
+    DeferredLightShader shaders[MAX_SHADER_VARIANTS]; // same order as variants.programs
+};
+
+void ResolveDeferredLightShader(DeferredLightShader& shader, GLuint program) {
+    shader.program = program;
+    if(!program) return;
+
+    BindUniformBlock(program, "FrameConstants", FRAME_CONSTANTS_BINDING);
+    BindUniformBlock(program, "MaterialTable", MATERIAL_TABLE_BINDING);
+
+    shader.u_albedoMap = glGetUniformLocation(program, "u_albedoMap");
+    shader.u_normalMap = glGetUniformLocation(program, "u_normalMap");
+    shader.u_materialMap = glGetUniformLocation(program, "u_materialMap");
+    shader.u_depthMap = glGetUniformLocation(program, "u_depthMap");
+    shader.u_invVpMatrix = glGetUniformLocation(program, "u_invVpMatrix");
+
+    shader.u_shadowMap = glGetUniformLocation(program, "u_shadowMap");
+
+    shader.u_lightData = glGetUniformLocation(program, "u_lightData");
+    shader.u_clusterRanges = glGetUniformLocation(program, "u_clusterRanges");
+    shader.u_clusterLightIndices = glGetUniformLocation(program, "u_clusterLightIndices");
+}
+
+void InitDeferredLightShaderVariants(DeferredLightShaderVariants& shaders) {
+    InitShaderVariants(shaders.variants, "shaders/simpleVS.glsl", "shaders/deferredLightFS.glsl", VARIANT_FEATURE_NAMES, N_VARIANT_FEATURES);
+}
+
+void DeinitDeferredLightShaderVariants(DeferredLightShaderVariants& shaders, RenderState& state) {
+    for(u32 i = 0; i < shaders.variants.nVariants; i++) {
+        ForgetProgramUniforms(state, shaders.variants.programs[i]);
+    }
+    DeinitShaderVariants(shaders.variants);
+}
+
+/** the variant for the renderer's shader features (the ones it doesn't use are dropped), NULL if it doesn't compile */
+DeferredLightShader* GetDeferredLightShader(DeferredLightShaderVariants& shaders, u32 variant) {
+    bool compiled;
+    s32 i = LoadShaderVariant(shaders.variants, variant & VARIANT_SETTINGS, compiled);
+    if(i < 0) return NULL;
+    if(compiled) {
+        ResolveDeferredLightShader(shaders.shaders[i], shaders.variants.programs[i]);
+    }
+    return shaders.shaders[i].program ? &shaders.shaders[i] : NULL;
+}
+
+void ReloadDeferredLightShaderVariantsIfUpdated(DeferredLightShaderVariants& shaders, RenderState& state) {
+    u64 replaced = ReloadShaderVariantsIfUpdated(shaders.variants, state);
+    for(u32 i = 0; i < shaders.variants.nVariants; i++) {
+        if(replaced & (1ull << i)) {
+            ResolveDeferredLightShader(shaders.shaders[i], shaders.variants.programs[i]);
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <math.h>
+#include "../core/types.h"
+#include "gpu_profiler.h"
+
+/**
+ * picks the resolution an expensive pass renders at from how long it took on the gpu, so it stays within a time budget
+ * the scale moves in DYNAMIC_RESOLUTION_STEP steps, each one a render target size the render graph keeps in its pool,
+ * and holds for DYNAMIC_RESOLUTION_HOLD_FRAMES after a change since gpu times come back GPU_PROFILER_LATENCY frames late
+ * a pass' cost goes with its pixel count, the scale squared, which is how the time at another scale is predicted
+ */
+
+#define DYNAMIC_RESOLUTION_MIN_SCALE 0.5f
+#define DYNAMIC_RESOLUTION_MAX_SCALE 1.0f
+#define DYNAMIC_RESOLUTION_STEP 0.125f
+#define DYNAMIC_RESOLUTION_HOLD_FRAMES 16
+#define DYNAMIC_RESOLUTION_SMOOTHING 0.1f // of each new time mixed into the average
+#define DYNAMIC_RESOLUTION_HEADROOM 0.85f // of the budget the next step up has to fit in, so it doesn't flip back and forth
+
+struct DynamicResolution {
+	r32 scale; // of the full resolution's width and height
+	r32 budget; // ms the pass should take
+	r32 averageTime; // ms, at the current scale, < 0 until the first time comes in
+	u32 framesHeld; // since the scale last changed
+};
+
+void InitDynamicResolution(DynamicResolution& resolution, r32 budget) {
+	resolution.scale = DYNAMIC_RESOLUTION_MAX_SCALE;
+	resolution.budget = budget;
+	resolution.averageTime = -1.0f;
+	resolution.framesHeld = 0;
+}
+
+void SetDynamicResolutionScale(DynamicResolution& resolution, r32 scale) {
+	if(resolution.averageTime > 0.0f) {
+		resolution.averageTime *= (scale * scale) / (resolution.scale * resolution.scale);
+	}
+	resolution.scale = scale;
+	resolution.framesHeld = 0;
+}
+
+/** call once a frame with the ns the pass took (see GetGpuZoneTime), < 0 when there's no time this frame */
+void UpdateDynamicResolution(DynamicResolution& resolution, s64 gpuTime) {
+	resolution.framesHeld++;
+	if(gpuTime < 0) return;
+	r32 time = gpuTime / 1000000.0f;
+	// the first times after a change are from frames still at the old scale
+	if(resolution.framesHeld <= GPU_PROFILER_LATENCY) return;
+	if(resolution.averageTime < 0.0f) {
+		resolution.averageTime = time;
+		return;
+	}
+	resolution.averageTime += (time - resolution.averageTime) * DYNAMIC_RESOLUTION_SMOOTHING;
+	if(resolution.framesHeld < DYNAMIC_RESOLUTION_HOLD_FRAMES) return;
+
+	r32 scale = resolution.scale;
+	if(resolution.averageTime > resolution.budget) {
+		// straight to the step that should fit, so a sudden spike doesn't take several holds to get under the budget
+		r32 fits = scale * sqrtf(resolution.budget / resolution.averageTime);
+		scale = floorf(fits / DYNAMIC_RESOLUTION_STEP) * DYNAMIC_RESOLUTION_STEP;
+		scale = fmaxf(scale, DYNAMIC_RESOLUTION_MIN_SCALE);
+	}
+	else if(scale < DYNAMIC_RESOLUTION_MAX_SCALE) {
+		r32 up = scale + DYNAMIC_RESOLUTION_STEP;
+		if(resolution.averageTime * (up * up) / (scale * scale) < resolution.budget * DYNAMIC_RESOLUTION_HEADROOM) {
+			scale = up;
+		}
+	}
+	if(scale != resolution.scale) {
+		SetDynamicResolutionScale(resolution, scale);
+	}
+}
+
+/** size of the scaled target, never 0 */
+void GetDynamicResolutionSize(DynamicResolution& resolution, u32 width, u32 height, u32& scaledWidth, u32& scaledHeight) {
+	scaledWidth = (u32)fmaxf(1.0f, floorf(width * resolution.scale + 0.5f));
+	scaledHeight = (u32)fmaxf(1.0f, floorf(height * resolution.scale + 0.5f));
+}
+
+// simple unit test
+// int main() {
+// 	DynamicResolution resolution;
+// 	InitDynamicResolution(resolution, 4.0f);
+// 	// the pass costs 10ms at full resolution
+// 	for(u32 frame = 0; frame < 200; frame++) {
+// 		r32 time = 10.0f * resolution.scale * resolution.scale;
+// 		UpdateDynamicResolution(resolution, (s64)(time * 1000000.0f));
+// 		if(frame % 20 == 0) printf("frame %d scale %f average %fms\n", frame, resolution.scale, resolution.averageTime);
+// 	}
+// 	// should settle on 0.625 (3.9ms), the most that fits in 4ms
+// 	return 0;
+// }
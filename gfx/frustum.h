@@ -0,0 +1,133 @@
+#pragma once
+#include "../core/types.h"
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+	#include <xmmintrin.h>
+	#define FRUSTUM_SSE
+#endif
+
+// planes are stored as (normal, distance) with the normals pointing into the frustum
+// so a point p is inside a plane when dot(plane.xyz, p) + plane.w >= 0
+struct Frustum {
+	vec4 planes[6]; // left, right, bottom, top, near, far
+};
+
+// Gribb/Hartmann plane extraction from a view projection matrix (works for both perspective and ortho cameras)
+void ExtractFrustumPlanes(Frustum& frustum, const mat4& vpMatrix) {
+	// glm is column major, so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+	vec4 row0 = vec4(vpMatrix[0][0], vpMatrix[1][0], vpMatrix[2][0], vpMatrix[3][0]);
+	vec4 row1 = vec4(vpMatrix[0][1], vpMatrix[1][1], vpMatrix[2][1], vpMatrix[3][1]);
+	vec4 row2 = vec4(vpMatrix[0][2], vpMatrix[1][2], vpMatrix[2][2], vpMatrix[3][2]);
+	vec4 row3 = vec4(vpMatrix[0][3], vpMatrix[1][3], vpMatrix[2][3], vpMatrix[3][3]);
+
+	frustum.planes[0] = row3 + row0;
+	frustum.planes[1] = row3 - row0;
+	frustum.planes[2] = row3 + row1;
+	frustum.planes[3] = row3 - row1;
+	frustum.planes[4] = row3 + row2;
+	frustum.planes[5] = row3 - row2;
+
+	for(u32 i = 0; i < 6; i++) {
+		r32 len = length(vec3(frustum.planes[i]));
+		if(len > 0.0f) {
+			frustum.planes[i] /= len;
+		}
+	}
+}
+
+bool SphereInFrustum(const Frustum& frustum, vec3 center, r32 radius) {
+	for(u32 i = 0; i < 6; i++) {
+		const vec4& p = frustum.planes[i];
+		if(p.x * center.x + p.y * center.y + p.z * center.z + p.w < -radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool AABBInFrustum(const Frustum& frustum, vec3 minExtents, vec3 maxExtents) {
+	for(u32 i = 0; i < 6; i++) {
+		const vec4& p = frustum.planes[i];
+		// test the corner furthest along the plane normal (the "positive vertex")
+		vec3 positive = vec3(
+			p.x >= 0.0f ? maxExtents.x : minExtents.x,
+			p.y >= 0.0f ? maxExtents.y : minExtents.y,
+			p.z >= 0.0f ? maxExtents.z : minExtents.z);
+		if(p.x * positive.x + p.y * positive.y + p.z * positive.z + p.w < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+enum FrustumTestResult {
+	FRUSTUM_OUTSIDE = 0,
+	FRUSTUM_INTERSECTS = 1,
+	FRUSTUM_INSIDE = 2, // nothing contained in the box needs testing either
+};
+
+// the planes transposed into structure of arrays (6 planes padded to 8) so 4 planes are tested at once
+struct FrustumSoA {
+	alignas(16) r32 nx[8];
+	alignas(16) r32 ny[8];
+	alignas(16) r32 nz[8];
+	alignas(16) r32 d[8];
+};
+
+void ToFrustumSoA(const Frustum& frustum, FrustumSoA& soa) {
+	for(u32 i = 0; i < 8; i++) {
+		// the padding planes are 0x + 0y + 0z + 1 which every point is inside
+		vec4 p = i < 6 ? frustum.planes[i] : vec4(0, 0, 0, 1);
+		soa.nx[i] = p.x;
+		soa.ny[i] = p.y;
+		soa.nz[i] = p.z;
+		soa.d[i] = p.w;
+	}
+}
+
+/**
+ * classifies an aabb against all planes: outside if its positive vertex (furthest along the normal) is behind any plane,
+ * inside if its negative vertex is in front of all of them
+ */
+FrustumTestResult TestAABBFrustum(const FrustumSoA& frustum, vec3 minExtents, vec3 maxExtents) {
+#ifdef FRUSTUM_SSE
+	__m128 minX = _mm_set1_ps(minExtents.x), minY = _mm_set1_ps(minExtents.y), minZ = _mm_set1_ps(minExtents.z);
+	__m128 maxX = _mm_set1_ps(maxExtents.x), maxY = _mm_set1_ps(maxExtents.y), maxZ = _mm_set1_ps(maxExtents.z);
+	__m128 zero = _mm_setzero_ps();
+	bool inside = true;
+	for(u32 i = 0; i < 8; i += 4) {
+		__m128 nx = _mm_load_ps(&frustum.nx[i]);
+		__m128 ny = _mm_load_ps(&frustum.ny[i]);
+		__m128 nz = _mm_load_ps(&frustum.nz[i]);
+		__m128 d = _mm_load_ps(&frustum.d[i]);
+		// per axis the larger of n * min and n * max is the positive vertex' contribution, the smaller the negative one's
+		__m128 ax = _mm_mul_ps(nx, minX), bx = _mm_mul_ps(nx, maxX);
+		__m128 ay = _mm_mul_ps(ny, minY), by = _mm_mul_ps(ny, maxY);
+		__m128 az = _mm_mul_ps(nz, minZ), bz = _mm_mul_ps(nz, maxZ);
+		__m128 positive = _mm_add_ps(_mm_add_ps(_mm_max_ps(ax, bx), _mm_max_ps(ay, by)), _mm_add_ps(_mm_max_ps(az, bz), d));
+		if(_mm_movemask_ps(_mm_cmplt_ps(positive, zero)) != 0) {
+			return FRUSTUM_OUTSIDE;
+		}
+		__m128 negative = _mm_add_ps(_mm_add_ps(_mm_min_ps(ax, bx), _mm_min_ps(ay, by)), _mm_add_ps(_mm_min_ps(az, bz), d));
+		if(_mm_movemask_ps(_mm_cmplt_ps(negative, zero)) != 0) {
+			inside = false;
+		}
+	}
+	return inside ? FRUSTUM_INSIDE : FRUSTUM_INTERSECTS;
+#else
+	bool inside = true;
+	for(u32 i = 0; i < 6; i++) {
+		r32 ax = frustum.nx[i] * minExtents.x, bx = frustum.nx[i] * maxExtents.x;
+		r32 ay = frustum.ny[i] * minExtents.y, by = frustum.ny[i] * maxExtents.y;
+		r32 az = frustum.nz[i] * minExtents.z, bz = frustum.nz[i] * maxExtents.z;
+		r32 positive = (ax > bx ? ax : bx) + (ay > by ? ay : by) + (az > bz ? az : bz) + frustum.d[i];
+		if(positive < 0.0f) {
+			return FRUSTUM_OUTSIDE;
+		}
+		r32 negative = (ax < bx ? ax : bx) + (ay < by ? ay : by) + (az < bz ? az : bz) + frustum.d[i];
+		if(negative < 0.0f) {
+			inside = false;
+		}
+	}
+	return inside ? FRUSTUM_INSIDE : FRUSTUM_INTERSECTS;
+#endif
+}
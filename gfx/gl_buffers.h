@@ -41,6 +41,43 @@ struct JointBuffers {
 	u32 numKeyFramesInAnimation[MAX_ANIMATIONS];
 };
 
+// per instance data for instanced draws, streamed every pass
+#define MAX_INSTANCES 8192
+// attribute locations of the per instance matrices (a mat4 attribute takes 4 locations)
+#define INSTANCE_MODEL_MATRIX_LOC 7
+#define INSTANCE_NORMAL_MATRIX_LOC 11
+#define INSTANCE_MATERIAL_INDEX_LOC 15
+
+struct InstanceData {
+	mat4 modelMatrix;
+	mat4 normalMatrix;
+	s32 materialIndex; // so one multi draw can cover materials that share their texture arrays
+	s32 padding[3];
+};
+
+// matches the layout glMultiDrawElementsIndirect reads
+struct DrawElementsIndirectCommand {
+	u32 count;
+	u32 instanceCount;
+	u32 firstIndex;
+	s32 baseVertex;
+	u32 baseInstance; // offsets the per instance attributes, so it also acts as the draw's index into the instance buffer
+};
+
+#define MAX_INDIRECT_COMMANDS 8192
+
+struct IndirectBuffer {
+	GLuint id;
+	u32 nCommands;
+	DrawElementsIndirectCommand commands[MAX_INDIRECT_COMMANDS];
+};
+
+struct InstanceBuffer {
+	GLuint id;
+	u32 nInstances;
+	InstanceData instances[MAX_INSTANCES];
+};
+
 void InitGLBuffers(VBO& vbo, IBO& ibo) {
 	vbo.verticesOffset = 0;
 	ibo.indicesOffset = 0;
@@ -63,3 +100,57 @@ void DeinitGLBuffers(VBO& vbo, IBO& ibo) {
 	glDeleteBuffers(1, &vbo.id);
 	glDeleteBuffers(1, &ibo.id);
 }
+
+void InitInstanceBuffer(InstanceBuffer& instanceBuffer) {
+	instanceBuffer.nInstances = 0;
+	glGenBuffers(1, &instanceBuffer.id);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer.id);
+	glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCES * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+}
+
+// orphans the old storage so we never wait on draws still reading the previous pass' instances
+void UploadInstances(InstanceBuffer& instanceBuffer) {
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer.id);
+	glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCES * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+	if(instanceBuffer.nInstances > 0) {
+		glBufferSubData(GL_ARRAY_BUFFER, 0, instanceBuffer.nInstances * sizeof(InstanceData), instanceBuffer.instances);
+	}
+}
+
+/**
+ * points the per instance attributes of the bound vao at firstInstance
+ * (gl 4.1 has no base instance for glDrawElementsInstanced, so each batch re-points them instead)
+ */
+void PointInstanceAttributes(InstanceBuffer& instanceBuffer, u32 firstInstance) {
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer.id);
+	u8* base = (u8*)(firstInstance * sizeof(InstanceData));
+	for(u32 i = 0; i < 4; i++) {
+		glVertexAttribPointer(INSTANCE_MODEL_MATRIX_LOC + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLvoid*)(base + offsetof(InstanceData, modelMatrix) + i * sizeof(vec4)));
+		glVertexAttribPointer(INSTANCE_NORMAL_MATRIX_LOC + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (GLvoid*)(base + offsetof(InstanceData, normalMatrix) + i * sizeof(vec4)));
+	}
+	glVertexAttribIPointer(INSTANCE_MATERIAL_INDEX_LOC, 1, GL_INT, sizeof(InstanceData), (GLvoid*)(base + offsetof(InstanceData, materialIndex)));
+}
+
+void DeinitInstanceBuffer(InstanceBuffer& instanceBuffer) {
+	glDeleteBuffers(1, &instanceBuffer.id);
+}
+
+void InitIndirectBuffer(IndirectBuffer& indirectBuffer) {
+	indirectBuffer.nCommands = 0;
+	glGenBuffers(1, &indirectBuffer.id);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer.id);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, MAX_INDIRECT_COMMANDS * sizeof(DrawElementsIndirectCommand), NULL, GL_STREAM_DRAW);
+}
+
+// leaves the indirect buffer bound, which is where glMultiDrawElementsIndirect reads commands from
+void UploadIndirectCommands(IndirectBuffer& indirectBuffer) {
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer.id);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, MAX_INDIRECT_COMMANDS * sizeof(DrawElementsIndirectCommand), NULL, GL_STREAM_DRAW);
+	if(indirectBuffer.nCommands > 0) {
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, indirectBuffer.nCommands * sizeof(DrawElementsIndirectCommand), indirectBuffer.commands);
+	}
+}
+
+void DeinitIndirectBuffer(IndirectBuffer& indirectBuffer) {
+	glDeleteBuffers(1, &indirectBuffer.id);
+}
@@ -0,0 +1,435 @@
+#pragma once
+#include <GL/glew.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+#include "../core/types.h"
+#include "../core/fileio.h"
+#include "render_state.h"
+
+/**
+ * the printable ascii glyphs of a font packed into one GL_R8 texture, so a frame's worth of text needs a single texture
+ * glyphs are placed with a skyline packer, which keeps the top edge of everything packed so far as a list of horizontal
+ * segments and puts each rect where its top ends up lowest, little space is lost on glyphs of similar heights
+ *
+ * texels hold signed distances to the glyph's outline rather than coverage, 0.5 on the edge, so text stays sharp at any
+ * scale (the shader thresholds the interpolated distance instead of magnifying a blurry bitmap)
+ * distances come from a supersampled freetype bitmap run through a euclidean distance transform, that's too slow to do
+ * every launch so the atlas is cached next to the font (Arial.ttf -> Arial.ttf.sdf) and redone when the font is newer
+ */
+
+#define GLYPH_ATLAS_FIRST_CHAR 32 // space
+#define GLYPH_ATLAS_CHARS 95 // up to and including '~'
+#define GLYPH_ATLAS_MIN_SIZE 256 // the atlas doubles from this until every glyph fits
+#define GLYPH_ATLAS_MAX_SIZE 4096
+#define GLYPH_PADDING 1 // empty texels around each glyph so linear filtering never reaches a neighbour
+#define GLYPH_SDF_SPREAD 6 // texels of distance either side of the outline, glyphs get this much border for it too
+#define GLYPH_SDF_SUPERSAMPLE 4 // glyphs are rasterized this many times larger than the atlas to measure distances on
+#define GLYPH_SDF_INF 1e20f
+#define GLYPH_ATLAS_MAGIC 0x46445347 // "GSDF"
+#define GLYPH_ATLAS_VERSION 1
+#define GLYPH_ATLAS_EXTENSION ".sdf"
+#define MAX_SKYLINE_NODES 256
+
+struct SkylineNode {
+	u32 x, y; // left end of the segment and the height packed up to there
+	u32 width;
+};
+
+struct SkylinePacker {
+	u32 width, height;
+	u32 nNodes;
+	SkylineNode nodes[MAX_SKYLINE_NODES]; // sorted by x, together they span the whole width
+};
+
+void InitSkylinePacker(SkylinePacker& packer, u32 width, u32 height) {
+	packer.width = width;
+	packer.height = height;
+	packer.nNodes = 1;
+	packer.nodes[0].x = 0;
+	packer.nodes[0].y = 0;
+	packer.nodes[0].width = width;
+}
+
+// where a width x height rect with its left edge at node i would have to sit to clear every segment under it, -1 if it can't fit
+s32 GetSkylineFit(SkylinePacker& packer, u32 i, u32 width, u32 height) {
+	if(packer.nodes[i].x + width > packer.width) return -1;
+	u32 y = 0;
+	for(s32 widthLeft = width; widthLeft > 0; i++) {
+		if(packer.nodes[i].y > y) y = packer.nodes[i].y;
+		if(y + height > packer.height) return -1;
+		widthLeft -= packer.nodes[i].width;
+	}
+	return y;
+}
+
+void RemoveSkylineNode(SkylinePacker& packer, u32 i) {
+	memmove(&packer.nodes[i], &packer.nodes[i + 1], (packer.nNodes - i - 1) * sizeof(SkylineNode));
+	packer.nNodes--;
+}
+
+/** finds the lowest spot for a width x height rect (ties go to the narrowest segment), false once nothing fits */
+bool PackSkylineRect(SkylinePacker& packer, u32 width, u32 height, u32& x, u32& y) {
+	s32 best = -1;
+	u32 bestY = 0, bestWidth = 0;
+	for(u32 i = 0; i < packer.nNodes; i++) {
+		s32 fitY = GetSkylineFit(packer, i, width, height);
+		if(fitY < 0) continue;
+		if(best < 0 || (u32)fitY < bestY || ((u32)fitY == bestY && packer.nodes[i].width < bestWidth)) {
+			best = i;
+			bestY = fitY;
+			bestWidth = packer.nodes[i].width;
+		}
+	}
+	if(best < 0 || packer.nNodes >= MAX_SKYLINE_NODES) return false;
+	x = packer.nodes[best].x;
+	y = bestY;
+
+	// the rect's top becomes a segment, the ones it covers get cut back or removed
+	memmove(&packer.nodes[best + 1], &packer.nodes[best], (packer.nNodes - best) * sizeof(SkylineNode));
+	packer.nNodes++;
+	packer.nodes[best].x = x;
+	packer.nodes[best].y = y + height;
+	packer.nodes[best].width = width;
+	for(u32 i = best + 1; i < packer.nNodes; ) {
+		SkylineNode& node = packer.nodes[i];
+		u32 coveredTo = packer.nodes[i - 1].x + packer.nodes[i - 1].width;
+		if(node.x >= coveredTo) break;
+		u32 covered = coveredTo - node.x;
+		if(node.width > covered) {
+			node.x += covered;
+			node.width -= covered;
+			break;
+		}
+		RemoveSkylineNode(packer, i);
+	}
+	// neighbours at the same height are one segment
+	for(u32 i = 0; i + 1 < packer.nNodes; ) {
+		if(packer.nodes[i].y == packer.nodes[i + 1].y) {
+			packer.nodes[i].width += packer.nodes[i + 1].width;
+			RemoveSkylineNode(packer, i + 1);
+		}
+		else {
+			i++;
+		}
+	}
+	return true;
+}
+
+struct Glyph {
+	v2 uvMin, uvMax; // top left and bottom right corners in the atlas
+	s32 width, height; // in texels, including the distance border
+	r32 bearingX, bearingY; // from the pen on the baseline to the left and top edges of the border
+	r32 advance; // how far the pen moves on after the glyph
+};
+
+struct GlyphAtlas {
+	GLuint texture; // 0 if the font couldn't be loaded
+	u32 width, height;
+	u32 fontSize; // pixels a texel covers at a scale of 1
+	r32 lineHeight; // between baselines
+	Glyph glyphs[GLYPH_ATLAS_CHARS];
+};
+
+// what an atlas is cached as, followed by its width * height texels
+struct GlyphAtlasFileHeader {
+	u32 magic;
+	u32 version;
+	u32 fontSize, spread, supersample; // the atlas is redone if any of these change
+	u32 width, height;
+	r32 lineHeight;
+	Glyph glyphs[GLYPH_ATLAS_CHARS];
+};
+
+/** characters outside printable ascii show up as '?' */
+Glyph& GetGlyph(GlyphAtlas& atlas, char c) {
+	u32 i = (u8)c - GLYPH_ATLAS_FIRST_CHAR;
+	if(i >= GLYPH_ATLAS_CHARS) i = '?' - GLYPH_ATLAS_FIRST_CHAR;
+	return atlas.glyphs[i];
+}
+
+/**
+ * squared distance from every element of f to its nearest 0, through n elements spaced stride apart
+ * f is 0 on the shape and GLYPH_SDF_INF off it, or the squared distances of a previous pass, and it's overwritten
+ * the lower envelope of the parabolas rooted at each element, from felzenszwalb and huttenlocher's distance transforms
+ * of sampled functions, v, z and d need room for n, n + 1 and n elements
+ */
+void DistanceTransform1D(r32* f, u32 n, u32 stride, s32* v, r32* z, r32* d) {
+	u32 k = 0;
+	v[0] = 0;
+	z[0] = -GLYPH_SDF_INF;
+	z[1] = GLYPH_SDF_INF;
+	for(u32 q = 1; q < n; q++) {
+		// where q's parabola crosses the rightmost one on the envelope, those it's under everywhere are dropped
+		r32 s;
+		for(;;) {
+			s32 p = v[k];
+			s = ((f[q * stride] + q * q) - (f[p * stride] + p * p)) / (2.0f * q - 2.0f * p);
+			if(s > z[k]) break;
+			k--; // z[0] is lower than any crossing, so this stops at 0
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = GLYPH_SDF_INF;
+	}
+	k = 0;
+	for(u32 q = 0; q < n; q++) {
+		while(z[k + 1] < q) k++;
+		r32 dq = (r32)q - v[k];
+		d[q] = dq * dq + f[v[k] * stride];
+	}
+	for(u32 q = 0; q < n; q++) {
+		f[q * stride] = d[q];
+	}
+}
+
+// squared distance transform of a width x height grid, columns then rows
+void DistanceTransform2D(r32* grid, u32 width, u32 height, s32* v, r32* z, r32* d) {
+	for(u32 x = 0; x < width; x++) {
+		DistanceTransform1D(grid + x, height, width, v, z, d);
+	}
+	for(u32 y = 0; y < height; y++) {
+		DistanceTransform1D(grid + y * width, width, 1, v, z, d);
+	}
+}
+
+/**
+ * renders glyph i at GLYPH_SDF_SUPERSAMPLE times the atlas size and boils it down into a distance tile of glyph.width x glyph.height,
+ * tile is NULL for glyphs with nothing to draw, like space, free it otherwise
+ */
+bool GenerateGlyphSdf(FT_Face face, u32 i, Glyph& glyph, u8*& tile) {
+	glyph = Glyph();
+	tile = NULL;
+	if(FT_Load_Char(face, GLYPH_ATLAS_FIRST_CHAR + i, FT_LOAD_RENDER)) {
+		printf("failed to load glyph %c\n", GLYPH_ATLAS_FIRST_CHAR + i);
+		return false;
+	}
+	const u32 ss = GLYPH_SDF_SUPERSAMPLE;
+	const u32 border = GLYPH_SDF_SPREAD * ss;
+	FT_Bitmap& bitmap = face->glyph->bitmap;
+	glyph.advance = face->glyph->advance.x / 64.0f / ss; // 26.6 fixed point
+	if(bitmap.width == 0 || bitmap.rows == 0) return true;
+
+	// the high res grid is padded by the spread and rounded up to whole texels
+	glyph.width = (bitmap.width + 2 * border + ss - 1) / ss;
+	glyph.height = (bitmap.rows + 2 * border + ss - 1) / ss;
+	glyph.bearingX = face->glyph->bitmap_left / (r32)ss - GLYPH_SDF_SPREAD;
+	glyph.bearingY = face->glyph->bitmap_top / (r32)ss + GLYPH_SDF_SPREAD;
+	u32 gridWidth = glyph.width * ss, gridHeight = glyph.height * ss;
+	u32 gridSize = gridWidth * gridHeight;
+	u32 lineSize = gridWidth > gridHeight ? gridWidth : gridHeight;
+
+	// distances to the nearest texel inside the outline and to the nearest one outside it
+	r32* toInside = (r32*)malloc(gridSize * sizeof(r32));
+	r32* toOutside = (r32*)malloc(gridSize * sizeof(r32));
+	s32* v = (s32*)malloc(lineSize * sizeof(s32));
+	r32* z = (r32*)malloc((lineSize + 1) * sizeof(r32));
+	r32* d = (r32*)malloc(lineSize * sizeof(r32));
+	for(u32 y = 0; y < gridHeight; y++) {
+		for(u32 x = 0; x < gridWidth; x++) {
+			bool inside = false;
+			if(x >= border && y >= border && x - border < bitmap.width && y - border < bitmap.rows) {
+				inside = bitmap.buffer[(y - border) * bitmap.pitch + x - border] >= 128;
+			}
+			toInside[y * gridWidth + x] = inside ? 0.0f : GLYPH_SDF_INF;
+			toOutside[y * gridWidth + x] = inside ? GLYPH_SDF_INF : 0.0f;
+		}
+	}
+	DistanceTransform2D(toInside, gridWidth, gridHeight, v, z, d);
+	DistanceTransform2D(toOutside, gridWidth, gridHeight, v, z, d);
+
+	// the edge is half way between an inside and an outside texel, each texel averages the signed distances it covers
+	tile = (u8*)malloc(glyph.width * glyph.height);
+	for(s32 ty = 0; ty < glyph.height; ty++) {
+		for(s32 tx = 0; tx < glyph.width; tx++) {
+			r32 sum = 0.0f;
+			for(u32 y = ty * ss; y < (ty + 1) * ss; y++) {
+				for(u32 x = tx * ss; x < (tx + 1) * ss; x++) {
+					u32 j = y * gridWidth + x;
+					sum += toInside[j] == 0.0f ? sqrtf(toOutside[j]) - 0.5f : 0.5f - sqrtf(toInside[j]);
+				}
+			}
+			r32 distance = sum / (ss * ss * ss); // in atlas texels, positive inside
+			r32 value = 0.5f + distance / (2.0f * GLYPH_SDF_SPREAD);
+			value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+			tile[ty * glyph.width + tx] = (u8)(value * 255.0f + 0.5f);
+		}
+	}
+	free(toInside);
+	free(toOutside);
+	free(v);
+	free(z);
+	free(d);
+	return true;
+}
+
+// copies every glyph's tile into a size x size bitmap, false if they don't all fit
+bool PackGlyphs(GlyphAtlas& atlas, u8** tiles, u8* pixels, u32 size) {
+	SkylinePacker packer;
+	InitSkylinePacker(packer, size, size);
+	memset(pixels, 0, size * size); // 0 is as far outside as the spread reaches
+	for(u32 i = 0; i < GLYPH_ATLAS_CHARS; i++) {
+		Glyph& glyph = atlas.glyphs[i];
+		if(tiles[i] == NULL) continue;
+		u32 x, y;
+		if(!PackSkylineRect(packer, glyph.width + 2 * GLYPH_PADDING, glyph.height + 2 * GLYPH_PADDING, x, y)) return false;
+		x += GLYPH_PADDING;
+		y += GLYPH_PADDING;
+		for(s32 row = 0; row < glyph.height; row++) {
+			memcpy(pixels + (y + row) * size + x, tiles[i] + row * glyph.width, glyph.width);
+		}
+		glyph.uvMin = v2(x / (r32)size, y / (r32)size);
+		glyph.uvMax = v2((x + glyph.width) / (r32)size, (y + glyph.height) / (r32)size);
+	}
+	return true;
+}
+
+// generates the distance field atlas of a font into the smallest power of two it fits in, pixels is NULL on failure
+u8* GenerateGlyphAtlas(GlyphAtlas& atlas, const char* fontPath) {
+	FT_Library ft;
+	if(FT_Init_FreeType(&ft)) {
+		printf("failed to init freetype\n");
+		return NULL;
+	}
+	FT_Face face;
+	if(FT_New_Face(ft, fontPath, 0, &face)) {
+		printf("Unable to load font: %s\n", fontPath);
+		FT_Done_FreeType(ft);
+		return NULL;
+	}
+	FT_Set_Pixel_Sizes(face, 0, atlas.fontSize * GLYPH_SDF_SUPERSAMPLE);
+	atlas.lineHeight = face->size->metrics.height / 64.0f / GLYPH_SDF_SUPERSAMPLE;
+	u8* tiles[GLYPH_ATLAS_CHARS];
+	for(u32 i = 0; i < GLYPH_ATLAS_CHARS; i++) {
+		GenerateGlyphSdf(face, i, atlas.glyphs[i], tiles[i]);
+	}
+	FT_Done_Face(face);
+	FT_Done_FreeType(ft);
+
+	u8* pixels = NULL;
+	u32 size = GLYPH_ATLAS_MIN_SIZE;
+	for(; size <= GLYPH_ATLAS_MAX_SIZE; size *= 2) {
+		pixels = (u8*)realloc(pixels, size * size);
+		if(PackGlyphs(atlas, tiles, pixels, size)) break;
+	}
+	for(u32 i = 0; i < GLYPH_ATLAS_CHARS; i++) {
+		free(tiles[i]);
+	}
+	if(size > GLYPH_ATLAS_MAX_SIZE) {
+		printf("glyphs of %s don't fit in a %dx%d atlas\n", fontPath, GLYPH_ATLAS_MAX_SIZE, GLYPH_ATLAS_MAX_SIZE);
+		free(pixels);
+		return NULL;
+	}
+	atlas.width = size;
+	atlas.height = size;
+	return pixels;
+}
+
+bool WriteGlyphAtlas(GlyphAtlas& atlas, u8* pixels, const char* path) {
+	GlyphAtlasFileHeader header;
+	header.magic = GLYPH_ATLAS_MAGIC;
+	header.version = GLYPH_ATLAS_VERSION;
+	header.fontSize = atlas.fontSize;
+	header.spread = GLYPH_SDF_SPREAD;
+	header.supersample = GLYPH_SDF_SUPERSAMPLE;
+	header.width = atlas.width;
+	header.height = atlas.height;
+	header.lineHeight = atlas.lineHeight;
+	memcpy(header.glyphs, atlas.glyphs, sizeof(header.glyphs));
+	FILE* file = fopen(path, "wb");
+	if(file == NULL) {
+		printf("Unable to write glyph atlas: %s\n", path);
+		return false;
+	}
+	u32 dataSize = atlas.width * atlas.height;
+	bool written = fwrite(&header, sizeof(GlyphAtlasFileHeader), 1, file) == 1 && fwrite(pixels, 1, dataSize, file) == dataSize;
+	fclose(file);
+	if(!written) {
+		printf("Unable to write glyph atlas: %s\n", path);
+		remove(path);
+	}
+	return written;
+}
+
+/** NULL if the file is missing or was generated with different settings, free the pixels otherwise */
+u8* ReadGlyphAtlas(GlyphAtlas& atlas, const char* path) {
+	FILE* file = fopen(path, "rb");
+	if(file == NULL) return NULL;
+	GlyphAtlasFileHeader header;
+	if(fread(&header, sizeof(GlyphAtlasFileHeader), 1, file) != 1 || header.magic != GLYPH_ATLAS_MAGIC || header.version != GLYPH_ATLAS_VERSION
+	|| header.fontSize != atlas.fontSize || header.spread != GLYPH_SDF_SPREAD || header.supersample != GLYPH_SDF_SUPERSAMPLE
+	|| header.width > GLYPH_ATLAS_MAX_SIZE || header.height > GLYPH_ATLAS_MAX_SIZE) {
+		fclose(file);
+		return NULL;
+	}
+	u32 dataSize = header.width * header.height;
+	u8* pixels = (u8*)malloc(dataSize);
+	bool read = fread(pixels, 1, dataSize, file) == dataSize;
+	fclose(file);
+	if(!read) {
+		free(pixels);
+		return NULL;
+	}
+	atlas.width = header.width;
+	atlas.height = header.height;
+	atlas.lineHeight = header.lineHeight;
+	memcpy(atlas.glyphs, header.glyphs, sizeof(atlas.glyphs));
+	return pixels;
+}
+
+/**
+ * loads the distance field atlas of the font with a texel per pixel at pixelSize, from its cache if that's up to date
+ * and generating (and caching) it otherwise, the texture is left bound to unit 0
+ */
+bool InitGlyphAtlas(GlyphAtlas& atlas, RenderState& state, const char* fontPath, u32 pixelSize) {
+	atlas.texture = 0;
+	atlas.fontSize = pixelSize;
+	time_t fontTime = LastModifiedOfFile(fontPath);
+	std::string cachePath = std::string(fontPath) + GLYPH_ATLAS_EXTENSION;
+	u8* pixels = NULL;
+	if(fontTime != 0 && LastModifiedOfFile(cachePath.c_str()) >= fontTime) {
+		pixels = ReadGlyphAtlas(atlas, cachePath.c_str());
+	}
+	if(pixels == NULL) {
+		pixels = GenerateGlyphAtlas(atlas, fontPath);
+		if(pixels == NULL) return false;
+		WriteGlyphAtlas(atlas, pixels, cachePath.c_str()); // only costs the next launch if it fails
+	}
+
+	glGenTextures(1, &atlas.texture);
+	SetTexture(state, 0, atlas.texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows are one byte per texel
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, atlas.width, atlas.height, 0, GL_RED, GL_UNSIGNED_BYTE, pixels);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	free(pixels);
+	return true;
+}
+
+void DeinitGlyphAtlas(GlyphAtlas& atlas) {
+	if(atlas.texture != 0) {
+		glDeleteTextures(1, &atlas.texture);
+		atlas.texture = 0;
+	}
+}
+
+// simple unit test
+// int main() {
+// 	SkylinePacker packer;
+// 	InitSkylinePacker(packer, 64, 64);
+// 	u32 x, y, area = 0;
+// 	for(u32 i = 0; ; i++) {
+// 		u32 width = 3 + i % 7, height = 5 + i % 5;
+// 		if(!PackSkylineRect(packer, width, height, x, y)) break;
+// 		area += width * height;
+// 	}
+// 	printf("packed %d of %d texels\n", area, 64 * 64);
+// 	return 0;
+// }
@@ -0,0 +1,97 @@
+#pragma once
+#include <GL/glew.h>
+#include <string.h>
+#include "../core/types.h"
+#include "../core/profiler.h"
+
+// gpu zones are timestamp queries, read back GPU_PROFILER_LATENCY frames later so waiting on them never stalls the cpu
+// they show up in the profiler's trace on the gpu track once they're read
+
+#define MAX_GPU_ZONES 64 // per frame
+#define GPU_PROFILER_LATENCY 4
+
+struct GpuProfiler {
+	bool supported; // timestamp queries need GL 3.3 or ARB_timer_query
+	u32 frameIndex;
+	GLuint queries[GPU_PROFILER_LATENCY][MAX_GPU_ZONES * 2]; // begin and end timestamp of each zone
+	char names[GPU_PROFILER_LATENCY][MAX_GPU_ZONES][MAX_PROFILE_NAME]; // copied, so they outlive a dll reload
+	u32 nZones[GPU_PROFILER_LATENCY];
+	s64 timeOffsets[GPU_PROFILER_LATENCY]; // added to gl timestamps to get profiler time, measured when the frame started
+
+	// the zones read back by the last BeginGpuProfilerFrame, for code that adapts to how busy the gpu is (see GetGpuZoneTime)
+	u32 nReadZones;
+	char readNames[MAX_GPU_ZONES][MAX_PROFILE_NAME];
+	u64 readDurations[MAX_GPU_ZONES]; // ns
+};
+
+void InitGpuProfiler(GpuProfiler& gpuProfiler) {
+	gpuProfiler.supported = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	gpuProfiler.frameIndex = 0;
+	gpuProfiler.nReadZones = 0;
+	for(u32 i = 0; i < GPU_PROFILER_LATENCY; i++) {
+		gpuProfiler.nZones[i] = 0;
+		gpuProfiler.timeOffsets[i] = 0;
+	}
+	if(gpuProfiler.supported) {
+		glGenQueries(GPU_PROFILER_LATENCY * MAX_GPU_ZONES * 2, &gpuProfiler.queries[0][0]);
+	}
+}
+
+void DeinitGpuProfiler(GpuProfiler& gpuProfiler) {
+	if(gpuProfiler.supported) {
+		glDeleteQueries(GPU_PROFILER_LATENCY * MAX_GPU_ZONES * 2, &gpuProfiler.queries[0][0]);
+	}
+}
+
+/** records the zones of the frame GPU_PROFILER_LATENCY frames ago into the profiler and reuses its queries for this one */
+void BeginGpuProfilerFrame(GpuProfiler& gpuProfiler, Profiler& profiler) {
+	if(!gpuProfiler.supported) return;
+	u32 f = gpuProfiler.frameIndex = (gpuProfiler.frameIndex + 1) % GPU_PROFILER_LATENCY;
+	gpuProfiler.nReadZones = 0;
+	for(u32 z = 0; z < gpuProfiler.nZones[f]; z++) {
+		GLint available = 0;
+		glGetQueryObjectiv(gpuProfiler.queries[f][z * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+		// still not done after GPU_PROFILER_LATENCY frames, drop it rather than wait
+		if(!available) continue;
+		GLuint64 begin, end;
+		glGetQueryObjectui64v(gpuProfiler.queries[f][z * 2], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(gpuProfiler.queries[f][z * 2 + 1], GL_QUERY_RESULT, &end);
+		RecordProfileEvent(profiler, gpuProfiler.names[f][z], begin + gpuProfiler.timeOffsets[f], end - begin, 0, true);
+		strcpy(gpuProfiler.readNames[gpuProfiler.nReadZones], gpuProfiler.names[f][z]);
+		gpuProfiler.readDurations[gpuProfiler.nReadZones++] = end - begin;
+	}
+	gpuProfiler.nZones[f] = 0;
+
+	GLint64 gpuTime;
+	glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+	gpuProfiler.timeOffsets[f] = (s64)GetProfileTime(profiler) - gpuTime;
+}
+
+/** returns the zone to pass to EndGpuZone, zones can nest */
+s32 BeginGpuZone(GpuProfiler& gpuProfiler, const char* name) {
+	u32 f = gpuProfiler.frameIndex;
+	if(!gpuProfiler.supported || gpuProfiler.nZones[f] >= MAX_GPU_ZONES) return -1;
+	u32 zone = gpuProfiler.nZones[f]++;
+	CopyProfileName(gpuProfiler.names[f][zone], name);
+	glQueryCounter(gpuProfiler.queries[f][zone * 2], GL_TIMESTAMP);
+	return zone;
+}
+
+void EndGpuZone(GpuProfiler& gpuProfiler, s32 zone) {
+	if(zone < 0) return;
+	glQueryCounter(gpuProfiler.queries[gpuProfiler.frameIndex][zone * 2 + 1], GL_TIMESTAMP);
+}
+
+/**
+ * ns the zones named name took on the gpu in the frame read back by the last BeginGpuProfilerFrame, GPU_PROFILER_LATENCY
+ * frames ago, -1 if there weren't any (the zone didn't run then, its queries weren't done or timer queries aren't supported)
+ */
+s64 GetGpuZoneTime(GpuProfiler& gpuProfiler, const char* name) {
+	s64 time = -1;
+	for(u32 z = 0; z < gpuProfiler.nReadZones; z++) {
+		if(strncmp(gpuProfiler.readNames[z], name, MAX_PROFILE_NAME - 1) == 0) {
+			time = (time < 0 ? 0 : time) + gpuProfiler.readDurations[z];
+		}
+	}
+	return time;
+}
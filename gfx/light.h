@@ -3,25 +3,114 @@
 #include "texture.h"
 #include "camera.h"
 
+#define MAX_SHADOW_CASCADES 4 // has to match shaders/include/frame_constants.glsl
+#define SHADOW_CASCADE_SIZE 2048 // width and height of each cascade's layer in the shadow map
+#define SHADOW_CASTER_DISTANCE 50.0f // how far towards the light casters outside a cascade still get rendered into it
+// cascades are this much bigger than their slice of the view frustum, so they only have to move
+// (and re-render their static casters) once the view has moved out of the extra room
+#define SHADOW_CASCADE_PADDING 1.25f
+
 struct DirLight {
     v3 color;
 
     // for shadows
-    Camera cameraForShadows;
-    FBO shadowMap;
+    Camera cameraForShadows; // only its dir is the light's, the cascades get their own cameras fitted to the view
+    u32 nCascades;
+    r32 shadowDistance; // the cascades cover the view frustum up to here
+    r32 splitLambda; // 0 splits the view frustum uniformly, 1 logarithmically
+    Camera cascadeCameras[MAX_SHADOW_CASCADES];
+    r32 cascadeSplits[MAX_SHADOW_CASCADES]; // view depth each cascade ends at
+    FBO shadowMap; // texture array, one layer per cascade
+
+    // static casters are only rendered into staticShadowMap when they or their cascade change,
+    // every frame its layers are copied into shadowMap and just the dynamic casters are drawn on top
+    FBO staticShadowMap;
+    mat4 staticVpMatrices[MAX_SHADOW_CASCADES]; // what each static layer was rendered with
+    bool staticLayerDirty[MAX_SHADOW_CASCADES];
 };
 
-void InitDirLight(DirLight& dirLight, v3 dir = v3(-1,-1,-1), v3 color = v3(1.0f, 1.0f, 1.0f)) {
+void InitDirLight(DirLight& dirLight, v3 dir = v3(-1,-1,-1), v3 color = v3(1.0f, 1.0f, 1.0f), u32 nCascades = 4, r32 shadowDistance = 100.0f) {
     dirLight.color = color;
-    InitOrthoCamera(dirLight.cameraForShadows, v3(10,10,10), dir);
-    // dirLight.cameraForShadows.farClip = 10000;
-    dirLight.cameraForShadows.leftClip = -5.0f;
-    dirLight.cameraForShadows.rightClip = 5.0f;
-    dirLight.cameraForShadows.topClip = -5.0f;
-    dirLight.cameraForShadows.bottomClip = 5.0f;
-    UpdateOrthoMatrices(dirLight.cameraForShadows);
-    // InitShadowMap(dirLight.shadowMap, 4096, 4096);
-    InitShadowMap(dirLight.shadowMap, 1024, 1024);
+    InitOrthoCamera(dirLight.cameraForShadows, v3(10,10,10), normalize(dir));
+    if(nCascades < 1) nCascades = 1;
+    if(nCascades > MAX_SHADOW_CASCADES) nCascades = MAX_SHADOW_CASCADES;
+    dirLight.nCascades = nCascades;
+    dirLight.shadowDistance = shadowDistance;
+    dirLight.splitLambda = 0.75f;
+    for(u32 i = 0; i < MAX_SHADOW_CASCADES; i++) {
+        dirLight.cascadeCameras[i] = dirLight.cameraForShadows;
+        dirLight.cascadeSplits[i] = shadowDistance;
+        dirLight.staticVpMatrices[i] = mat4(0);
+        dirLight.staticLayerDirty[i] = true;
+    }
+    InitShadowMapArray(dirLight.shadowMap, SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE, nCascades);
+    InitShadowMapArray(dirLight.staticShadowMap, SHADOW_CASCADE_SIZE, SHADOW_CASCADE_SIZE, nCascades);
+}
+
+void DeinitDirLight(DirLight& dirLight) {
+    glDeleteFramebuffers(1, &dirLight.shadowMap.id);
+    glDeleteFramebuffers(1, &dirLight.staticShadowMap.id);
+    DeinitTexture(dirLight.shadowMap.texture);
+    DeinitTexture(dirLight.staticShadowMap.texture);
+}
+
+/**
+ * splits the view frustum (up to shadowDistance) into the cascades and fits each cascade's ortho camera around its slice
+ * the bounds are a sphere around the slice so they don't change size as the view rotates, and the camera only moves
+ * in whole shadow map texels so shadow edges don't shimmer as the view moves
+ * a cascade keeps its camera while the slice still fits in its padding, so its static casters can stay cached
+ */
+void UpdateShadowCascades(DirLight& dirLight, Camera& viewCamera) {
+    v3 lightDir = normalize(dirLight.cameraForShadows.dir);
+    v3 lightUp = abs(lightDir.y) > 0.99f ? v3(0, 0, 1) : v3(0, 1, 0);
+    v3 lightRight = normalize(cross(lightDir, lightUp));
+    lightUp = cross(lightRight, lightDir);
+
+    r32 nearClip = viewCamera.nearClip;
+    r32 farClip = min(dirLight.shadowDistance, viewCamera.farClip);
+    r32 tanHalfFov = tan(radians(viewCamera.fov) * 0.5f);
+    r32 sliceNear = nearClip;
+    for(u32 i = 0; i < dirLight.nCascades; i++) {
+        // practical split scheme, a blend of logarithmic and uniform splits
+        r32 t = (i + 1) / (r32)dirLight.nCascades;
+        r32 logSplit = nearClip * pow(farClip / nearClip, t);
+        r32 uniformSplit = nearClip + (farClip - nearClip) * t;
+        r32 sliceFar = dirLight.splitLambda * logSplit + (1.0f - dirLight.splitLambda) * uniformSplit;
+        dirLight.cascadeSplits[i] = sliceFar;
+
+        // bounding sphere of the slice's 8 corners
+        v3 corners[8];
+        for(u32 c = 0; c < 8; c++) {
+            r32 depth = c & 4 ? sliceFar : sliceNear;
+            r32 halfHeight = depth * tanHalfFov;
+            r32 halfWidth = halfHeight * viewCamera.aspect;
+            corners[c] = viewCamera.pos + viewCamera.dir * depth
+                + viewCamera.right * (c & 1 ? halfWidth : -halfWidth)
+                + viewCamera.up * (c & 2 ? halfHeight : -halfHeight);
+        }
+        v3 center = v3(0);
+        for(u32 c = 0; c < 8; c++) center += corners[c];
+        center /= 8.0f;
+        r32 radius = 0.0f;
+        for(u32 c = 0; c < 8; c++) radius = max(radius, length(corners[c] - center));
+        radius = ceil(radius * 16.0f) / 16.0f; // so float noise doesn't change the texel size from frame to frame
+        r32 paddedRadius = radius * SHADOW_CASCADE_PADDING;
+
+        Camera& camera = dirLight.cascadeCameras[i];
+        v3 cascadeCenter = camera.pos + camera.dir * (paddedRadius + SHADOW_CASTER_DISTANCE);
+        bool fits = camera.rightClip == paddedRadius && camera.dir == lightDir && length(center - cascadeCenter) + radius <= paddedRadius;
+        if(!fits) {
+            // snap the center to the texel grid in the light's plane
+            r32 texelSize = 2.0f * paddedRadius / dirLight.shadowMap.width;
+            r32 x = dot(center, lightRight);
+            r32 y = dot(center, lightUp);
+            center += lightRight * (floor(x / texelSize) * texelSize - x) + lightUp * (floor(y / texelSize) * texelSize - y);
+
+            InitOrthoCamera(camera, center - lightDir * (paddedRadius + SHADOW_CASTER_DISTANCE), lightDir, lightUp, lightRight,
+                -paddedRadius, paddedRadius, -paddedRadius, paddedRadius, 0.0f, 2.0f * paddedRadius + SHADOW_CASTER_DISTANCE);
+        }
+        sliceNear = sliceFar;
+    }
 }
 
 struct Light {
@@ -29,21 +118,22 @@ struct Light {
     v3 lookDir;
     v3 color;
 
-    // for spot lights
+    // for spot lights, the full angle of the cone in degrees (0 for point lights)
     r32 angle;
 
     // coefficients that make up the fade out function
     r32 constant;
     r32 linear;
     r32 quadratic;
+    r32 radius; // where the fade out gets too dark to see, set by BinLights
 
     // for shadows
     Camera cameraForShadows;
-    FBO shadowMap;
+    FBO shadowMap; // id is 0 until a shadow map is set up
 };
 
 void InitLight(Light& light, v3 pos, v3 lookDir, v3 color = v3(1,1,1),
-r32 angle = 90, r32 constant = 0, r32 linear = 0, r32 quadratic = 0) {
+r32 angle = 0, r32 constant = 1, r32 linear = 0.35f, r32 quadratic = 0.44f) {
     light.pos = pos;
     light.lookDir = lookDir;
     light.color = color;
@@ -51,5 +141,9 @@ r32 angle = 90, r32 constant = 0, r32 linear = 0, r32 quadratic = 0) {
     light.constant = constant;
     light.linear = linear;
     light.quadratic = quadratic;
+    light.radius = 0;
     // TODO: cube map for shadows
+    light.shadowMap.id = 0;
+    light.shadowMap.texture = 0;
+    light.shadowMap.rbo = 0;
 }
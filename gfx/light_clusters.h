@@ -0,0 +1,263 @@
+#pragma once
+#include <GL/glew.h>
+#include <string.h>
+#include "../core/types.h"
+#include "../core/jobs.h"
+#include "camera.h"
+#include "light.h"
+
+// clustered forward lighting
+// the view frustum is split into a grid of froxels (screen tiles x exponential depth slices), every point / spot light
+// is binned into the froxels its sphere of influence touches, and the fragment shader only loops over its froxel's lights
+// the light data, each froxel's range and the compact light index list go to the gpu as texture buffers
+
+// have to match shaders/include/lighting.glsl
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+
+#define MAX_CLUSTERED_LIGHTS 1024
+#define MAX_LIGHTS_PER_CLUSTER 128
+#define MAX_CLUSTER_LIGHT_INDICES (CLUSTER_COUNT * 32)
+#define MIN_CLUSTER_SLICES_PER_THREAD 2
+
+// slices are exponential between these view depths, anything nearer goes in the first slice and anything farther in the last
+#define CLUSTER_NEAR 0.1f
+#define CLUSTER_MAX_FAR 500.0f
+
+// a light's radius is where its attenuated brightness drops below this
+#define LIGHT_CUTOFF (1.0f / 256.0f)
+#define MAX_LIGHT_RADIUS 100.0f // for lights that never fall off
+
+// 4 texels of the light data texture buffer, layout has to match shaders/include/lighting.glsl
+struct ClusterLight {
+	vec4 posRadius; // world space
+	vec4 colorSpotCos; // w is the cos of the spot cone's half angle, -1 for point lights
+	vec4 dirConstant; // spot direction, w is the constant attenuation
+	vec4 attenuation; // x linear, y quadratic
+};
+
+struct LightClusters {
+	r32 near;
+	r32 far;
+
+	u32 nLights;
+	ClusterLight lights[MAX_CLUSTERED_LIGHTS];
+	vec4 viewSpheres[MAX_CLUSTERED_LIGHTS]; // view space center (z forward) and radius, for binning
+
+	// each slice is binned by one thread into these, then they're packed into indices
+	u32 clusterCounts[CLUSTER_COUNT];
+	u16 clusterLights[CLUSTER_COUNT][MAX_LIGHTS_PER_CLUSTER];
+
+	u32 ranges[CLUSTER_COUNT][2]; // offset into indices and count
+	u32 nIndices;
+	u16 indices[MAX_CLUSTER_LIGHT_INDICES];
+
+	GLuint lightBuffer, lightTexture;
+	GLuint rangeBuffer, rangeTexture;
+	GLuint indexBuffer, indexTexture;
+};
+
+void InitTextureBuffer(GLuint& buffer, GLuint& texture, GLenum format, u32 size) {
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBufferData(GL_TEXTURE_BUFFER, size, NULL, GL_STREAM_DRAW);
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_BUFFER, texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+}
+
+void InitLightClusters(LightClusters& clusters) {
+	clusters.near = CLUSTER_NEAR;
+	clusters.far = CLUSTER_MAX_FAR;
+	clusters.nLights = 0;
+	clusters.nIndices = 0;
+	memset(clusters.ranges, 0, sizeof(clusters.ranges));
+	InitTextureBuffer(clusters.lightBuffer, clusters.lightTexture, GL_RGBA32F, sizeof(clusters.lights));
+	InitTextureBuffer(clusters.rangeBuffer, clusters.rangeTexture, GL_RG32UI, sizeof(clusters.ranges));
+	InitTextureBuffer(clusters.indexBuffer, clusters.indexTexture, GL_R16UI, sizeof(clusters.indices));
+}
+
+void DeinitLightClusters(LightClusters& clusters) {
+	glDeleteTextures(1, &clusters.lightTexture);
+	glDeleteTextures(1, &clusters.rangeTexture);
+	glDeleteTextures(1, &clusters.indexTexture);
+	glDeleteBuffers(1, &clusters.lightBuffer);
+	glDeleteBuffers(1, &clusters.rangeBuffer);
+	glDeleteBuffers(1, &clusters.indexBuffer);
+}
+
+/** distance where constant / linear / quadratic attenuation of the light's brightest channel drops below LIGHT_CUTOFF */
+r32 CalcLightRadius(Light& light) {
+	r32 brightness = max(light.color.x, max(light.color.y, light.color.z));
+	// solve quadratic * d^2 + linear * d + constant = brightness / LIGHT_CUTOFF
+	r32 c = light.constant - brightness / LIGHT_CUTOFF;
+	r32 radius = MAX_LIGHT_RADIUS;
+	if(light.quadratic > 0.0f) {
+		radius = (-light.linear + sqrt(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+	}
+	else if(light.linear > 0.0f) {
+		radius = -c / light.linear;
+	}
+	return clamp(radius, 0.0f, MAX_LIGHT_RADIUS);
+}
+
+r32 GetClusterSliceNear(LightClusters& clusters, u32 slice) {
+	return slice == 0 ? 0.0f : clusters.near * pow(clusters.far / clusters.near, slice / (r32)CLUSTER_GRID_Z);
+}
+
+r32 GetClusterSliceFar(LightClusters& clusters, u32 slice) {
+	return slice == CLUSTER_GRID_Z - 1 ? FLT_MAX : clusters.near * pow(clusters.far / clusters.near, (slice + 1) / (r32)CLUSTER_GRID_Z);
+}
+
+// the same mapping lighting.glsl uses to find a fragment's slice
+u32 GetClusterSlice(LightClusters& clusters, r32 viewDepth) {
+	if(viewDepth <= clusters.near) return 0;
+	s32 slice = (s32)(log(viewDepth / clusters.near) * CLUSTER_GRID_Z / log(clusters.far / clusters.near));
+	return slice < CLUSTER_GRID_Z ? slice : CLUSTER_GRID_Z - 1;
+}
+
+u32 GetClusterIndex(u32 x, u32 y, u32 slice) {
+	return (slice * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x;
+}
+
+// tile column (or row with tanHalfFov instead of tanHalfFov * aspect) of a view space point, not clamped to the grid
+r32 GetClusterTile(r32 viewX, r32 viewDepth, r32 tanHalfFov, u32 gridSize) {
+	return (viewX / (viewDepth * tanHalfFov) * 0.5f + 0.5f) * gridSize;
+}
+
+// range of tiles [first, last] the sphere's bounding box covers somewhere between depths d0 and d1 (both > 0)
+void GetClusterTileRange(r32 center, r32 radius, r32 d0, r32 d1, r32 tanHalfFov, u32 gridSize, u32& first, u32& last) {
+	// x / depth is monotonic in depth, so the extremes are at the ends of the depth range
+	r32 lo = min(GetClusterTile(center - radius, d0, tanHalfFov, gridSize), GetClusterTile(center - radius, d1, tanHalfFov, gridSize));
+	r32 hi = max(GetClusterTile(center + radius, d0, tanHalfFov, gridSize), GetClusterTile(center + radius, d1, tanHalfFov, gridSize));
+	first = lo <= 0.0f ? 0 : (lo >= gridSize ? gridSize : (u32)lo);
+	last = hi < 0.0f ? 0 : (hi >= gridSize ? gridSize - 1 : (u32)hi);
+	if(hi < 0.0f) first = gridSize; // entirely off the low side, empty range
+}
+
+/**
+ * bins the lights into the froxels of camera's view, split across threads by depth slice
+ * a light goes into every froxel its sphere's bounding box touches, which is conservative, never missing a lit pixel
+ */
+void BinLights(LightClusters& clusters, Camera& camera, Light* lights, u32 nLights) {
+	PROFILE_FUNCTION();
+	if(nLights > MAX_CLUSTERED_LIGHTS) {
+		printf("exceeded max clustered lights\n");
+		nLights = MAX_CLUSTERED_LIGHTS;
+	}
+	clusters.far = max(min(camera.farClip, CLUSTER_MAX_FAR), clusters.near * 2.0f);
+	clusters.nLights = nLights;
+	for(u32 i = 0; i < nLights; i++) {
+		Light& light = lights[i];
+		light.radius = CalcLightRadius(light);
+		ClusterLight& clusterLight = clusters.lights[i];
+		clusterLight.posRadius = vec4(light.pos, light.radius);
+		r32 spotCos = light.angle > 0.0f && light.angle < 360.0f ? cos(radians(light.angle * 0.5f)) : -1.0f;
+		clusterLight.colorSpotCos = vec4(light.color, spotCos);
+		clusterLight.dirConstant = vec4(length(light.lookDir) > 0.0f ? normalize(light.lookDir) : v3(0, 0, -1), light.constant);
+		clusterLight.attenuation = vec4(light.linear, light.quadratic, 0, 0);
+		vec4 viewPos = camera.viewMatrix * vec4(light.pos, 1.0f);
+		clusters.viewSpheres[i] = vec4(viewPos.x, viewPos.y, -viewPos.z, light.radius);
+	}
+
+	r32 tanHalfFovY = tan(radians(camera.fov) * 0.5f);
+	r32 tanHalfFovX = tanHalfFovY * camera.aspect;
+	ParallelFor(CLUSTER_GRID_Z, MIN_CLUSTER_SLICES_PER_THREAD, [&](u32 start, u32 end, u32 threadIndex) {
+		for(u32 slice = start; slice < end; slice++) {
+			u32* counts = clusters.clusterCounts + GetClusterIndex(0, 0, slice);
+			memset(counts, 0, CLUSTER_GRID_X * CLUSTER_GRID_Y * sizeof(u32));
+			r32 sliceNear = GetClusterSliceNear(clusters, slice);
+			r32 sliceFar = GetClusterSliceFar(clusters, slice);
+			for(u32 i = 0; i < clusters.nLights; i++) {
+				vec4 sphere = clusters.viewSpheres[i];
+				r32 d0 = max(sphere.z - sphere.w, sliceNear);
+				r32 d1 = min(sphere.z + sphere.w, sliceFar);
+				if(d0 > d1) continue;
+
+				u32 x0 = 0, x1 = CLUSTER_GRID_X - 1, y0 = 0, y1 = CLUSTER_GRID_Y - 1;
+				// a sphere reaching behind the camera can project anywhere
+				if(d0 > 0.0f) {
+					GetClusterTileRange(sphere.x, sphere.w, d0, d1, tanHalfFovX, CLUSTER_GRID_X, x0, x1);
+					GetClusterTileRange(sphere.y, sphere.w, d0, d1, tanHalfFovY, CLUSTER_GRID_Y, y0, y1);
+				}
+				for(u32 y = y0; y <= y1 && y < CLUSTER_GRID_Y; y++) {
+					for(u32 x = x0; x <= x1 && x < CLUSTER_GRID_X; x++) {
+						u32 cluster = GetClusterIndex(x, y, slice);
+						if(clusters.clusterCounts[cluster] < MAX_LIGHTS_PER_CLUSTER) {
+							clusters.clusterLights[cluster][clusters.clusterCounts[cluster]++] = i;
+						}
+					}
+				}
+			}
+		}
+	});
+
+	// pack the per froxel lists into one index list
+	clusters.nIndices = 0;
+	bool overflowed = false;
+	for(u32 c = 0; c < CLUSTER_COUNT; c++) {
+		u32 count = clusters.clusterCounts[c];
+		if(clusters.nIndices + count > MAX_CLUSTER_LIGHT_INDICES) {
+			count = MAX_CLUSTER_LIGHT_INDICES - clusters.nIndices;
+			overflowed = true;
+		}
+		clusters.ranges[c][0] = clusters.nIndices;
+		clusters.ranges[c][1] = count;
+		memcpy(clusters.indices + clusters.nIndices, clusters.clusterLights[c], count * sizeof(u16));
+		clusters.nIndices += count;
+	}
+	if(overflowed) {
+		printf("exceeded max cluster light indices, lights were dropped from the farthest clusters\n");
+	}
+}
+
+void UploadLightClusters(LightClusters& clusters) {
+	// orphan each buffer so the gpu can keep reading last frame's
+	glBindBuffer(GL_TEXTURE_BUFFER, clusters.lightBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(clusters.lights), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, clusters.nLights * sizeof(ClusterLight), clusters.lights);
+	glBindBuffer(GL_TEXTURE_BUFFER, clusters.rangeBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(clusters.ranges), clusters.ranges, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, clusters.indexBuffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(clusters.indices), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, clusters.nIndices * sizeof(u16), clusters.indices);
+}
+
+// x cluster near, y slices per log of depth, zw screen size, for FrameConstants
+vec4 GetClusterParams(LightClusters& clusters, u32 screenWidth, u32 screenHeight) {
+	return vec4(clusters.near, CLUSTER_GRID_Z / log(clusters.far / clusters.near), screenWidth, screenHeight);
+}
+
+// simple unit test (no gl context needed), every light that touches a froxel has to be in its list
+
+// int main() {
+// 	static LightClusters clusters; static Light lights[256];
+// 	Camera camera;
+// 	InitCamera(camera, vec3(0, 1, 3), vec3(0, 0, -1), vec3(0, 1, 0), vec3(1, 0, 0), 45.0f, 16.0f / 9.0f, 0.01f, 1000.0f);
+// 	for(u32 i = 0; i < 256; i++) {
+// 		InitLight(lights[i], vec3((i % 16) * 8.0f - 60.0f, (i % 4) * 0.5f, -(r32)(i / 16) * 8.0f), vec3(0, -1, 0), vec3(1, 0.8f, 0.5f), 0, 1.0f, 0.7f, 1.8f);
+// 	}
+// 	clusters.near = CLUSTER_NEAR;
+// 	BinLights(clusters, camera, lights, 256);
+// 	r32 tanY = tan(radians(camera.fov) * 0.5f), tanX = tanY * camera.aspect;
+// 	u32 missed = 0;
+// 	for(u32 i = 0; i < 20000; i++) {
+// 		// random point in view, check every light reaching it is in its cluster
+// 		r32 depth = 0.05f + (rand() % 10000) * 0.01f;
+// 		vec3 view = vec3(((rand() % 2000) / 1000.0f - 1.0f) * depth * tanX, ((rand() % 2000) / 1000.0f - 1.0f) * depth * tanY, depth);
+// 		u32 x = min((u32)GetClusterTile(view.x, depth, tanX, CLUSTER_GRID_X), (u32)CLUSTER_GRID_X - 1);
+// 		u32 y = min((u32)GetClusterTile(view.y, depth, tanY, CLUSTER_GRID_Y), (u32)CLUSTER_GRID_Y - 1);
+// 		u32 cluster = GetClusterIndex(x, y, GetClusterSlice(clusters, depth));
+// 		for(u32 l = 0; l < 256; l++) {
+// 			vec4 sphere = clusters.viewSpheres[l];
+// 			if(length(vec3(sphere) - view) > sphere.w) continue;
+// 			bool found = false;
+// 			for(u32 k = 0; k < clusters.ranges[cluster][1]; k++) found |= clusters.indices[clusters.ranges[cluster][0] + k] == l;
+// 			missed += !found;
+// 		}
+// 	}
+// 	printf("indices: %d missed: %d (should be 0)\n", clusters.nIndices, missed);
+// 	return 0;
+// }
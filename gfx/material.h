@@ -3,6 +3,7 @@
 #include "../core/types.h"
 
 struct Material {
+    u32 id; // index into assets.materials, used to batch draws with the same material
     Texture* texture;
     Texture* normalMap;
     Texture* dispMap; // parallax displacement map
@@ -30,14 +31,26 @@ v3 color = v3(1,1,1), r32 shininess = 100.0f, r32 dispMapScale = 0.04f, r32 disp
     material.friction = friction;
 }
 
+// textures in a texture array are deleted with the array
 void DeinitMaterial(Material& material) {
-    if(material.texture != NULL) {
+    if(material.texture != NULL && material.texture->layer < 0) {
         DeinitTexture(material.texture->texture);
     }
-    if(material.normalMap != NULL) {
+    if(material.normalMap != NULL && material.normalMap->layer < 0) {
         DeinitTexture(material.normalMap->texture);
     }
-    if(material.dispMap != NULL) {
+    if(material.dispMap != NULL && material.dispMap->layer < 0) {
         DeinitTexture(material.dispMap->texture);
     }
 }
+
+bool InSameTextureArray(Texture* a, Texture* b) {
+    if(a == NULL || b == NULL) return a == b;
+    return a->texture == b->texture;
+}
+
+// materials whose maps are all in the same texture arrays draw one after another without binding anything
+bool SharesTextureArrays(Material& a, Material& b) {
+    return InSameTextureArray(a.texture, b.texture) && InSameTextureArray(a.normalMap, b.normalMap)
+        && InSameTextureArray(a.dispMap, b.dispMap);
+}
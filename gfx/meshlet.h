@@ -0,0 +1,280 @@
+#pragma once
+#include <GL/glew.h>
+#include <vector>
+#include "model.h"
+#include "gl_buffers.h"
+#include "frustum.h"
+
+// sizes picked so a meshlet's vertices and triangles fit nicely in on-chip memory on most gpus
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+// only static models with at least this many triangles get split into meshlets
+// (small models are cheaper to just draw than to cull piece by piece)
+#define MESHLET_MIN_TRIANGLES 512
+#define MAX_MESHLETS 65536
+#define MAX_DRAW_RANGES 4096
+
+struct Meshlet {
+	// the meshlet's triangles are contiguous in the IBO, so it's just a range of indices
+	u32 indicesOffset;
+	u32 numIndices;
+
+	// bounding sphere in model space
+	vec3 center;
+	r32 radius;
+
+	// normal cone in model space - if the whole cone faces away from the camera, every triangle is a backface
+	vec3 coneAxis;
+	r32 coneCutoff; // sin of the cone's spread angle, 1 means the cone can never be culled
+};
+
+struct MeshletBuffers {
+	u32 meshletsOffset;
+	Meshlet meshlets[MAX_MESHLETS];
+};
+
+// ready to hand to glMultiDrawElements
+struct DrawRanges {
+	u32 nRanges;
+	GLsizei counts[MAX_DRAW_RANGES];
+	const GLvoid* offsets[MAX_DRAW_RANGES];
+};
+
+void InitMeshletBuffers(MeshletBuffers& meshletBuffers) {
+	meshletBuffers.meshletsOffset = 0;
+}
+
+void CalcMeshletBounds(Meshlet& meshlet, IndexType* indices, Vertex* vertices) {
+	vec3 minPos = vec3(FLT_MAX);
+	vec3 maxPos = vec3(-FLT_MAX);
+	for(u32 i = 0; i < meshlet.numIndices; i++) {
+		vec3 pos = vertices[indices[meshlet.indicesOffset + i]].pos;
+		minPos = min(minPos, pos);
+		maxPos = max(maxPos, pos);
+	}
+	meshlet.center = (minPos + maxPos) * 0.5f;
+	meshlet.radius = 0.0f;
+	for(u32 i = 0; i < meshlet.numIndices; i++) {
+		vec3 pos = vertices[indices[meshlet.indicesOffset + i]].pos;
+		meshlet.radius = max(meshlet.radius, length(pos - meshlet.center));
+	}
+
+	// cone axis is the average of the triangle normals, the spread is the widest angle from it
+	vec3 normals[MESHLET_MAX_TRIANGLES];
+	u32 numNormals = 0;
+	vec3 axis = vec3(0.0f);
+	for(u32 i = 0; i < meshlet.numIndices; i += 3) {
+		vec3 p0 = vertices[indices[meshlet.indicesOffset + i + 0]].pos;
+		vec3 p1 = vertices[indices[meshlet.indicesOffset + i + 1]].pos;
+		vec3 p2 = vertices[indices[meshlet.indicesOffset + i + 2]].pos;
+		vec3 normal = cross(p1 - p0, p2 - p0);
+		r32 len = length(normal);
+		if(len <= 0.0f) continue; // degenerate triangles don't constrain the cone
+		normals[numNormals] = normal / len;
+		axis += normals[numNormals];
+		numNormals++;
+	}
+	meshlet.coneAxis = vec3(0, 0, 1);
+	meshlet.coneCutoff = 1.0f;
+	r32 axisLen = length(axis);
+	if(numNormals == 0 || axisLen <= 0.0f)
+		return;
+	axis /= axisLen;
+
+	r32 minDot = 1.0f;
+	for(u32 i = 0; i < numNormals; i++) {
+		minDot = min(minDot, dot(axis, normals[i]));
+	}
+	meshlet.coneAxis = axis;
+	if(minDot <= 0.0f)
+		return; // normals span more than a hemisphere, some triangle is always front facing
+	meshlet.coneCutoff = sqrt(1.0f - minDot * minDot);
+}
+
+/**
+ * splits the model's triangles into meshlets and reorders the model's range of the IBO so each meshlet is contiguous
+ * must be called before FillGLBuffers
+ */
+void BuildMeshlets(Model& model, IBO& ibo, Vertex* vertices, MeshletBuffers& meshletBuffers) {
+	model.meshletsOffset = meshletBuffers.meshletsOffset;
+	model.numMeshlets = 0;
+
+	u32 numTriangles = model.numIndices / 3;
+	IndexType* indices = &ibo.indices[model.indicesOffset];
+
+	// vertex to triangle adjacency (compressed rows) so we can grow meshlets across shared vertices
+	vector<u32> adjacencyOffsets(model.numVertices + 1, 0);
+	for(u32 i = 0; i < numTriangles * 3; i++) {
+		adjacencyOffsets[indices[i] - model.verticesOffset + 1]++;
+	}
+	for(u32 i = 0; i < model.numVertices; i++) {
+		adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+	}
+	vector<u32> adjacency(numTriangles * 3);
+	vector<u32> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for(u32 i = 0; i < numTriangles * 3; i++) {
+		adjacency[fill[indices[i] - model.verticesOffset]++] = i / 3;
+	}
+
+	vector<bool> emitted(numTriangles, false);
+	vector<bool> inMeshlet(model.numVertices, false);
+	vector<IndexType> reordered;
+	reordered.reserve(numTriangles * 3);
+
+	u32 meshletVertices[MESHLET_MAX_VERTICES];
+	u32 numMeshletVertices = 0;
+	u32 numMeshletTriangles = 0;
+	u32 meshletStart = 0;
+	u32 nextSeed = 0;
+	u32 numEmitted = 0;
+
+	while(numEmitted < numTriangles) {
+		// prefer the triangle adding the fewest new vertices to the current meshlet
+		s32 best = -1;
+		u32 bestNewVertices = 4;
+		for(u32 v = 0; v < numMeshletVertices && bestNewVertices > 0; v++) {
+			u32 vertex = meshletVertices[v];
+			for(u32 a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; a++) {
+				u32 tri = adjacency[a];
+				if(emitted[tri]) continue;
+				u32 newVertices = 0;
+				for(u32 k = 0; k < 3; k++) {
+					newVertices += inMeshlet[indices[tri * 3 + k] - model.verticesOffset] ? 0 : 1;
+				}
+				if(newVertices < bestNewVertices) {
+					best = tri;
+					bestNewVertices = newVertices;
+				}
+			}
+		}
+		// nothing connected, so start from the next triangle in the original order
+		if(best == -1) {
+			while(emitted[nextSeed]) nextSeed++;
+			best = nextSeed;
+			bestNewVertices = 0;
+			for(u32 k = 0; k < 3; k++) {
+				bestNewVertices += inMeshlet[indices[best * 3 + k] - model.verticesOffset] ? 0 : 1;
+			}
+		}
+
+		// close the current meshlet if the triangle doesn't fit
+		if(numMeshletVertices + bestNewVertices > MESHLET_MAX_VERTICES || numMeshletTriangles + 1 > MESHLET_MAX_TRIANGLES) {
+			if(meshletBuffers.meshletsOffset >= MAX_MESHLETS) {
+				printf("max meshlets exceeded when building meshlets\n");
+				exit(1);
+			}
+			Meshlet& meshlet = meshletBuffers.meshlets[meshletBuffers.meshletsOffset++];
+			meshlet.indicesOffset = model.indicesOffset + meshletStart;
+			meshlet.numIndices = reordered.size() - meshletStart;
+			model.numMeshlets++;
+
+			for(u32 v = 0; v < numMeshletVertices; v++) {
+				inMeshlet[meshletVertices[v]] = false;
+			}
+			numMeshletVertices = 0;
+			numMeshletTriangles = 0;
+			meshletStart = reordered.size();
+			continue; // pick again now that the meshlet is empty
+		}
+
+		for(u32 k = 0; k < 3; k++) {
+			IndexType index = indices[best * 3 + k];
+			u32 vertex = index - model.verticesOffset;
+			if(!inMeshlet[vertex]) {
+				inMeshlet[vertex] = true;
+				meshletVertices[numMeshletVertices++] = vertex;
+			}
+			reordered.push_back(index);
+		}
+		emitted[best] = true;
+		numEmitted++;
+		numMeshletTriangles++;
+	}
+	if(numMeshletTriangles > 0) {
+		if(meshletBuffers.meshletsOffset >= MAX_MESHLETS) {
+			printf("max meshlets exceeded when building meshlets\n");
+			exit(1);
+		}
+		Meshlet& meshlet = meshletBuffers.meshlets[meshletBuffers.meshletsOffset++];
+		meshlet.indicesOffset = model.indicesOffset + meshletStart;
+		meshlet.numIndices = reordered.size() - meshletStart;
+		model.numMeshlets++;
+	}
+
+	for(u32 i = 0; i < reordered.size(); i++) {
+		indices[i] = reordered[i];
+	}
+	for(u32 i = 0; i < model.numMeshlets; i++) {
+		CalcMeshletBounds(meshletBuffers.meshlets[model.meshletsOffset + i], ibo.indices, vertices);
+	}
+}
+
+/**
+ * frustum and backface cone culls the model's meshlets and fills drawRanges with the surviving index ranges
+ * neighbouring visible meshlets get merged into one range
+ * coneCulling should be false when the pass doesn't cull backfaces (or culls front faces like the shadow pass)
+ * returns the number of visible meshlets
+ */
+u32 CullMeshlets(MeshletBuffers& meshletBuffers, Model& model, const mat4& modelMatrix, const mat4& normalMatrix,
+const Frustum& frustum, vec3 cameraPos, bool coneCulling, DrawRanges& drawRanges) {
+	drawRanges.nRanges = 0;
+	u32 numVisible = 0;
+	u32 lastRangeEnd = 0;
+
+	r32 maxScale = max(length(vec3(modelMatrix[0])), max(length(vec3(modelMatrix[1])), length(vec3(modelMatrix[2]))));
+	for(u32 i = 0; i < model.numMeshlets; i++) {
+		Meshlet& meshlet = meshletBuffers.meshlets[model.meshletsOffset + i];
+		vec3 center = vec3(modelMatrix * vec4(meshlet.center, 1.0f));
+		r32 radius = meshlet.radius * maxScale;
+		if(!SphereInFrustum(frustum, center, radius))
+			continue;
+		if(coneCulling && meshlet.coneCutoff < 1.0f) {
+			vec3 axis = normalize(vec3(normalMatrix * vec4(meshlet.coneAxis, 0.0f)));
+			vec3 toCenter = center - cameraPos;
+			if(dot(toCenter, axis) >= meshlet.coneCutoff * length(toCenter) + radius)
+				continue;
+		}
+		numVisible++;
+
+		if(drawRanges.nRanges > 0 && (lastRangeEnd == meshlet.indicesOffset || drawRanges.nRanges == MAX_DRAW_RANGES)) {
+			// contiguous with the last range (or out of ranges, so conservatively draw everything in between)
+			drawRanges.counts[drawRanges.nRanges - 1] += meshlet.indicesOffset + meshlet.numIndices - lastRangeEnd;
+		}
+		else {
+			drawRanges.counts[drawRanges.nRanges] = meshlet.numIndices;
+			drawRanges.offsets[drawRanges.nRanges] = (const GLvoid*)(meshlet.indicesOffset * sizeof(IndexType));
+			drawRanges.nRanges++;
+		}
+		lastRangeEnd = meshlet.indicesOffset + meshlet.numIndices;
+	}
+	return numVisible;
+}
+
+// simple unit test (no gl context needed)
+
+// int main() {
+// 	static IBO ibo; static VBO vbo; static MeshletBuffers meshletBuffers; static DrawRanges drawRanges;
+// 	// 100x100 grid of quads facing +z
+// 	Model model = {};
+// 	for(u32 y = 0; y <= 100; y++)
+// 		for(u32 x = 0; x <= 100; x++)
+// 			vbo.vertices[model.numVertices++].pos = vec3(x, y, 0);
+// 	for(u32 y = 0; y < 100; y++) {
+// 		for(u32 x = 0; x < 100; x++) {
+// 			u32 i = y * 101 + x;
+// 			IndexType quad[6] = { i, i + 1, i + 102, i, i + 102, i + 101 };
+// 			for(u32 k = 0; k < 6; k++) ibo.indices[model.numIndices++] = quad[k];
+// 		}
+// 	}
+// 	InitMeshletBuffers(meshletBuffers);
+// 	BuildMeshlets(model, ibo, vbo.vertices, meshletBuffers);
+// 	printf("meshlets: %d\n", model.numMeshlets);
+// 	Frustum frustum;
+// 	mat4 vp = perspective(radians(45.0f), 1.0f, 0.1f, 1000.0f) * lookAt(vec3(50, 50, 100), vec3(50, 50, 0), vec3(0, 1, 0));
+// 	ExtractFrustumPlanes(frustum, vp);
+// 	printf("visible from front: %d\n", CullMeshlets(meshletBuffers, model, mat4(1), mat4(1), frustum, vec3(50, 50, 100), true, drawRanges));
+// 	vp = perspective(radians(45.0f), 1.0f, 0.1f, 1000.0f) * lookAt(vec3(50, 50, -100), vec3(50, 50, 0), vec3(0, 1, 0));
+// 	ExtractFrustumPlanes(frustum, vp);
+// 	printf("visible from behind: %d (should be 0)\n", CullMeshlets(meshletBuffers, model, mat4(1), mat4(1), frustum, vec3(50, 50, -100), true, drawRanges));
+// 	return 0;
+// }
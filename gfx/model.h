@@ -1,8 +1,13 @@
 #pragma once
 #include "gl_buffers.h"
+#include "../core/jobs.h"
 #include <GL/glew.h>
 
+// how much to grow the bind pose bounds of rigged models by on each side, as a fraction of their size
+#define RIGGED_BOUNDS_PADDING 0.25f
+
 struct Model {
+	u32 id; // index into assets.models, used to batch draws of the same model
     u32 verticesOffset;
     u32 numVertices;
 
@@ -15,6 +20,13 @@ struct Model {
 
 	u32 animationsOffset;
 	u32 numAnimations;
+
+	// only large static models get meshlets (see meshlet.h), numMeshlets is 0 otherwise
+	u32 meshletsOffset;
+	u32 numMeshlets;
+
+	// model space bounds, in the bind pose for rigged models (padded since animations can move vertices past it)
+	vec3 minExtents, maxExtents;
 };
 
 struct IndexedModel {
@@ -69,49 +81,112 @@ struct OBJModel {
 	vector<Face> faces;
 };
 
+// below this many triangles / vertices per thread it's not worth splitting tangent generation across threads
+#define TANGENT_MIN_TRIANGLES_PER_THREAD 4096
+#define TANGENT_MIN_VERTICES_PER_THREAD 8192
+
+/**
+ * fills the tangents (xyz) and bitangent handedness (w) of the model's vertices
+ * triangles are split across threads, each thread accumulating into its own arrays, which are then summed
+ * the accumulators are stored as separate x/y/z arrays so the reduction and orthonormalization loops vectorize
+ */
 void CalculateTangents(Model& model, const IndexedModel& indexedModel, Vertex* vertices) {
 	if(indexedModel.uvCoords.size() == 0)
 		return;
-	for(u32 i = 0; i < indexedModel.indices.size(); i += 3) {
-		vec3 p0 = indexedModel.positions[indexedModel.indices[i + 0]];
-		vec3 p1 = indexedModel.positions[indexedModel.indices[i + 1]];
-		vec3 p2 = indexedModel.positions[indexedModel.indices[i + 2]];
-
-		vec3 Edge1 = p1 - p0;
-		vec3 Edge2 = p2 - p0;
-
-		vec2 t0 = indexedModel.uvCoords[indexedModel.indices[i + 0]];
-		vec2 t1 = indexedModel.uvCoords[indexedModel.indices[i + 1]];
-		vec2 t2 = indexedModel.uvCoords[indexedModel.indices[i + 2]];
-
-		float DeltaU1 = t1.x - t0.x;
-		float DeltaV1 = t1.y - t0.y;
-		float DeltaU2 = t2.x - t0.x;
-		float DeltaV2 = t2.y - t0.y;
-
-		float f = 1.0f / (DeltaU1 * DeltaV2 - DeltaU2 * DeltaV1);
-
-		vec3 tangent;
-		tangent.x = f * (DeltaV2 * Edge1.x - DeltaV1 * Edge2.x);
-		tangent.y = f * (DeltaV2 * Edge1.y - DeltaV1 * Edge2.y);
-		tangent.z = f * (DeltaV2 * Edge1.z - DeltaV1 * Edge2.z);
-
-		// vec3 bitangent;
-		// bitangent.x = f * (-DeltaU2 * Edge1.x - DeltaU1 * Edge2.x);
-		// bitangent.y = f * (-DeltaU2 * Edge1.y - DeltaU1 * Edge2.y);
-		// bitangent.z = f * (-DeltaU2 * Edge1.z - DeltaU1 * Edge2.z);
-
-		for(u32 j = 0; j < 3; j++) {
-			u32 index = indexedModel.indices[i + j];
-			vertices[model.verticesOffset + index].tangent.x += tangent.x;
-			vertices[model.verticesOffset + index].tangent.y += tangent.y;
-			vertices[model.verticesOffset + index].tangent.z += tangent.z;
-
-			// vertices[model.verticesOffset + index].bitangent.x += bitangent.x;
-			// vertices[model.verticesOffset + index].bitangent.y += bitangent.y;
-			// vertices[model.verticesOffset + index].bitangent.z += bitangent.z;
+	u32 numVertices = indexedModel.positions.size();
+	u32 numTriangles = indexedModel.indices.size() / 3;
+	u32 numThreads = GetNumParallelForThreads(numTriangles, TANGENT_MIN_TRIANGLES_PER_THREAD);
+
+	// per thread: tangent x, y, z then bitangent x, y, z, each numVertices long
+	u32 threadStride = 6 * numVertices;
+	vector<r32> accumulators(numThreads * threadStride, 0.0f);
+
+	ParallelFor(numTriangles, TANGENT_MIN_TRIANGLES_PER_THREAD, [&](u32 start, u32 end, u32 thread) {
+		r32* tx = &accumulators[thread * threadStride];
+		r32* ty = tx + numVertices;
+		r32* tz = ty + numVertices;
+		r32* bx = tz + numVertices;
+		r32* by = bx + numVertices;
+		r32* bz = by + numVertices;
+		for(u32 tri = start; tri < end; tri++) {
+			u32 i = tri * 3;
+			vec3 p0 = indexedModel.positions[indexedModel.indices[i + 0]];
+			vec3 p1 = indexedModel.positions[indexedModel.indices[i + 1]];
+			vec3 p2 = indexedModel.positions[indexedModel.indices[i + 2]];
+
+			vec3 Edge1 = p1 - p0;
+			vec3 Edge2 = p2 - p0;
+
+			vec2 t0 = indexedModel.uvCoords[indexedModel.indices[i + 0]];
+			vec2 t1 = indexedModel.uvCoords[indexedModel.indices[i + 1]];
+			vec2 t2 = indexedModel.uvCoords[indexedModel.indices[i + 2]];
+
+			float DeltaU1 = t1.x - t0.x;
+			float DeltaV1 = t1.y - t0.y;
+			float DeltaU2 = t2.x - t0.x;
+			float DeltaV2 = t2.y - t0.y;
+
+			// degenerate uvs (all three on a line or point) don't define a tangent, so they don't contribute
+			float det = DeltaU1 * DeltaV2 - DeltaU2 * DeltaV1;
+			if(fabs(det) < 1e-12f)
+				continue;
+			float f = 1.0f / det;
+
+			vec3 tangent = f * (DeltaV2 * Edge1 - DeltaV1 * Edge2);
+			vec3 bitangent = f * (DeltaU1 * Edge2 - DeltaU2 * Edge1);
+
+			for(u32 j = 0; j < 3; j++) {
+				u32 index = indexedModel.indices[i + j];
+				tx[index] += tangent.x;
+				ty[index] += tangent.y;
+				tz[index] += tangent.z;
+				bx[index] += bitangent.x;
+				by[index] += bitangent.y;
+				bz[index] += bitangent.z;
+			}
 		}
+	});
+
+	// sum every thread's accumulators into thread 0's
+	if(numThreads > 1) {
+		ParallelFor(threadStride, 6 * TANGENT_MIN_VERTICES_PER_THREAD, [&](u32 start, u32 end, u32 thread) {
+			r32* sum = &accumulators[0];
+			for(u32 t = 1; t < numThreads; t++) {
+				const r32* partial = &accumulators[t * threadStride];
+				for(u32 i = start; i < end; i++) {
+					sum[i] += partial[i];
+				}
+			}
+		});
 	}
+
+	// gram-schmidt against the normal and work out which way the bitangent points
+	ParallelFor(numVertices, TANGENT_MIN_VERTICES_PER_THREAD, [&](u32 start, u32 end, u32 thread) {
+		const r32* tx = &accumulators[0];
+		const r32* ty = tx + numVertices;
+		const r32* tz = ty + numVertices;
+		const r32* bx = tz + numVertices;
+		const r32* by = bx + numVertices;
+		const r32* bz = by + numVertices;
+		for(u32 i = start; i < end; i++) {
+			vec3 normal = vertices[model.verticesOffset + i].normal;
+			vec3 tangent = vec3(tx[i], ty[i], tz[i]);
+			vec3 bitangent = vec3(bx[i], by[i], bz[i]);
+
+			tangent = tangent - normal * dot(normal, tangent);
+			r32 len = length(tangent);
+			if(len < 1e-6f) {
+				// no usable uv direction, so any vector perpendicular to the normal will do
+				vec3 axis = fabs(normal.x) < 0.9f ? vec3(1, 0, 0) : vec3(0, 1, 0);
+				tangent = normalize(cross(axis, normal));
+			}
+			else {
+				tangent /= len;
+			}
+			r32 handedness = dot(cross(normal, tangent), bitangent) < 0.0f ? -1.0f : 1.0f;
+			vertices[model.verticesOffset + i].tangent = vec4(tangent, handedness);
+		}
+	});
 }
 
 void LoadModelToBuffers(Model& model, RiggedModel* riggedModel, VBO& vbo, IBO& ibo, JointBuffers& jointBuffers) {
@@ -122,6 +197,8 @@ void LoadModelToBuffers(Model& model, RiggedModel* riggedModel, VBO& vbo, IBO& i
 
     model.numVertices = indexedModel.positions.size();
     model.numIndices = indexedModel.indices.size();
+	model.meshletsOffset = 0;
+	model.numMeshlets = 0;
 	if(model.verticesOffset + model.numVertices > MAX_VERTICES) {
 		printf("max vertices exceeded when loading model to buffers\n");
 		exit(1);
@@ -149,6 +226,17 @@ void LoadModelToBuffers(Model& model, RiggedModel* riggedModel, VBO& vbo, IBO& i
 
 	CalculateTangents(model, indexedModel, vbo.vertices);
 
+	model.minExtents = vec3(0.0f);
+	model.maxExtents = vec3(0.0f);
+	if(indexedModel.positions.size() > 0) {
+		model.minExtents = indexedModel.positions[0];
+		model.maxExtents = indexedModel.positions[0];
+	}
+	for(u32 i = 1; i < indexedModel.positions.size(); i++) {
+		model.minExtents = min(model.minExtents, indexedModel.positions[i]);
+		model.maxExtents = max(model.maxExtents, indexedModel.positions[i]);
+	}
+
 	for(u32 i = 0; i < indexedModel.indices.size(); i++) {
 		ibo.indices[model.indicesOffset + i] = model.verticesOffset + indexedModel.indices[i];
 	}
@@ -175,6 +263,12 @@ void LoadModelToBuffers(Model& model, RiggedModel* riggedModel, VBO& vbo, IBO& i
 	}
 	jointBuffers.jointsOffset += model.numJoints;
 
+	if(model.numJoints > 0) {
+		vec3 padding = (model.maxExtents - model.minExtents) * RIGGED_BOUNDS_PADDING;
+		model.minExtents -= padding;
+		model.maxExtents += padding;
+	}
+
 	// load animation keyframes
 	model.animationsOffset = jointBuffers.animationsOffset;
 	model.numAnimations = riggedModel->animationKeyFrameTimestamps.size();
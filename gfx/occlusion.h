@@ -0,0 +1,350 @@
+#pragma once
+#include <stdio.h>
+#include "../core/types.h"
+#include "../core/jobs.h"
+#include "gl_buffers.h"
+#include "render_obj.h"
+#include "frustum.h" // for FRUSTUM_SSE
+#include "bvh.h"
+
+// software occlusion culling
+// occluder render objs (keep their models low poly) get rasterized on the cpu into a small depth buffer,
+// which is reduced into a hierarchical z pyramid holding the farthest depth of each texel's area.
+// an object is occluded when the nearest point of its bounding box is behind the farthest depth everywhere it covers.
+// no gpu involved, so the buffer can be checked headlessly with WriteOcclusionPGM
+
+#define OCCLUSION_WIDTH 256 // has to be a multiple of 4 for the simd rasterizer
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_LEVELS 9 // 256x128 down to 1x1
+#define MAX_OCCLUDER_TRIANGLES 16384
+#define OCCLUSION_MIN_ROWS_PER_THREAD 16
+#define OCCLUSION_MIN_OBJS_PER_THREAD 256
+// a box is tested against the finest level where its screen rect covers at most this many texels across,
+// coarser levels read less but their farther depths hide less
+#define OCCLUSION_MAX_TEST_TEXELS 4
+
+// screen space, x and y in pixels and z is depth in [0, 1]
+struct OccluderTriangle {
+	vec3 v[3];
+};
+
+struct OcclusionBuffer {
+	u32 nTriangles;
+	OccluderTriangle triangles[MAX_OCCLUDER_TRIANGLES];
+
+	// level i is (OCCLUSION_WIDTH >> i) x (OCCLUSION_HEIGHT >> i), at least 1x1
+	u32 levelWidths[OCCLUSION_LEVELS];
+	u32 levelHeights[OCCLUSION_LEVELS];
+	u32 levelOffsets[OCCLUSION_LEVELS];
+	r32 depth[OCCLUSION_WIDTH * OCCLUSION_HEIGHT * 2]; // all levels, a pyramid takes less than twice its base, not aligned since game memory isn't
+
+	bool occluded[MAX_BVH_OBJECTS]; // CullOccludedObjs' results, by position in the objIndices it was given
+};
+
+void InitOcclusionBuffer(OcclusionBuffer& buffer) {
+	buffer.nTriangles = 0;
+	u32 offset = 0;
+	for(u32 i = 0; i < OCCLUSION_LEVELS; i++) {
+		u32 w = OCCLUSION_WIDTH >> i;
+		u32 h = OCCLUSION_HEIGHT >> i;
+		buffer.levelWidths[i] = w > 0 ? w : 1;
+		buffer.levelHeights[i] = h > 0 ? h : 1;
+		buffer.levelOffsets[i] = offset;
+		offset += buffer.levelWidths[i] * buffer.levelHeights[i];
+	}
+}
+
+// signed distance to the near plane in clip space (z = -w), negative behind it
+r32 NearPlaneDist(vec4 clip) {
+	return clip.z + clip.w;
+}
+
+vec3 ClipToOcclusionScreen(vec4 clip) {
+	vec3 ndc = vec3(clip) / clip.w;
+	return vec3((ndc.x * 0.5f + 0.5f) * OCCLUSION_WIDTH, (ndc.y * 0.5f + 0.5f) * OCCLUSION_HEIGHT, ndc.z * 0.5f + 0.5f);
+}
+
+void AddOccluderTriangle(OcclusionBuffer& buffer, vec4 a, vec4 b, vec4 c) {
+	if(buffer.nTriangles >= MAX_OCCLUDER_TRIANGLES) {
+		return; // dropping occluders only makes culling less effective, never wrong
+	}
+	OccluderTriangle& tri = buffer.triangles[buffer.nTriangles++];
+	tri.v[0] = ClipToOcclusionScreen(a);
+	tri.v[1] = ClipToOcclusionScreen(b);
+	tri.v[2] = ClipToOcclusionScreen(c);
+}
+
+// clips a clip space triangle against the near plane, leaving 0, 1 or 2 triangles
+// (with nothing in front of the near plane depths stay in [0, 1], except past the far plane where they're harmlessly over 1)
+void ClipOccluderTriangle(OcclusionBuffer& buffer, vec4* v) {
+	vec4 out[4];
+	u32 nOut = 0;
+	for(u32 i = 0; i < 3; i++) {
+		vec4 cur = v[i];
+		vec4 next = v[(i + 1) % 3];
+		r32 curDist = NearPlaneDist(cur);
+		r32 nextDist = NearPlaneDist(next);
+		bool curIn = curDist >= 0.0f;
+		bool nextIn = nextDist >= 0.0f;
+		if(curIn) out[nOut++] = cur;
+		if(curIn != nextIn) {
+			r32 t = curDist / (curDist - nextDist);
+			out[nOut++] = cur + (next - cur) * t;
+		}
+	}
+	for(u32 i = 2; i < nOut; i++) {
+		AddOccluderTriangle(buffer, out[0], out[i - 1], out[i]);
+	}
+}
+
+/** transforms the triangles of every occluder in objIndices to screen space */
+void SetupOccluders(OcclusionBuffer& buffer, mat4& vpMatrix, RenderObj* renderObjs, u32* objIndices, u32 nObjs, VBO& vbo, IBO& ibo) {
+	buffer.nTriangles = 0;
+	for(u32 o = 0; o < nObjs; o++) {
+		RenderObj& obj = renderObjs[objIndices[o]];
+		if(!obj.isOccluder) continue;
+		Model& model = *obj.model;
+		mat4 mvpMatrix = vpMatrix * obj.transform.matrix;
+		for(u32 i = 0; i + 2 < model.numIndices; i += 3) {
+			vec4 v[3];
+			for(u32 k = 0; k < 3; k++) {
+				v[k] = mvpMatrix * vec4(vbo.vertices[ibo.indices[model.indicesOffset + i + k]].pos, 1.0f);
+			}
+			if(NearPlaneDist(v[0]) >= 0.0f && NearPlaneDist(v[1]) >= 0.0f && NearPlaneDist(v[2]) >= 0.0f) {
+				AddOccluderTriangle(buffer, v[0], v[1], v[2]);
+			}
+			else {
+				ClipOccluderTriangle(buffer, v);
+			}
+		}
+	}
+}
+
+/**
+ * rasterizes every triangle into rows [rowStart, rowEnd) of the base level, keeping the nearest depth
+ * pixels count as covered only when their center is inside, so occluders never grow past their real silhouette
+ * centers exactly on an edge go to the triangle it's a top or left edge of, so there are no cracks between triangles
+ */
+void RasterizeOccluderRows(OcclusionBuffer& buffer, u32 rowStart, u32 rowEnd) {
+	r32* depth = buffer.depth;
+	for(u32 t = 0; t < buffer.nTriangles; t++) {
+		vec3 v0 = buffer.triangles[t].v[0];
+		vec3 v1 = buffer.triangles[t].v[1];
+		vec3 v2 = buffer.triangles[t].v[2];
+		r32 area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+		if(area == 0.0f) continue;
+		// occluders are double sided, flip back facing triangles so the edge functions are positive inside
+		if(area < 0.0f) {
+			vec3 temp = v1; v1 = v2; v2 = temp;
+			area = -area;
+		}
+
+		r32 minX = v0.x < v1.x ? (v0.x < v2.x ? v0.x : v2.x) : (v1.x < v2.x ? v1.x : v2.x);
+		r32 maxX = v0.x > v1.x ? (v0.x > v2.x ? v0.x : v2.x) : (v1.x > v2.x ? v1.x : v2.x);
+		r32 minY = v0.y < v1.y ? (v0.y < v2.y ? v0.y : v2.y) : (v1.y < v2.y ? v1.y : v2.y);
+		r32 maxY = v0.y > v1.y ? (v0.y > v2.y ? v0.y : v2.y) : (v1.y > v2.y ? v1.y : v2.y);
+		s32 x0 = (s32)floorf(minX); if(x0 < 0) x0 = 0;
+		s32 x1 = (s32)ceilf(maxX); if(x1 > OCCLUSION_WIDTH) x1 = OCCLUSION_WIDTH;
+		s32 y0 = (s32)floorf(minY); if(y0 < (s32)rowStart) y0 = rowStart;
+		s32 y1 = (s32)ceilf(maxY); if(y1 > (s32)rowEnd) y1 = rowEnd;
+		if(x0 >= x1 || y0 >= y1) continue;
+		x0 &= ~3; // start on a 4 pixel boundary so a simd group never reads past the end of a row (the width is a multiple of 4)
+
+		// edge function e_i(p) = a_i * p.x + b_i * p.y + c_i, positive on the inside of the edge opposite vertex i
+		r32 a0 = v1.y - v2.y, b0 = v2.x - v1.x, c0 = v1.x * v2.y - v1.y * v2.x;
+		r32 a1 = v2.y - v0.y, b1 = v0.x - v2.x, c1 = v2.x * v0.y - v2.y * v0.x;
+		r32 a2 = v0.y - v1.y, b2 = v1.x - v0.x, c2 = v0.x * v1.y - v0.y * v1.x;
+		bool topLeft0 = a0 > 0.0f || (a0 == 0.0f && b0 < 0.0f);
+		bool topLeft1 = a1 > 0.0f || (a1 == 0.0f && b1 < 0.0f);
+		bool topLeft2 = a2 > 0.0f || (a2 == 0.0f && b2 < 0.0f);
+		// depth is affine in screen space: z = v0.z + e1 * dz1 + e2 * dz2
+		r32 invArea = 1.0f / area;
+		r32 dz1 = (v1.z - v0.z) * invArea;
+		r32 dz2 = (v2.z - v0.z) * invArea;
+
+		for(s32 y = y0; y < y1; y++) {
+			r32 py = y + 0.5f;
+			r32* row = depth + y * OCCLUSION_WIDTH;
+#ifdef FRUSTUM_SSE
+			__m128 zero = _mm_setzero_ps();
+			__m128 ones = _mm_cmpeq_ps(zero, zero); // all bits set
+			__m128 topLeftMask0 = topLeft0 ? ones : zero;
+			__m128 topLeftMask1 = topLeft1 ? ones : zero;
+			__m128 topLeftMask2 = topLeft2 ? ones : zero;
+			__m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+			for(s32 x = x0; x < x1; x += 4) {
+				__m128 px = _mm_add_ps(_mm_set1_ps((r32)x), offsets);
+				__m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), px), _mm_set1_ps(b0 * py + c0));
+				__m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), px), _mm_set1_ps(b1 * py + c1));
+				__m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), px), _mm_set1_ps(b2 * py + c2));
+				__m128 in0 = _mm_or_ps(_mm_cmpgt_ps(e0, zero), _mm_and_ps(_mm_cmpeq_ps(e0, zero), topLeftMask0));
+				__m128 in1 = _mm_or_ps(_mm_cmpgt_ps(e1, zero), _mm_and_ps(_mm_cmpeq_ps(e1, zero), topLeftMask1));
+				__m128 in2 = _mm_or_ps(_mm_cmpgt_ps(e2, zero), _mm_and_ps(_mm_cmpeq_ps(e2, zero), topLeftMask2));
+				__m128 inside = _mm_and_ps(_mm_and_ps(in0, in1), in2);
+				if(_mm_movemask_ps(inside) == 0) continue;
+				__m128 z = _mm_add_ps(_mm_set1_ps(v0.z), _mm_add_ps(_mm_mul_ps(e1, _mm_set1_ps(dz1)), _mm_mul_ps(e2, _mm_set1_ps(dz2))));
+				__m128 old = _mm_loadu_ps(row + x);
+				__m128 nearest = _mm_min_ps(old, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+			}
+#else
+			for(s32 x = x0; x < x1; x++) {
+				r32 px = x + 0.5f;
+				r32 e0 = a0 * px + b0 * py + c0;
+				r32 e1 = a1 * px + b1 * py + c1;
+				r32 e2 = a2 * px + b2 * py + c2;
+				if(e0 < 0.0f || (e0 == 0.0f && !topLeft0)) continue;
+				if(e1 < 0.0f || (e1 == 0.0f && !topLeft1)) continue;
+				if(e2 < 0.0f || (e2 == 0.0f && !topLeft2)) continue;
+				r32 z = v0.z + e1 * dz1 + e2 * dz2;
+				if(z < row[x]) row[x] = z;
+			}
+#endif
+		}
+	}
+}
+
+// each level keeps the farthest depth of the 2x2 texels under it (clamped at odd edges), so tests against it stay conservative
+void BuildHiZLevel(OcclusionBuffer& buffer, u32 level, u32 rowStart, u32 rowEnd) {
+	r32* src = buffer.depth + buffer.levelOffsets[level - 1];
+	r32* dst = buffer.depth + buffer.levelOffsets[level];
+	u32 srcW = buffer.levelWidths[level - 1];
+	u32 srcH = buffer.levelHeights[level - 1];
+	u32 dstW = buffer.levelWidths[level];
+	for(u32 y = rowStart; y < rowEnd; y++) {
+		u32 sy0 = y * 2;
+		u32 sy1 = sy0 + 1 < srcH ? sy0 + 1 : sy0;
+		for(u32 x = 0; x < dstW; x++) {
+			u32 sx0 = x * 2;
+			u32 sx1 = sx0 + 1 < srcW ? sx0 + 1 : sx0;
+			r32 a = src[sy0 * srcW + sx0], b = src[sy0 * srcW + sx1];
+			r32 c = src[sy1 * srcW + sx0], d = src[sy1 * srcW + sx1];
+			r32 ab = a > b ? a : b;
+			r32 cd = c > d ? c : d;
+			dst[y * dstW + x] = ab > cd ? ab : cd;
+		}
+	}
+}
+
+/** clears the base level, rasterizes the set up occluders and builds the pyramid, all split across threads by rows */
+void RasterizeOcclusionBuffer(OcclusionBuffer& buffer) {
+	PROFILE_FUNCTION();
+	ParallelFor(OCCLUSION_HEIGHT, OCCLUSION_MIN_ROWS_PER_THREAD, [&](u32 start, u32 end, u32 threadIndex) {
+		for(u32 i = start * OCCLUSION_WIDTH; i < end * OCCLUSION_WIDTH; i++) {
+			buffer.depth[i] = 1.0f;
+		}
+		RasterizeOccluderRows(buffer, start, end);
+	});
+	for(u32 level = 1; level < OCCLUSION_LEVELS; level++) {
+		ParallelFor(buffer.levelHeights[level], OCCLUSION_MIN_ROWS_PER_THREAD, [&](u32 start, u32 end, u32 threadIndex) {
+			BuildHiZLevel(buffer, level, start, end);
+		});
+	}
+}
+
+/** true if the aabb is certainly hidden behind the occluders (anything crossing the near plane is assumed visible) */
+bool IsAABBOccluded(OcclusionBuffer& buffer, mat4& vpMatrix, vec3 minExtents, vec3 maxExtents) {
+	r32 minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	r32 nearestZ = FLT_MAX;
+	for(u32 i = 0; i < 8; i++) {
+		vec3 corner = vec3(i & 1 ? maxExtents.x : minExtents.x, i & 2 ? maxExtents.y : minExtents.y, i & 4 ? maxExtents.z : minExtents.z);
+		vec4 clip = vpMatrix * vec4(corner, 1.0f);
+		if(NearPlaneDist(clip) < 0.0f) {
+			return false;
+		}
+		vec3 screen = ClipToOcclusionScreen(clip);
+		minX = screen.x < minX ? screen.x : minX;
+		maxX = screen.x > maxX ? screen.x : maxX;
+		minY = screen.y < minY ? screen.y : minY;
+		maxY = screen.y > maxY ? screen.y : maxY;
+		nearestZ = screen.z < nearestZ ? screen.z : nearestZ;
+	}
+	if(maxX < 0.0f || maxY < 0.0f || minX >= OCCLUSION_WIDTH || minY >= OCCLUSION_HEIGHT) {
+		return false; // off screen, frustum culling's job
+	}
+	s32 x0 = minX < 0.0f ? 0 : (s32)minX;
+	s32 y0 = minY < 0.0f ? 0 : (s32)minY;
+	s32 x1 = maxX >= OCCLUSION_WIDTH ? OCCLUSION_WIDTH - 1 : (s32)maxX;
+	s32 y1 = maxY >= OCCLUSION_HEIGHT ? OCCLUSION_HEIGHT - 1 : (s32)maxY;
+
+	// go up the pyramid until the rect is small enough, then every texel it touches has to be nearer than the box
+	u32 level = 0;
+	while(level + 1 < OCCLUSION_LEVELS && ((x1 >> level) - (x0 >> level) >= OCCLUSION_MAX_TEST_TEXELS || (y1 >> level) - (y0 >> level) >= OCCLUSION_MAX_TEST_TEXELS)) {
+		level++;
+	}
+	r32* depth = buffer.depth + buffer.levelOffsets[level];
+	u32 w = buffer.levelWidths[level];
+	for(s32 y = y0 >> level; y <= (y1 >> level); y++) {
+		for(s32 x = x0 >> level; x <= (x1 >> level); x++) {
+			if(nearestZ <= depth[y * w + x]) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/** removes occluded objects from objIndices (keeping their order), returns the new count */
+u32 CullOccludedObjs(OcclusionBuffer& buffer, mat4& vpMatrix, RenderObj* renderObjs, u32* objIndices, u32 nObjs) {
+	bool* occluded = buffer.occluded;
+	ParallelFor(nObjs, OCCLUSION_MIN_OBJS_PER_THREAD, [&](u32 start, u32 end, u32 threadIndex) {
+		for(u32 i = start; i < end; i++) {
+			RenderObj& obj = renderObjs[objIndices[i]];
+			occluded[i] = !obj.isOccluder && IsAABBOccluded(buffer, vpMatrix, obj.minExtents, obj.maxExtents);
+		}
+	});
+	u32 nVisible = 0;
+	for(u32 i = 0; i < nObjs; i++) {
+		if(!occluded[i]) {
+			objIndices[nVisible++] = objIndices[i];
+		}
+	}
+	return nVisible;
+}
+
+/** writes a level of the depth pyramid as a binary pgm (near is black), flipped so it reads like the screen */
+bool WriteOcclusionPGM(OcclusionBuffer& buffer, const char* path, u32 level = 0) {
+	FILE* file = fopen(path, "wb");
+	if(file == NULL) {
+		printf("failed to open %s for writing\n", path);
+		return false;
+	}
+	u32 w = buffer.levelWidths[level];
+	u32 h = buffer.levelHeights[level];
+	r32* depth = buffer.depth + buffer.levelOffsets[level];
+	fprintf(file, "P5\n%d %d\n255\n", w, h);
+	for(s32 y = h - 1; y >= 0; y--) {
+		for(u32 x = 0; x < w; x++) {
+			r32 d = depth[y * w + x];
+			u8 value = (u8)((d < 0.0f ? 0.0f : (d > 1.0f ? 1.0f : d)) * 255.0f);
+			fputc(value, file);
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+// simple unit test (no gl context needed), compare occlusion.pgm against a known good dump when changing the rasterizer
+
+// int main() {
+// 	static VBO vbo; static IBO ibo; static OcclusionBuffer buffer; static RenderObj floor;
+// 	vec3 corners[4] = { vec3(-500, -1, -500), vec3(500, -1, -500), vec3(500, -1, 500), vec3(-500, -1, 500) };
+// 	u32 indices[6] = { 0, 1, 2, 0, 2, 3 };
+// 	for(u32 i = 0; i < 4; i++) vbo.vertices[i].pos = corners[i];
+// 	for(u32 i = 0; i < 6; i++) ibo.indices[i] = indices[i];
+// 	Model model = {};
+// 	model.numIndices = 6;
+// 	floor.model = &model;
+// 	floor.isOccluder = true;
+// 	floor.transform.matrix = mat4(1.0f);
+// 	mat4 vpMatrix = perspective(radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f) * lookAt(vec3(0, 1, 3), vec3(0, 0.5f, 2), vec3(0, 1, 0));
+// 	u32 objIndex = 0;
+// 	InitOcclusionBuffer(buffer);
+// 	SetupOccluders(buffer, vpMatrix, &floor, &objIndex, 1, vbo, ibo);
+// 	RasterizeOcclusionBuffer(buffer);
+// 	printf("under the floor: %d (should be 1)\n", IsAABBOccluded(buffer, vpMatrix, vec3(-1, -3, -5), vec3(1, -2, -4)));
+// 	printf("above the floor: %d (should be 0)\n", IsAABBOccluded(buffer, vpMatrix, vec3(-1, 0, -5), vec3(1, 1, -4)));
+// 	printf("through the floor: %d (should be 0)\n", IsAABBOccluded(buffer, vpMatrix, vec3(-1, -1.5f, -5), vec3(1, -0.5f, -4)));
+// 	WriteOcclusionPGM(buffer, "occlusion.pgm");
+// 	return 0;
+// }
@@ -4,19 +4,28 @@
 #include "vertex.h"
 #include "gl_buffers.h"
 #include "camera.h"
+#include "render_state.h"
+#include "dynamic_resolution.h"
 
+#define RAYMARCH_TIME_BUDGET 4.0f // ms the fractal gets on the gpu, its resolution drops to stay within it
+
+/**
+ * the fractal is raymarched into its own target at resolution.scale of the window (see dynamic_resolution.h),
+ * then RaymarchComposite upsamples it and merges it with the full resolution scene by depth
+ */
 struct RaymarchRenderer {
 	// GLuint vao;
 
-    GLuint shader;
-    FBO* renderMap;
+    ShaderVariants shaders; // just the one variant, kept as variants so it hot reloads
+    ShaderVariants compositeShaders;
+	DynamicResolution resolution;
 	// Camera orthoCamera;
-    // TODO: can have an option to draw this to an FBO and pass it to the default renderer
 };
 
-void InitRaymarchRenderer(RaymarchRenderer& renderer, VBO& vbo, IBO& ibo, FBO* renderMap) {
-	InitShader(renderer.shader, "shaders/simpleVS.glsl", "shaders/fractalFS3.glsl");
-	renderer.renderMap = renderMap;
+void InitRaymarchRenderer(RaymarchRenderer& renderer, VBO& vbo, IBO& ibo) {
+	InitShaderVariants(renderer.shaders, "shaders/simpleVS.glsl", "shaders/fractalFS3.glsl", NULL, 0);
+	InitShaderVariants(renderer.compositeShaders, "shaders/simpleVS.glsl", "shaders/raymarchCompositeFS.glsl", NULL, 0);
+	InitDynamicResolution(renderer.resolution, RAYMARCH_TIME_BUDGET);
 
 	// glGenVertexArrays(1, &renderer.vao);
 	// glBindVertexArray(renderer.vao);
@@ -25,44 +34,72 @@ void InitRaymarchRenderer(RaymarchRenderer& renderer, VBO& vbo, IBO& ibo, FBO* r
 	// GLint posLoc = glGetAttribLocation(renderer.shader, "a_position");
 	// glVertexAttribPointer(posLoc, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*) offsetof(Vertex, pos));
 	// glEnableVertexAttribArray(posLoc);
-	
+
 	// glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo.id);
 
 	// InitOrthoCamera(renderer.orthoCamera, v3(0,0,1), vec3(0,0,-1), v3(0,1,0), v3(1,0,0), -0.5f, 0.5f, -0.5f, 0.5f, 0.01f, 10.0f);
 }
 
-void DeinitRaymarchRenderer(RaymarchRenderer& renderer) {
-    DeinitShader(renderer.shader);
+void DeinitRaymarchRenderer(RaymarchRenderer& renderer, RenderState& state) {
+	for(u32 i = 0; i < renderer.shaders.nVariants; i++) {
+		ForgetProgramUniforms(state, renderer.shaders.programs[i]);
+	}
+	for(u32 i = 0; i < renderer.compositeShaders.nVariants; i++) {
+		ForgetProgramUniforms(state, renderer.compositeShaders.programs[i]);
+	}
+    DeinitShaderVariants(renderer.shaders);
+    DeinitShaderVariants(renderer.compositeShaders);
 	// glDeleteVertexArrays(1, &renderer.vao);
 }
 
-void RaymarchRender(RaymarchRenderer& renderer, Camera& camera) {
-	glUseProgram(renderer.shader);
+// the program of the only variant, 0 if it doesn't compile
+GLuint GetRaymarchProgram(ShaderVariants& variants) {
+	bool compiled;
+	s32 i = LoadShaderVariant(variants, 0, compiled);
+	return i < 0 ? 0 : variants.programs[i];
+}
+
+/**
+ * draws the fractal over every pixel of the bound target, width x height, with the distance along the ray in alpha
+ * size it with GetDynamicResolutionSize, the uniforms are looked up every draw, so a reloaded program needs nothing else
+ */
+void RaymarchRender(RaymarchRenderer& renderer, RenderState& state, Camera& camera, u32 width, u32 height) {
+	GLuint shader = GetRaymarchProgram(renderer.shaders);
+	if(!shader) return;
+	SetProgram(state, shader);
 	// glBindVertexArray(renderer.vao);
-	
-	glDisable(GL_DEPTH_TEST);
-	
-	glClear(GL_COLOR_BUFFER_BIT);
 
-	// u_cameraPos
-	GLuint u_cameraPos = glGetUniformLocation(renderer.shader, "u_cameraPos");
-	glUniform3fv(u_cameraPos, 1, &camera.pos[0]);
-	// u_cameraDir
-	GLuint u_cameraDir = glGetUniformLocation(renderer.shader, "u_cameraDir");
-	glUniform3fv(u_cameraDir, 1, &camera.dir[0]);
+	// no clear, every pixel gets written
+	glDisable(GL_DEPTH_TEST);
 
-	GLuint u_renderMap = glGetUniformLocation(renderer.shader, "u_renderMap");
-	BindTexture(u_renderMap, renderer.renderMap->texture, 0);
+	SetUniform3fv(state, glGetUniformLocation(shader, "u_cameraPos"), camera.pos);
+	SetUniform3fv(state, glGetUniformLocation(shader, "u_cameraDir"), camera.dir);
+	SetUniform2fv(state, glGetUniformLocation(shader, "u_resolution"), vec2(width, height));
 
-	// GLuint u_mvpMatrix = glGetUniformLocation(renderer.shader, "u_mvpMatrix");
+	// GLuint u_mvpMatrix = glGetUniformLocation(shader, "u_mvpMatrix");
 	// glUniformMatrix4fv(u_mvpMatrix, 1, GL_FALSE, &renderer.orthoCamera.vpMatrix[0][0]);
 
-	// GLuint iResolution = glGetUniformLocation(renderer.shader, "iResolution");
-	// vec2 resolution = vec2(game->window->sfml_window->getSize().x, game->window->sfml_window->getSize().y);
-	// glUniform3fv(iResolution, 1, &resolution[0]);
-	
     // hard coded 6 as the num indices for a square and 0 for the offset (always have square as the first model in the vbo)
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)(0 * sizeof(IndexType)));
+	DrawElements(state, 6, 0);
+
+	glEnable(GL_DEPTH_TEST);
+}
+
+/** upsamples raymarchMap (from RaymarchRender) over every pixel of the bound target, merged with sceneMap (the scene with its depth in alpha, see defaultFS.glsl) */
+void RaymarchComposite(RaymarchRenderer& renderer, RenderState& state, GLuint sceneMap, GLuint raymarchMap) {
+	GLuint shader = GetRaymarchProgram(renderer.compositeShaders);
+	if(!shader) return;
+	SetProgram(state, shader);
+	glDisable(GL_DEPTH_TEST);
+
+	SetSampler(state, glGetUniformLocation(shader, "u_sceneMap"), sceneMap, 0);
+	SetSampler(state, glGetUniformLocation(shader, "u_raymarchMap"), raymarchMap, 1);
+	DrawElements(state, 6, 0);
 
 	glEnable(GL_DEPTH_TEST);
 }
+
+void ReloadRaymarchShaderIfUpdated(RaymarchRenderer& renderer, RenderState& state) {
+	ReloadShaderVariantsIfUpdated(renderer.shaders, state);
+	ReloadShaderVariantsIfUpdated(renderer.compositeShaders, state);
+}
@@ -23,7 +23,14 @@ struct RenderObj {
 	// TODO: dynamic animations / ragdolls
 
 	// for collisin / frustum culling
-	vec3 minExtents, maxExtents;
+	vec3 minExtents, maxExtents; // world space, UpdateMatrices keeps them around the model's bounds
+	bool moved; // set by UpdateMatrices, cleared once the renderer's bvh has seen the new extents
+
+	// for occlusion culling
+	bool isOccluder; // rasterized into the software depth buffer to hide what's behind it, give occluders low poly models
+
+	// for shadows
+	bool isStatic; // rarely moves, so its shadows are cached (set before it's first rendered)
 
 	// for physics
 	r32 invMass;
@@ -63,9 +70,25 @@ void GetExtents(RenderObj& renderObj, Vertex* vertices, JointBuffers& jointBuffe
 	}
 }
 
+// transforms a model space aabb, the result is the aabb of the transformed box (Arvo's method)
+void TransformAABB(const mat4& matrix, vec3 minExtents, vec3 maxExtents, vec3& outMin, vec3& outMax) {
+	outMin = vec3(matrix[3]);
+	outMax = vec3(matrix[3]);
+	for(u32 col = 0; col < 3; col++) {
+		for(u32 row = 0; row < 3; row++) {
+			r32 a = matrix[col][row] * minExtents[col];
+			r32 b = matrix[col][row] * maxExtents[col];
+			outMin[row] += a < b ? a : b;
+			outMax[row] += a < b ? b : a;
+		}
+	}
+}
+
 void UpdateMatrices(RenderObj& renderObj) {
 	CalcTransformMatrix(renderObj.transform);
 	renderObj.normalMatrix = transpose(inverse(renderObj.transform.matrix));
+	TransformAABB(renderObj.transform.matrix, renderObj.model->minExtents, renderObj.model->maxExtents, renderObj.minExtents, renderObj.maxExtents);
+	renderObj.moved = true;
 }
 
 void InitRenderObj(RenderObj& renderObj, Model* model, Material* material, v3 pos = v3(0,0,0), v3 rot = v3(0,0,0), v3 scale = v3(1,1,1), v3 pivot = v3(0,0,0)) {
@@ -86,6 +109,9 @@ void InitRenderObj(RenderObj& renderObj, Model* model, Material* material, v3 po
 	renderObj.animationTime = 0;
 	renderObj.prevKeyFrameIndex = 0;
 	renderObj.nextKeyFrameIndex = 1;
+
+	renderObj.isOccluder = false;
+	renderObj.isStatic = false;
 }
 
 void CalcInitialJointStates(RenderObj& renderObj, JointBuffers& jointBuffers) {
@@ -0,0 +1,246 @@
+#pragma once
+#include "../core/types.h"
+#include "../core/jobs.h"
+#include "render_obj.h"
+#include "material.h"
+#include "camera.h"
+#include "gl_buffers.h"
+#include "default_shader.h"
+
+#define MAX_QUEUED_DRAWS 8192
+// runs of at least this many objects with the same model and material (just model in the shadow pass) get drawn instanced
+#define MIN_INSTANCES_PER_BATCH 2
+#define MIN_BATCHES_PER_THREAD 256
+
+enum RenderPass {
+	RENDER_PASS_SHADOW = 0,
+	RENDER_PASS_OPAQUE = 1,
+};
+
+// sort key layout, most significant bits first so state that's most expensive to change changes least often
+// pass (4) | shader variant (8) | material (12) | model (12) | depth (16) | unused (12)
+#define SORT_KEY_PASS_SHIFT     60
+#define SORT_KEY_VARIANT_SHIFT  52
+#define SORT_KEY_MATERIAL_SHIFT 40
+#define SORT_KEY_MODEL_SHIFT    28
+#define SORT_KEY_DEPTH_SHIFT    12
+
+// a run of queue items drawn together, either one instanced draw or a single object drawn on its own
+struct RenderBatch {
+	u32 queueStart;
+	u32 count;
+	s32 firstInstance; // into the InstanceBuffer, -1 if the batch isn't instanced
+
+	// for batches that aren't instanced, where their ObjectConstants and JointPalette were written in the uniform ring (-1 for none)
+	s32 objectConstantsOffset;
+	s32 jointPaletteOffset;
+};
+
+struct RenderQueue {
+	RenderPass pass; // every item is for the same pass
+	u32 nItems;
+	u64 keys[MAX_QUEUED_DRAWS];
+	u32 objIndices[MAX_QUEUED_DRAWS]; // index into the renderObjs array the queue was built from
+
+	// ping pong buffers for the radix sort
+	u64 scratchKeys[MAX_QUEUED_DRAWS];
+	u32 scratchObjIndices[MAX_QUEUED_DRAWS];
+
+	u32 nBatches;
+	RenderBatch batches[MAX_QUEUED_DRAWS];
+};
+
+// the shader features an object needs itself (VARIANT_OBJECT_FEATURES bits, see default_shader.h)
+u32 GetShaderVariant(RenderPass pass, RenderObj& obj) {
+	u32 variant = 0;
+	if(obj.model->numJoints > 0) variant |= VARIANT_SKELETAL_ANIMATIONS;
+	// the shadow pass only cares about positions
+	if(pass == RENDER_PASS_SHADOW) return variant;
+	if(obj.material->texture != NULL) variant |= VARIANT_TEXTURE_MAPPING;
+	if(obj.material->normalMap != NULL) variant |= VARIANT_NORMAL_MAPPING;
+	if(obj.material->dispMap != NULL) variant |= VARIANT_DISPLACEMENT_MAPPING;
+	return variant;
+}
+
+u64 MakeSortKey(RenderPass pass, u32 variant, u32 materialId, u32 modelId, r32 normalizedDepth) {
+	u64 depth = (u64)(clamp(normalizedDepth, 0.0f, 1.0f) * 65535.0f);
+	return ((u64)(pass & 0xF) << SORT_KEY_PASS_SHIFT)
+		| ((u64)(variant & 0xFF) << SORT_KEY_VARIANT_SHIFT)
+		| ((u64)(materialId & 0xFFF) << SORT_KEY_MATERIAL_SHIFT)
+		| ((u64)(modelId & 0xFFF) << SORT_KEY_MODEL_SHIFT)
+		| (depth << SORT_KEY_DEPTH_SHIFT);
+}
+
+u32 GetSortKeyVariant(u64 key) {
+	return (key >> SORT_KEY_VARIANT_SHIFT) & 0xFF;
+}
+
+/**
+ * lsd radix sort of the keys (8 bits per pass), the object indices move with their keys
+ * all 8 histograms are built in one read of the keys and passes where every key has the same digit are skipped
+ */
+void SortRenderQueue(RenderQueue& queue) {
+	u32 histograms[8][256] = {};
+	for(u32 i = 0; i < queue.nItems; i++) {
+		u64 key = queue.keys[i];
+		for(u32 d = 0; d < 8; d++) {
+			histograms[d][(key >> (d * 8)) & 0xFF]++;
+		}
+	}
+
+	u64* srcKeys = queue.keys;
+	u32* srcIndices = queue.objIndices;
+	u64* dstKeys = queue.scratchKeys;
+	u32* dstIndices = queue.scratchObjIndices;
+	for(u32 d = 0; d < 8; d++) {
+		u32* histogram = histograms[d];
+		if(histogram[(srcKeys[0] >> (d * 8)) & 0xFF] == queue.nItems)
+			continue; // every key has the same digit here, this pass wouldn't move anything
+
+		// exclusive prefix sum turns counts into output offsets
+		u32 offset = 0;
+		for(u32 b = 0; b < 256; b++) {
+			u32 count = histogram[b];
+			histogram[b] = offset;
+			offset += count;
+		}
+		for(u32 i = 0; i < queue.nItems; i++) {
+			u32 dst = histogram[(srcKeys[i] >> (d * 8)) & 0xFF]++;
+			dstKeys[dst] = srcKeys[i];
+			dstIndices[dst] = srcIndices[i];
+		}
+		u64* tempKeys = srcKeys; srcKeys = dstKeys; dstKeys = tempKeys;
+		u32* tempIndices = srcIndices; srcIndices = dstIndices; dstIndices = tempIndices;
+	}
+	// make sure the sorted result ends up in keys / objIndices
+	if(srcKeys != queue.keys) {
+		memcpy(queue.keys, srcKeys, queue.nItems * sizeof(u64));
+		memcpy(queue.objIndices, srcIndices, queue.nItems * sizeof(u32));
+	}
+}
+
+/** fills the queue with one sorted item per visible render obj (objIndices are indices into renderObjs) for the given pass */
+void BuildRenderQueue(RenderQueue& queue, RenderPass pass, Camera& camera, RenderObj* renderObjs, u32* objIndices, u32 nObjs) {
+	queue.pass = pass;
+	queue.nItems = 0;
+	for(u32 v = 0; v < nObjs; v++) {
+		if(queue.nItems >= MAX_QUEUED_DRAWS) {
+			printf("exceeded max queued draws\n");
+			break;
+		}
+		u32 i = objIndices[v];
+		RenderObj& obj = renderObjs[i];
+		// front to back, so early depth testing rejects as much as it can
+		r32 depth = dot(obj.transform.pos - camera.pos, camera.dir) / camera.farClip;
+		u32 materialId = pass == RENDER_PASS_SHADOW ? 0 : obj.material->id;
+		queue.keys[queue.nItems] = MakeSortKey(pass, GetShaderVariant(pass, obj), materialId, obj.model->id, depth);
+		queue.objIndices[queue.nItems] = i;
+		queue.nItems++;
+	}
+	if(queue.nItems > 0) {
+		SortRenderQueue(queue);
+	}
+}
+
+// skinned models need their own joint transforms and models with meshlets are cluster culled per object,
+// so neither can share a draw with other objects
+bool CanInstance(RenderObj& obj) {
+	return obj.model->numJoints == 0 && obj.model->numMeshlets == 0;
+}
+
+/**
+ * groups the sorted queue into batches, runs of at least minInstancesPerBatch objects sharing a model and material become
+ * one instanced batch and their matrices are written to the instance buffer (call UploadInstances before drawing)
+ * the shadow pass is depth only, so there only the model has to match
+ */
+void BatchRenderQueue(RenderQueue& queue, RenderObj* renderObjs, InstanceBuffer& instanceBuffer, u32 minInstancesPerBatch = MIN_INSTANCES_PER_BATCH) {
+	queue.nBatches = 0;
+	instanceBuffer.nInstances = 0;
+	bool splitOnMaterial = queue.pass != RENDER_PASS_SHADOW;
+	for(u32 i = 0; i < queue.nItems; ) {
+		RenderObj& first = renderObjs[queue.objIndices[i]];
+		u32 count = 1;
+		if(CanInstance(first)) {
+			while(i + count < queue.nItems) {
+				RenderObj& next = renderObjs[queue.objIndices[i + count]];
+				if(next.model != first.model || (splitOnMaterial && next.material != first.material)) break;
+				count++;
+			}
+		}
+
+		RenderBatch& batch = queue.batches[queue.nBatches++];
+		batch.queueStart = i;
+		batch.count = count;
+		batch.firstInstance = -1;
+		batch.objectConstantsOffset = -1;
+		batch.jointPaletteOffset = -1;
+		if(CanInstance(first) && count >= minInstancesPerBatch && instanceBuffer.nInstances + count <= MAX_INSTANCES) {
+			batch.firstInstance = instanceBuffer.nInstances;
+			instanceBuffer.nInstances += count;
+		}
+		else if(count > 1) {
+			// no room for instancing, fall back to drawing them one by one
+			batch.count = 1;
+			count = 1;
+		}
+		i += count;
+	}
+
+	// every batch knows where its instances go now, so they can be written in parallel
+	ParallelFor(queue.nBatches, MIN_BATCHES_PER_THREAD, [&](u32 start, u32 end, u32 threadIndex) {
+		for(u32 b = start; b < end; b++) {
+			RenderBatch& batch = queue.batches[b];
+			if(batch.firstInstance < 0) continue;
+			for(u32 j = 0; j < batch.count; j++) {
+				RenderObj& obj = renderObjs[queue.objIndices[batch.queueStart + j]];
+				InstanceData& instance = instanceBuffer.instances[batch.firstInstance + j];
+				instance.modelMatrix = obj.transform.matrix;
+				instance.normalMatrix = obj.normalMatrix;
+				instance.materialIndex = obj.material->id;
+			}
+		}
+	});
+}
+
+/**
+ * writes one indirect command per batch (commands[b] draws batches[b]), batches that aren't instanced get an empty command
+ * (call UploadIndirectCommands before drawing)
+ */
+void FillIndirectCommands(IndirectBuffer& indirectBuffer, RenderQueue& queue, RenderObj* renderObjs) {
+	if(queue.nBatches > MAX_INDIRECT_COMMANDS) {
+		printf("exceeded max indirect commands\n");
+		exit(1);
+	}
+	ParallelFor(queue.nBatches, MIN_BATCHES_PER_THREAD, [&](u32 start, u32 end, u32 threadIndex) {
+		for(u32 b = start; b < end; b++) {
+			RenderBatch& batch = queue.batches[b];
+			Model& model = *renderObjs[queue.objIndices[batch.queueStart]].model;
+			DrawElementsIndirectCommand& command = indirectBuffer.commands[b];
+			command.count = model.numIndices;
+			command.instanceCount = batch.firstInstance < 0 ? 0 : batch.count;
+			command.firstIndex = model.indicesOffset;
+			command.baseVertex = 0; // indices already point into the shared vbo
+			command.baseInstance = batch.firstInstance < 0 ? 0 : batch.firstInstance;
+		}
+	});
+	indirectBuffer.nCommands = queue.nBatches;
+}
+
+/**
+ * end of the run of instanced batches starting at start, which can go out as one multi draw indirect
+ * the run ends where the shader variant changes, and with sameTextures also where a material needs other texture arrays bound
+ * (instances carry their material index)
+ */
+u32 GetIndirectRunEnd(RenderQueue& queue, RenderObj* renderObjs, u32 start, bool sameTextures) {
+	u32 queueStart = queue.batches[start].queueStart;
+	Material* material = renderObjs[queue.objIndices[queueStart]].material;
+	u32 variant = GetSortKeyVariant(queue.keys[queueStart]);
+	u32 end = start + 1;
+	while(end < queue.nBatches && queue.batches[end].firstInstance >= 0) {
+		u32 next = queue.batches[end].queueStart;
+		if(GetSortKeyVariant(queue.keys[next]) != variant) break;
+		if(sameTextures && !SharesTextureArrays(*renderObjs[queue.objIndices[next]].material, *material)) break;
+		end++;
+	}
+	return end;
+}
@@ -0,0 +1,256 @@
+#pragma once
+#include <GL/glew.h>
+#include <string.h>
+#include "../core/types.h"
+#include "gl_buffers.h"
+
+// tracks gl state on the cpu so redundant binds and uniform uploads never reach the driver
+// and so we never have to read state back from the driver (glGet* calls can stall)
+
+#define MAX_TEXTURE_UNITS 16
+#define MAX_CACHED_PROGRAMS 64 // every shader variant is its own program
+// uniforms at or past this location are still set, just not cached
+#define MAX_CACHED_UNIFORM_LOCATION 256
+#define MAX_UNIFORM_BUFFER_BINDINGS 8
+
+struct RenderStats {
+	u32 drawCalls;
+	u32 triangles;
+	u32 programBinds;
+	u32 textureBinds;
+	u32 bufferBinds;
+	u32 uniformUploads;
+	u32 skippedCalls; // redundant calls the cache filtered out
+	u32 occludedObjs; // in the frustum but hidden behind occluders
+	u32 staticShadowUpdates; // cached static shadow map layers that had to be re-rendered
+};
+
+struct ProgramUniformCache {
+	GLuint program;
+	bool known[MAX_CACHED_UNIFORM_LOCATION];
+	u32 values[MAX_CACHED_UNIFORM_LOCATION][4]; // raw bits of up to 4 ints / floats
+};
+
+struct RenderState {
+	GLuint program;
+	GLuint vertexArray;
+	ProgramUniformCache* uniforms; // cache for the bound program
+	u32 activeTextureUnit;
+	GLuint boundTextures[MAX_TEXTURE_UNITS];
+	s32 boundUniformOffsets[MAX_UNIFORM_BUFFER_BINDINGS]; // offset bound with BindUniformRange at each binding point
+
+	u32 nPrograms;
+	ProgramUniformCache programs[MAX_CACHED_PROGRAMS];
+
+	RenderStats stats; // for the frame in progress
+	RenderStats lastFrameStats;
+};
+
+/** forget what's bound (but not uniform values), call when other code may have changed bindings */
+void InvalidateBindings(RenderState& state) {
+	state.program = 0;
+	state.uniforms = NULL;
+	state.vertexArray = (GLuint)-1;
+	state.activeTextureUnit = (u32)-1;
+	for(u32 i = 0; i < MAX_TEXTURE_UNITS; i++) {
+		state.boundTextures[i] = (GLuint)-1;
+	}
+	for(u32 i = 0; i < MAX_UNIFORM_BUFFER_BINDINGS; i++) {
+		state.boundUniformOffsets[i] = -1;
+	}
+}
+
+void InitRenderState(RenderState& state) {
+	state.nPrograms = 0;
+	memset(&state.stats, 0, sizeof(RenderStats));
+	memset(&state.lastFrameStats, 0, sizeof(RenderStats));
+	InvalidateBindings(state);
+}
+
+/** call when a program is deleted or relinked, since its uniform values are gone, its cache is freed for another program */
+void ForgetProgramUniforms(RenderState& state, GLuint program) {
+	if(program == 0) return;
+	for(u32 i = 0; i < state.nPrograms; i++) {
+		if(state.programs[i].program == program) {
+			state.programs[i].program = 0;
+		}
+	}
+	if(state.program == program) {
+		state.program = 0;
+		state.uniforms = NULL;
+	}
+}
+
+void ResetRenderStats(RenderState& state) {
+	state.lastFrameStats = state.stats;
+	memset(&state.stats, 0, sizeof(RenderStats));
+}
+
+void SetProgram(RenderState& state, GLuint program) {
+	if(state.program == program) {
+		state.stats.skippedCalls++;
+		return;
+	}
+	glUseProgram(program);
+	state.program = program;
+	state.stats.programBinds++;
+
+	state.uniforms = NULL;
+	if(program == 0) return; // freed caches have program 0
+	ProgramUniformCache* freed = NULL;
+	for(u32 i = 0; i < state.nPrograms; i++) {
+		if(state.programs[i].program == program) {
+			state.uniforms = &state.programs[i];
+			return;
+		}
+		if(state.programs[i].program == 0 && freed == NULL) {
+			freed = &state.programs[i];
+		}
+	}
+	if(freed == NULL && state.nPrograms >= MAX_CACHED_PROGRAMS) {
+		printf("exceeded max cached programs, uniforms for program %d won't be cached\n", program);
+		return;
+	}
+	// hot reloaded shaders leave their old program's cache to reuse
+	state.uniforms = freed != NULL ? freed : &state.programs[state.nPrograms++];
+	state.uniforms->program = program;
+	memset(state.uniforms->known, 0, sizeof(state.uniforms->known));
+}
+
+void SetVertexArray(RenderState& state, GLuint vertexArray) {
+	if(state.vertexArray == vertexArray) {
+		state.stats.skippedCalls++;
+		return;
+	}
+	glBindVertexArray(vertexArray);
+	state.vertexArray = vertexArray;
+	state.stats.bufferBinds++;
+}
+
+void SetTexture(RenderState& state, u32 texUnit, GLuint texture, GLenum target = GL_TEXTURE_2D) {
+	if(texUnit < MAX_TEXTURE_UNITS && state.boundTextures[texUnit] == texture) {
+		state.stats.skippedCalls++;
+		return;
+	}
+	if(state.activeTextureUnit != texUnit) {
+		glActiveTexture(GL_TEXTURE0 + texUnit);
+		state.activeTextureUnit = texUnit;
+	}
+	glBindTexture(target, texture);
+	if(texUnit < MAX_TEXTURE_UNITS) {
+		state.boundTextures[texUnit] = texture;
+	}
+	state.stats.textureBinds++;
+}
+
+// binding points used with this should only ever see ranges of one buffer
+void BindUniformRange(RenderState& state, u32 binding, GLuint buffer, s32 offset, u32 size) {
+	if(binding < MAX_UNIFORM_BUFFER_BINDINGS && state.boundUniformOffsets[binding] == offset) {
+		state.stats.skippedCalls++;
+		return;
+	}
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+	if(binding < MAX_UNIFORM_BUFFER_BINDINGS) {
+		state.boundUniformOffsets[binding] = offset;
+	}
+	state.stats.bufferBinds++;
+}
+
+// returns true if the value differs from the cached one (and updates the cache)
+bool UpdateUniformCache(RenderState& state, GLint location, const void* value, u32 size) {
+	if(state.uniforms == NULL || location >= MAX_CACHED_UNIFORM_LOCATION)
+		return true;
+	u32* cached = state.uniforms->values[location];
+	if(state.uniforms->known[location] && memcmp(cached, value, size) == 0) {
+		state.stats.skippedCalls++;
+		return false;
+	}
+	memcpy(cached, value, size);
+	state.uniforms->known[location] = true;
+	return true;
+}
+
+void SetUniform1i(RenderState& state, GLint location, GLint value) {
+	if(location < 0) return; // optimized out of the shader
+	if(!UpdateUniformCache(state, location, &value, sizeof(GLint))) return;
+	glUniform1i(location, value);
+	state.stats.uniformUploads++;
+}
+
+void SetUniform1f(RenderState& state, GLint location, r32 value) {
+	if(location < 0) return;
+	if(!UpdateUniformCache(state, location, &value, sizeof(r32))) return;
+	glUniform1f(location, value);
+	state.stats.uniformUploads++;
+}
+
+void SetUniform2fv(RenderState& state, GLint location, const vec2& value) {
+	if(location < 0) return;
+	if(!UpdateUniformCache(state, location, &value[0], 2 * sizeof(r32))) return;
+	glUniform2fv(location, 1, &value[0]);
+	state.stats.uniformUploads++;
+}
+
+void SetUniform3fv(RenderState& state, GLint location, const vec3& value) {
+	if(location < 0) return;
+	if(!UpdateUniformCache(state, location, &value[0], 3 * sizeof(r32))) return;
+	glUniform3fv(location, 1, &value[0]);
+	state.stats.uniformUploads++;
+}
+
+// matrices change per object so they aren't cached, only counted
+void SetUniformMatrix4fv(RenderState& state, GLint location, u32 count, const r32* value) {
+	if(location < 0) return;
+	glUniformMatrix4fv(location, count, GL_FALSE, value);
+	state.stats.uniformUploads++;
+}
+
+/** cpu side read of an int uniform of the bound program, it must have been set through the cache */
+GLint GetUniform1i(RenderState& state, GLint location) {
+	if(state.uniforms == NULL || location < 0 || location >= MAX_CACHED_UNIFORM_LOCATION || !state.uniforms->known[location]) {
+		printf("GetUniform1i(): uniform %d was never set through the render state\n", location);
+		return 0;
+	}
+	return *((GLint*)state.uniforms->values[location]);
+}
+
+/** binds a texture to a unit and points the sampler uniform at it */
+void SetSampler(RenderState& state, GLint samplerLocation, GLuint texture, u32 texUnit, GLenum target = GL_TEXTURE_2D) {
+	SetTexture(state, texUnit, texture, target);
+	SetUniform1i(state, samplerLocation, texUnit);
+}
+
+void DrawElements(RenderState& state, u32 numIndices, u32 indicesOffset) {
+	glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, (void*)(indicesOffset * sizeof(u32)));
+	state.stats.drawCalls++;
+	state.stats.triangles += numIndices / 3;
+}
+
+void DrawArrays(RenderState& state, u32 firstVertex, u32 nVertices) {
+	glDrawArrays(GL_TRIANGLES, firstVertex, nVertices);
+	state.stats.drawCalls++;
+	state.stats.triangles += nVertices / 3;
+}
+
+void DrawElementsInstanced(RenderState& state, u32 numIndices, u32 indicesOffset, u32 nInstances) {
+	glDrawElementsInstanced(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, (void*)(indicesOffset * sizeof(u32)), nInstances);
+	state.stats.drawCalls++;
+	state.stats.triangles += numIndices / 3 * nInstances;
+}
+
+// draws commands [firstCommand, firstCommand + nCommands) of the bound GL_DRAW_INDIRECT_BUFFER, commands is the cpu copy of it
+void MultiDrawElementsIndirect(RenderState& state, DrawElementsIndirectCommand* commands, u32 firstCommand, u32 nCommands) {
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(firstCommand * sizeof(DrawElementsIndirectCommand)), nCommands, 0);
+	state.stats.drawCalls++;
+	for(u32 i = firstCommand; i < firstCommand + nCommands; i++) {
+		state.stats.triangles += commands[i].count / 3 * commands[i].instanceCount;
+	}
+}
+
+void MultiDrawElements(RenderState& state, const GLsizei* counts, const GLvoid* const* offsets, u32 nRanges) {
+	glMultiDrawElements(GL_TRIANGLES, counts, GL_UNSIGNED_INT, offsets, nRanges);
+	state.stats.drawCalls++;
+	for(u32 i = 0; i < nRanges; i++) {
+		state.stats.triangles += counts[i] / 3;
+	}
+}
@@ -1,9 +1,18 @@
 #pragma once
 #include <GL/glew.h>
 #include <vector>
+#include "../core/types.h"
 #include "../core/fileio.h"
+#include "../core/hash.h"
+#include "render_state.h"
 using namespace std;
 
+#define MAX_SHADER_VARIANTS 64 // per ShaderVariants
+#define MAX_SHADER_FEATURES 32
+#define MAX_SHADER_FEATURE_NAME 32
+#define MAX_SHADER_PATH 128
+#define MAX_SHADER_DEPENDENCIES 16 // files a shader's sources are read from, includes and all
+
 bool CheckOpenGLError(GLuint id, bool shader_program_info) {
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
@@ -27,55 +36,334 @@ bool CheckOpenGLError(GLuint id, bool shader_program_info) {
 	return true;
 }
 
-GLuint CompileShaderProgram(const char* vertexShaderPath, const char* fragmentShaderPath) {
-	// create shaders
-	GLuint vertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint fragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+// defines have to come after #version, which has to be the first line
+void InsertShaderDefines(string& code, const char* defines) {
+	if(defines == NULL || defines[0] == '\0') return;
+	size_t versionEnd = 0;
+	if(code.compare(0, 8, "#version") == 0) {
+		versionEnd = code.find('\n');
+		versionEnd = versionEnd == string::npos ? code.size() : versionEnd + 1;
+		// so errors still point at the line the shader file has
+		code.insert(versionEnd, "#line 2 0\n");
+	}
+	code.insert(versionEnd, defines);
+}
 
-	// read in shaders
-	string vertexShaderCode;
-	if(!ReadFile(vertexShaderCode, vertexShaderPath)) {
-		return 0;
+/**
+ * the files a shader was read from, with their modify times when they were read, for hot reloading
+ * one is kept per ShaderVariants rather than per program since #includes are pasted in whatever the variant's defines are
+ */
+struct ShaderDependencies {
+	u32 nFiles;
+	char paths[MAX_SHADER_DEPENDENCIES][MAX_SHADER_PATH];
+	FILETIME modifyTimes[MAX_SHADER_DEPENDENCIES];
+};
+
+void AddShaderDependency(ShaderDependencies& deps, const char* path) {
+	for(u32 i = 0; i < deps.nFiles; i++) {
+		if(strcmp(deps.paths[i], path) == 0) {
+			deps.modifyTimes[i] = LastModifiedOfFile(path);
+			return;
+		}
 	}
-	char const* vertexSourcePointer = vertexShaderCode.c_str();
-	std::string fragmentShaderCode;
-	if(!ReadFile(fragmentShaderCode, fragmentShaderPath)) {
-		return 0;
+	if(deps.nFiles >= MAX_SHADER_DEPENDENCIES || strlen(path) >= MAX_SHADER_PATH) {
+		printf("can't watch %s for shader reloads\n", path);
+		return;
 	}
-	char const* fragmentSourcePointer = fragmentShaderCode.c_str();
+	strcpy(deps.paths[deps.nFiles], path);
+	deps.modifyTimes[deps.nFiles] = LastModifiedOfFile(path);
+	deps.nFiles++;
+}
 
-	// compile shaders
-	glShaderSource(vertexShaderID, 1, &vertexSourcePointer , NULL);
-	glCompileShader(vertexShaderID);
-	glShaderSource(fragmentShaderID, 1, &fragmentSourcePointer , NULL);
-	glCompileShader(fragmentShaderID);
+/** true if any of the files changed since they were read (or since the last call), polled like ReloadDLLIfUpdated */
+bool ShaderDependenciesChanged(ShaderDependencies& deps) {
+	bool changed = false;
+	for(u32 i = 0; i < deps.nFiles; i++) {
+		FILETIME modifyTime = LastModifiedOfFile(deps.paths[i]);
+		if(CompareFileTime(&deps.modifyTimes[i], &modifyTime) != 0) {
+			deps.modifyTimes[i] = modifyTime;
+			changed = true;
+		}
+	}
+	return changed;
+}
 
-	// check if error compiling
-	if(!CheckOpenGLError(vertexShaderID, true)) {
-		return 0;
+// pastes path into code, files already in included are skipped so shared headers can include each other
+bool AppendShaderSource(string& code, const char* path, vector<string>& included) {
+	for(u32 i = 0; i < included.size(); i++) {
+		if(included[i] == path) return true;
 	}
-	// check if error compiling
-	if(!CheckOpenGLError(fragmentShaderID, true)) {
-		return 0;
+	u32 fileIndex = included.size();
+	included.push_back(path); // before it's read, so a missing file is still watched
+	string source;
+	if(!ReadFile(source, path)) {
+		return false;
 	}
+	string directory = path;
+	size_t slash = directory.find_last_of('/');
+	directory = slash == string::npos ? "" : directory.substr(0, slash + 1);
 
-	// Link the program
-	GLuint program = glCreateProgram();
-	glAttachShader(program, vertexShaderID);
-	glAttachShader(program, fragmentShaderID);
-	glLinkProgram(program);
-	// check if error linking
-	if(!CheckOpenGLError(program, false)) {
-		return 0;
+	u32 lineNumber = 1;
+	size_t lineStart = 0;
+	while(lineStart < source.size()) {
+		size_t lineEnd = source.find('\n', lineStart);
+		lineEnd = lineEnd == string::npos ? source.size() : lineEnd + 1;
+		size_t first = source.find_first_not_of(" \t", lineStart);
+		// only the including file's #version counts
+		if(fileIndex > 0 && first < lineEnd && source.compare(first, 8, "#version") == 0) {
+			code += "\n";
+		}
+		else if(first < lineEnd && source.compare(first, 8, "#include") == 0) {
+			size_t nameStart = source.find('"', first);
+			size_t nameEnd = nameStart < lineEnd ? source.find('"', nameStart + 1) : string::npos;
+			if(nameEnd >= lineEnd) {
+				printf("%s(%d): expected #include \"file\"\n", path, lineNumber);
+				return false;
+			}
+			string includePath = directory + source.substr(nameStart + 1, nameEnd - nameStart - 1);
+			char line[32];
+			snprintf(line, sizeof(line), "#line 1 %d\n", (int)included.size());
+			code += line;
+			if(!AppendShaderSource(code, includePath.c_str(), included)) {
+				printf("included from %s(%d)\n", path, lineNumber);
+				return false;
+			}
+			snprintf(line, sizeof(line), "#line %d %d\n", lineNumber + 1, fileIndex);
+			code += line;
+		}
+		else {
+			code.append(source, lineStart, lineEnd - lineStart);
+		}
+		lineStart = lineEnd;
+		lineNumber++;
+	}
+	return true;
+}
+
+/**
+ * reads the shader at path with every #include "file" (relative to the file including it) pasted in, each file at most
+ * once, and adds everything it read to deps if it isn't NULL
+ * compile errors are reported as <source string>(<line>), the source string being which file it is in the order they
+ * were first included, 0 for path
+ */
+bool ReadShaderSource(string& out_code, const char* path, ShaderDependencies* deps = NULL) {
+	vector<string> included;
+	bool read = AppendShaderSource(out_code, path, included);
+	if(deps != NULL) {
+		// a missing file is watched too, so adding it back reloads the shader
+		for(u32 i = 0; i < included.size(); i++) {
+			AddShaderDependency(*deps, included[i].c_str());
+		}
+	}
+	return read;
+}
+
+/**
+ * linked programs are cached as glGetProgramBinary blobs in SHADER_CACHE_DIR, a file per shader pair and defines, and only
+ * used while the hash in its header still matches the sources, defines and driver, so edits and driver updates recompile
+ * drivers that support KHR_parallel_shader_compile compile on their own threads, so a program can be started with
+ * BeginShaderProgram and only waited on by FinishShaderProgram when it's needed (see PrecompileShaderVariant), or polled with
+ * IsShaderProgramReady so a draw can skip it until then (see LoadShaderVariant)
+ */
+
+#define SHADER_CACHE_DIR "shaders/cache/"
+#define SHADER_CACHE_MAGIC 0x4E494250 // "PBIN"
+#define SHADER_CACHE_VERSION 1
+
+struct ShaderCacheHeader {
+	u32 magic;
+	u32 version;
+	u64 sourceHash; // of the sources with their defines and the driver strings
+	GLenum binaryFormat;
+	u32 binarySize; // follows the header
+};
+
+// a program that may still be compiling
+struct ShaderProgramBuild {
+	GLuint program; // 0 if the sources couldn't be read
+	GLuint vertexShader, fragmentShader; // 0 when the program came from the cache
+	u64 fileHash; // names the cache file
+	u64 sourceHash;
+};
+
+bool ParallelShaderCompileSupported() {
+#ifdef GL_KHR_parallel_shader_compile
+	return GLEW_KHR_parallel_shader_compile;
+#else
+	return false;
+#endif
+}
+
+// macos reports no binary formats, so nothing gets cached there
+bool ProgramBinariesSupported() {
+	static GLint nFormats = -1; // asked once, not for every program
+	if(nFormats < 0) {
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nFormats);
+	}
+	return nFormats > 0;
+}
+
+/** call once after glewInit, lets the driver compile on as many threads as it likes and makes the cache directory */
+void InitShaderCache() {
+#ifdef GL_KHR_parallel_shader_compile
+	if(GLEW_KHR_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+	}
+#endif
+	if(ProgramBinariesSupported() && !MakeDirectory(SHADER_CACHE_DIR)) {
+		printf("Unable to make shader cache directory %s\n", SHADER_CACHE_DIR);
+	}
+}
+
+// binaries are only good for the driver that made them
+u64 HashDriver(u64 hash) {
+	const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	for(u32 i = 0; i < 3; i++) {
+		const char* string = (const char*)glGetString(strings[i]);
+		if(string != NULL) {
+			hash = HashString(string, hash);
+		}
+	}
+	return hash;
+}
+
+string GetShaderCachePath(u64 fileHash) {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)fileHash);
+	return string(SHADER_CACHE_DIR) + name;
+}
+
+// true if the program linked from the cached binary
+bool LoadProgramBinary(GLuint program, u64 fileHash, u64 sourceHash) {
+	FILE* file = fopen(GetShaderCachePath(fileHash).c_str(), "rb");
+	if(file == NULL) return false;
+	ShaderCacheHeader header;
+	if(fread(&header, sizeof(ShaderCacheHeader), 1, file) != 1 || header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION
+	|| header.sourceHash != sourceHash) {
+		fclose(file);
+		return false;
+	}
+	vector<u8> binary(header.binarySize);
+	bool read = header.binarySize > 0 && fread(&binary[0], 1, header.binarySize, file) == header.binarySize;
+	fclose(file);
+	if(!read) return false;
+	glProgramBinary(program, header.binaryFormat, &binary[0], header.binarySize);
+	// the driver can refuse a binary it made, after an update it didn't change its version string for say
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	return linked == GL_TRUE;
+}
+
+void SaveProgramBinary(GLuint program, u64 fileHash, u64 sourceHash) {
+	GLint size = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+	if(size <= 0) return;
+	vector<u8> binary(size);
+	ShaderCacheHeader header;
+	header.magic = SHADER_CACHE_MAGIC;
+	header.version = SHADER_CACHE_VERSION;
+	header.sourceHash = sourceHash;
+	glGetProgramBinary(program, size, NULL, &header.binaryFormat, &binary[0]);
+	header.binarySize = size;
+
+	string path = GetShaderCachePath(fileHash);
+	FILE* file = fopen(path.c_str(), "wb");
+	if(file == NULL) return; // no cache directory, the program just gets compiled again next time
+	bool written = fwrite(&header, sizeof(ShaderCacheHeader), 1, file) == 1 && fwrite(&binary[0], 1, size, file) == (size_t)size;
+	fclose(file);
+	if(!written) {
+		printf("Unable to write shader cache: %s\n", path.c_str());
+		remove(path.c_str());
+	}
+}
+
+/**
+ * starts building the program, from the cache if it's there and by compiling and linking otherwise, without waiting on the driver
+ * defines (one "#define NAME\n" per line) are added to both shaders, NULL for none
+ * the files the sources were read from, includes and all, are added to deps if it isn't NULL
+ */
+bool BeginShaderProgram(ShaderProgramBuild& build, const char* vertexShaderPath, const char* fragmentShaderPath, const char* defines = NULL,
+ShaderDependencies* deps = NULL) {
+	build.program = 0;
+	build.vertexShader = 0;
+	build.fragmentShader = 0;
+
+	// read in shaders, the hashes are of what they include too, so editing an include misses the cache
+	string vertexShaderCode;
+	if(!ReadShaderSource(vertexShaderCode, vertexShaderPath, deps)) {
+		return false;
+	}
+	InsertShaderDefines(vertexShaderCode, defines);
+	string fragmentShaderCode;
+	if(!ReadShaderSource(fragmentShaderCode, fragmentShaderPath, deps)) {
+		return false;
+	}
+	InsertShaderDefines(fragmentShaderCode, defines);
+
+	build.fileHash = HashString(fragmentShaderPath, HashString(vertexShaderPath, HashString(defines != NULL ? defines : "")));
+	build.sourceHash = HashDriver(HashString(fragmentShaderCode.c_str(), HashString(vertexShaderCode.c_str())));
+	build.program = glCreateProgram();
+	bool cacheBinaries = ProgramBinariesSupported();
+	if(cacheBinaries && LoadProgramBinary(build.program, build.fileHash, build.sourceHash)) {
+		return true;
 	}
 
+	// compile and link, the statuses are checked by FinishShaderProgram so parallel compiles aren't waited on here
+	build.vertexShader = glCreateShader(GL_VERTEX_SHADER);
+	build.fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+	char const* vertexSourcePointer = vertexShaderCode.c_str();
+	char const* fragmentSourcePointer = fragmentShaderCode.c_str();
+	glShaderSource(build.vertexShader, 1, &vertexSourcePointer, NULL);
+	glCompileShader(build.vertexShader);
+	glShaderSource(build.fragmentShader, 1, &fragmentSourcePointer, NULL);
+	glCompileShader(build.fragmentShader);
+	glAttachShader(build.program, build.vertexShader);
+	glAttachShader(build.program, build.fragmentShader);
+	if(cacheBinaries) {
+		glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+	glLinkProgram(build.program);
+	return true;
+}
+
+/** false while the driver is still compiling the program on its own threads, FinishShaderProgram won't block once it's true */
+bool IsShaderProgramReady(ShaderProgramBuild& build) {
+	if(build.vertexShader == 0 || !ParallelShaderCompileSupported()) return true;
+	GLint ready = GL_TRUE;
+	glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &ready);
+	return ready == GL_TRUE;
+}
+
+/** waits for the program if it's still compiling, caches its binary, returns 0 (and prints the log) if it didn't compile or link */
+GLuint FinishShaderProgram(ShaderProgramBuild& build) {
+	if(build.vertexShader == 0) return build.program; // from the cache, or the sources couldn't be read
+
+	// check if error compiling or linking
+	bool compiled = CheckOpenGLError(build.vertexShader, true) && CheckOpenGLError(build.fragmentShader, true) && CheckOpenGLError(build.program, false);
+
 	// cleanup
-	glDetachShader(program, vertexShaderID);
-	glDetachShader(program, fragmentShaderID);
-	glDeleteShader(vertexShaderID);
-	glDeleteShader(fragmentShaderID);
+	glDetachShader(build.program, build.vertexShader);
+	glDetachShader(build.program, build.fragmentShader);
+	glDeleteShader(build.vertexShader);
+	glDeleteShader(build.fragmentShader);
+	build.vertexShader = 0;
+	build.fragmentShader = 0;
+	if(!compiled) {
+		glDeleteProgram(build.program);
+		build.program = 0;
+		return 0;
+	}
+	if(ProgramBinariesSupported()) {
+		SaveProgramBinary(build.program, build.fileHash, build.sourceHash);
+	}
+	return build.program;
+}
 
-	return program;
+/** defines (one "#define NAME\n" per line) are added to both shaders, NULL for none */
+GLuint CompileShaderProgram(const char* vertexShaderPath, const char* fragmentShaderPath, const char* defines = NULL) {
+	ShaderProgramBuild build;
+	BeginShaderProgram(build, vertexShaderPath, fragmentShaderPath, defines);
+	return FinishShaderProgram(build);
 }
 
 void InitShader(GLuint& shaderProgram, const char* vertexShaderPath, const char* fragmentShaderPath) {
@@ -89,3 +377,161 @@ void InitShader(GLuint& shaderProgram, const char* vertexShaderPath, const char*
 void DeinitShader(GLuint shaderProgram) {
 	glDeleteProgram(shaderProgram);
 }
+
+/**
+ * a shader compiled into programs specialized by a bitmask of features, instead of branching on bool uniforms
+ * bit i of a variant's mask adds "#define <featureNames[i]>" to the source, so it can #ifdef away whatever the variant doesn't use
+ * variants are compiled the first time they're asked for, or started ahead of time with PrecompileShaderVariant,
+ * then kept until DeinitShaderVariants
+ * the paths and names are copied in, since the game's memory outlives the dll their literals are in
+ */
+struct ShaderVariants {
+	char vertexShaderPath[MAX_SHADER_PATH];
+	char fragmentShaderPath[MAX_SHADER_PATH];
+	char featureNames[MAX_SHADER_FEATURES][MAX_SHADER_FEATURE_NAME]; // by bit, empty for bits the shader doesn't have
+	u32 nFeatures;
+	ShaderDependencies dependencies; // of every variant, see ReloadShaderVariantsIfUpdated
+	u32 nVariants;
+	u32 masks[MAX_SHADER_VARIANTS];
+	GLuint programs[MAX_SHADER_VARIANTS]; // 0 for variants that didn't compile, so they aren't retried every draw
+	bool pending[MAX_SHADER_VARIANTS]; // precompiled but not finished yet, programs is 0 until LoadShaderVariant finishes it
+	ShaderProgramBuild builds[MAX_SHADER_VARIANTS];
+};
+
+void InitShaderVariants(ShaderVariants& variants, const char* vertexShaderPath, const char* fragmentShaderPath, const char* const* featureNames, u32 nFeatures) {
+	snprintf(variants.vertexShaderPath, MAX_SHADER_PATH, "%s", vertexShaderPath);
+	snprintf(variants.fragmentShaderPath, MAX_SHADER_PATH, "%s", fragmentShaderPath);
+	for(u32 i = 0; i < nFeatures; i++) {
+		snprintf(variants.featureNames[i], MAX_SHADER_FEATURE_NAME, "%s", featureNames[i] != NULL ? featureNames[i] : "");
+	}
+	variants.nFeatures = nFeatures;
+	variants.dependencies.nFiles = 0;
+	variants.nVariants = 0;
+}
+
+void DeinitShaderVariants(ShaderVariants& variants) {
+	for(u32 i = 0; i < variants.nVariants; i++) {
+		if(variants.pending[i]) {
+			FinishShaderProgram(variants.builds[i]);
+			variants.programs[i] = variants.builds[i].program;
+		}
+		DeinitShader(variants.programs[i]);
+	}
+	variants.nVariants = 0;
+}
+
+string GetShaderDefines(ShaderVariants& variants, u32 mask) {
+	string defines;
+	for(u32 i = 0; i < variants.nFeatures; i++) {
+		if((mask & (1 << i)) && variants.featureNames[i][0] != '\0') {
+			defines += "#define ";
+			defines += variants.featureNames[i];
+			defines += "\n";
+		}
+	}
+	return defines;
+}
+
+// -1 if there's no variant with the mask yet
+s32 FindShaderVariant(ShaderVariants& variants, u32 mask) {
+	for(u32 i = 0; i < variants.nVariants; i++) {
+		if(variants.masks[i] == mask) return i;
+	}
+	return -1;
+}
+
+// adds a variant that hasn't been finished, -1 past MAX_SHADER_VARIANTS
+s32 BeginShaderVariant(ShaderVariants& variants, u32 mask) {
+	if(variants.nVariants >= MAX_SHADER_VARIANTS) {
+		printf("exceeded max shader variants for %s\n", variants.fragmentShaderPath);
+		return -1;
+	}
+	u32 i = variants.nVariants++;
+	variants.masks[i] = mask;
+	variants.programs[i] = 0;
+	variants.pending[i] = true;
+	BeginShaderProgram(variants.builds[i], variants.vertexShaderPath, variants.fragmentShaderPath, GetShaderDefines(variants, mask).c_str(),
+	&variants.dependencies);
+	return i;
+}
+
+/**
+ * starts compiling the variant if it's new without waiting for it, so with KHR_parallel_shader_compile the driver works
+ * through every variant a scene needs at once and the first draw with each one rarely has to wait
+ */
+void PrecompileShaderVariant(ShaderVariants& variants, u32 mask) {
+	if(FindShaderVariant(variants, mask) < 0) {
+		BeginShaderVariant(variants, mask);
+	}
+}
+
+/**
+ * index of the variant with the mask in variants.programs, -1 past MAX_SHADER_VARIANTS
+ * compiles the variant if it's new and finishes it if it was precompiled (compiled is then set, the caller looks up its
+ * uniforms), doesn't change the bound program
+ * with wait false it's also -1 while the driver is still compiling the variant on its own threads, so the draw can be
+ * skipped for a frame instead of stalling on it (without KHR_parallel_shader_compile the compile has already blocked)
+ */
+s32 LoadShaderVariant(ShaderVariants& variants, u32 mask, bool& compiled, bool wait = true) {
+	compiled = false;
+	s32 i = FindShaderVariant(variants, mask);
+	if(i < 0) {
+		i = BeginShaderVariant(variants, mask);
+		if(i < 0) return -1;
+	}
+	if(variants.pending[i]) {
+		if(!wait && !IsShaderProgramReady(variants.builds[i])) return -1;
+		variants.programs[i] = FinishShaderProgram(variants.builds[i]);
+		variants.pending[i] = false;
+		if(!variants.programs[i]) {
+			printf("error compiling variant 0x%x of %s\n", mask, variants.fragmentShaderPath);
+		}
+		compiled = true;
+	}
+	return i;
+}
+
+/**
+ * recompiles every variant if a file its sources come from changed, the new programs replace the old ones only once
+ * they've linked, a variant that fails keeps drawing with its old program (the log says why) until the file is fixed
+ * returns a bit per variant whose program was replaced, which needs its uniforms looked up again
+ * the old programs are forgotten by state and deleted
+ */
+u64 ReloadShaderVariantsIfUpdated(ShaderVariants& variants, RenderState& state) {
+#ifndef DISABLE_LIVE_UPDATING
+	if(!ShaderDependenciesChanged(variants.dependencies)) return 0;
+	printf("reloading %s\n", variants.fragmentShaderPath);
+
+	// every variant is started before any is finished, so they compile in parallel
+	ShaderProgramBuild builds[MAX_SHADER_VARIANTS];
+	for(u32 i = 0; i < variants.nVariants; i++) {
+		string defines = GetShaderDefines(variants, variants.masks[i]);
+		if(variants.pending[i]) {
+			// precompiled from the old sources and not drawn with yet, so it's just started over
+			DeinitShader(FinishShaderProgram(variants.builds[i]));
+			BeginShaderProgram(variants.builds[i], variants.vertexShaderPath, variants.fragmentShaderPath, defines.c_str(), &variants.dependencies);
+		}
+		else {
+			BeginShaderProgram(builds[i], variants.vertexShaderPath, variants.fragmentShaderPath, defines.c_str(), &variants.dependencies);
+		}
+	}
+	u64 replaced = 0;
+	for(u32 i = 0; i < variants.nVariants; i++) {
+		if(variants.pending[i]) continue;
+		GLuint program = FinishShaderProgram(builds[i]);
+		if(!program) {
+			printf("variant 0x%x of %s keeps its old program\n", variants.masks[i], variants.fragmentShaderPath);
+			continue;
+		}
+		if(variants.programs[i]) {
+			ForgetProgramUniforms(state, variants.programs[i]);
+			DeinitShader(variants.programs[i]);
+		}
+		variants.programs[i] = program;
+		replaced |= 1ull << i;
+	}
+	return replaced;
+#else
+	return 0;
+#endif
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "shader.h"
+#include "render_state.h"
+#include "uniform_buffers.h"
+#include "default_shader.h"
+
+// the only variant bits that change anything in the shadow shader
+#define SHADOW_SHADER_FEATURES (VARIANT_SKELETAL_ANIMATIONS | VARIANT_INSTANCING)
+
+// one compiled variant of the shadow shader
+struct ShadowShader {
+    GLuint program; // 0 if the variant didn't compile
+
+    GLuint u_vpMatrix; // for instanced draws, the rest comes from the ObjectConstants and JointPalette blocks
+};
+
+struct ShadowShaderVariants {
+    ShaderVariants variants;
+    ShadowShader shaders[MAX_SHADER_VARIANTS]; // same order as variants.programs
+};
+
+void ResolveShadowShader(ShadowShader& shader, GLuint program) {
+    shader.program = program;
+    if(!program) return;
+
+    BindUniformBlock(program, "ObjectConstants", OBJECT_CONSTANTS_BINDING);
+    BindUniformBlock(program, "JointPalette", JOINT_PALETTE_BINDING);
+
+    shader.u_vpMatrix = glGetUniformLocation(program, "u_vpMatrix");
+}
+
+void InitShadowShaderVariants(ShadowShaderVariants& shaders) {
+    InitShaderVariants(shaders.variants, "shaders/shadowVS.glsl", "shaders/shadowFS.glsl", VARIANT_FEATURE_NAMES, N_VARIANT_FEATURES);
+}
+
+void DeinitShadowShaderVariants(ShadowShaderVariants& shaders, RenderState& state) {
+    for(u32 i = 0; i < shaders.variants.nVariants; i++) {
+        ForgetProgramUniforms(state, shaders.variants.programs[i]);
+    }
+    DeinitShaderVariants(shaders.variants);
+}
+
+/** the variant with the given feature bits (the ones it doesn't use are dropped), NULL if it doesn't compile or, with wait false, is still compiling */
+ShadowShader* GetShadowShader(ShadowShaderVariants& shaders, u32 variant, bool wait = true) {
+    bool compiled;
+    s32 i = LoadShaderVariant(shaders.variants, variant & SHADOW_SHADER_FEATURES, compiled, wait);
+    if(i < 0) return NULL;
+    if(compiled) {
+        ResolveShadowShader(shaders.shaders[i], shaders.variants.programs[i]);
+    }
+    return shaders.shaders[i].program ? &shaders.shaders[i] : NULL;
+}
+
+void ReloadShadowShaderVariantsIfUpdated(ShadowShaderVariants& shaders, RenderState& state) {
+    u64 replaced = ReloadShaderVariantsIfUpdated(shaders.variants, state);
+    for(u32 i = 0; i < shaders.variants.nVariants; i++) {
+        if(replaced & (1ull << i)) {
+            ResolveShadowShader(shaders.shaders[i], shaders.variants.programs[i]);
+        }
+    }
+}
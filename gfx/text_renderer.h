@@ -1,176 +1,223 @@
 #pragma once
+#include <GL/glew.h>
+#include <string.h>
+#include "text_shader.h"
+#include "glyph_atlas.h"
+#include "render_state.h"
+#include "../core/hash.h"
+
+/**
+ * strings are queued as glyph quads into one cpu side vertex buffer over the frame, then DrawQueuedText streams them
+ * to the gpu and draws them all at once, every glyph comes from the same atlas (see glyph_atlas.h)
+ * the quads a string and scale lay out to are cached, so text that stays the same between frames is only copied into
+ * the queue at its position rather than walked glyph by glyph again
+ */
+
+#define MAX_TEXT_GLYPHS 4096 // queued between draws, past this text gets cut off
+#define MAX_TEXT_LAYOUTS 256 // the layout cache starts over once it has this many strings or MAX_TEXT_GLYPHS glyphs
+#define TEXT_FONT_PATH "fonts/Arial.ttf"
+#define TEXT_FONT_SIZE 48 // pixels, what a scale of 1 draws at, the distance field atlas stays sharp scaled well past it
+
+// has to match textVShader.glsl
+struct TextVertex {
+	v2 pos; // in whatever space the matrix given to DrawQueuedText maps from, pixels for hud text
+	v2 uv;
+	u32 color; // rgba8
+};
 
-#include <freetype2/ft2build.h>
-#include FT_FREETYPE_H
+// a string's quads with the pen starting at the origin
+struct TextLayout {
+	u64 hash; // of the string and scale
+	r32 scale;
+	u32 firstChar; // into the cache's chars, checked along with the hash so a collision doesn't draw the wrong string
+	u32 nChars;
+	u32 firstVertex;
+	u32 nVertices;
+};
 
-#include <iostream>
-#include <exception>
-#include "character.hpp"
-#include "../core/map.h"
-#include "../core/string.h"
-#include <SFML/OpenGL.hpp>
-#include "text_shader.h"
-#include "render_obj.h"
-#include "material.h"
-#include "light.h"
-#include "../core/string.h"
-#include "../core/map.h"
-#include "../gfx/character.hpp"
-#include "gl_buffers.h"
-
-void loadCharacters(Map* characters, Memory& mem)
-{
-    FT_Library ft;
-    if (FT_Init_FreeType(&ft))
-    {
-        std::cout << "ERROR::FREETYPE: Could not init FreeType Library" << std::endl;
-        throw std::runtime_error("Could not load FreeType");
-    }
-    std::cout << "FREETYPE INITIALIZED" << std::endl;
-
-    FT_Face face;
-    if (FT_New_Face(ft, "fonts/Arial.ttf", 0, &face))
-    {
-        std::cout << "ERROR::FREETYPE: Failed to load font" << std::endl;
-        throw std::runtime_error("Could not load font");
-    }
-    std::cout << "FACE INITIALIZED" << std::endl;
-
-    FT_Set_Pixel_Sizes(face, 0, 48); 
-
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
-    for (unsigned char c = 0; c < 128; c++)
-    {
-        // load character glyph 
-        if (FT_Load_Char(face, c, FT_LOAD_RENDER))
-        {
-            std::cout << "ERROR::FREETYTPE: Failed to load Glyph" << std::endl;
-            continue;
-        }
-        // generate texture
-        unsigned int texture;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexImage2D(
-            GL_TEXTURE_2D,
-            0,
-            GL_RED,
-            face->glyph->bitmap.width,
-            face->glyph->bitmap.rows,
-            0,
-            GL_RED,
-            GL_UNSIGNED_BYTE,
-            face->glyph->bitmap.buffer
-        );
-        // set texture options
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        // now store character for later use
-        Character* character = (Character*) Alloc(mem, sizeof(Character));
-        character->TextureID = texture;
-        character->Bearing = glm::ivec2(face->glyph->bitmap_left, face->glyph->bitmap_top);
-        character->Size = glm::ivec2(face->glyph->bitmap.width, face->glyph->bitmap.rows);
-        character->Advance = (uint32_t)face->glyph->advance.x;
-
-        char temp_str[2];
-        temp_str[0] = c;
-        temp_str[1] = '\0';
-        (*characters)[temp_str] = character;
-    }
-    FT_Done_Face(face);
-    FT_Done_FreeType(ft);
-}
+struct TextLayoutCache {
+	u32 nLayouts;
+	TextLayout layouts[MAX_TEXT_LAYOUTS];
+	u32 nChars;
+	char chars[MAX_TEXT_GLYPHS]; // the cached strings, not null terminated
+	u32 nVertices;
+	TextVertex vertices[MAX_TEXT_GLYPHS * 6];
+};
 
 struct TextRenderer {
 	GLuint vao;
+	GLuint vbo; // orphaned and refilled every draw
     TextShader textShader;
+	GlyphAtlas atlas;
+	u32 nVertices;
+	TextVertex vertices[MAX_TEXT_GLYPHS * 6];
+	TextLayoutCache layoutCache;
 };
 
-
-void InitTextRenderer(TextRenderer& renderer) {
+/** leaves the text renderer's vao bound */
+void InitTextRenderer(TextRenderer& renderer, RenderState& state, const char* fontPath = TEXT_FONT_PATH, u32 fontSize = TEXT_FONT_SIZE) {
 	InitTextShader(renderer.textShader);
+	InitGlyphAtlas(renderer.atlas, state, fontPath, fontSize); // text is skipped if the font is missing
+	renderer.nVertices = 0;
+	renderer.layoutCache.nLayouts = 0;
+	renderer.layoutCache.nChars = 0;
+	renderer.layoutCache.nVertices = 0;
+
+	glGenVertexArrays(1, &renderer.vao);
+	SetVertexArray(state, renderer.vao);
+	glGenBuffers(1, &renderer.vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, renderer.vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(renderer.vertices), NULL, GL_STREAM_DRAW);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (GLvoid*) offsetof(TextVertex, pos));
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (GLvoid*) offsetof(TextVertex, uv));
+	glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(TextVertex), (GLvoid*) offsetof(TextVertex, color));
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
 }
 
 void DeinitTextRenderer(TextRenderer& renderer)
 {
 	DeinitShader(renderer.textShader.program);
+	DeinitGlyphAtlas(renderer.atlas);
+	glDeleteBuffers(1, &renderer.vbo);
+	glDeleteVertexArrays(1, &renderer.vao);
 }
 
-void TextRender(TextRenderer& renderer,
-        const std::string& text,
-        Camera& camera,
-        const v3& color,
-        v3 position,
-        const float scale,
-        u32 nRenderObjs,
-        u32 windowWidth,
-        u32 windowHeight,
-        Map* characters)
-{
-
-    glm::mat4 model_matrix = glm::mat4(1);
-
-	// init for default render
-	glUseProgram(renderer.textShader.program);
-	glUniform3fv(renderer.textShader.u_color, 1, &color[0]);
-
-	// glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    // glDisable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    // iterate through all characters
-    for (int i = 0; i < text.length(); i++)
-    {
-        char key = text[i];
-
-        char temp_str[2];
-        temp_str[0] = key;
-        temp_str[1] = '\0';
-        Character& ch = *((Character*)((*characters)[temp_str]));
-
-        glActiveTexture(GL_TEXTURE4); // TODO MANAGE THIS
-        glBindTexture(GL_TEXTURE_2D, ch.TextureID);
-        glUniform1i(glGetUniformLocation(renderer.textShader.program, "text"), 4);
-
-        // printf("CHARACTER: key(%c) and id(%d)\n", key, ch.TextureID);
-
-        float xpos = position.x + ch.Bearing.x * scale;
-        float ypos = position.y - (ch.Size.y - ch.Bearing.y) * scale;
-
-        float w = ch.Size.x * scale;
-        float h = ch.Size.y * scale;
-
-        float our_xpos = xpos + w / 2;
-        float our_ypos = ypos + h / 2;
-
-        float our_w = w/2;
-        float our_h = h/2;
-
-        glm::mat4 translated = glm::translate(glm::vec3(our_xpos, our_ypos, 0));
+u32 PackTextColor(vec4 color) {
+	vec4 c = clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+	return (u32)c.x | (u32)c.y << 8 | (u32)c.z << 16 | (u32)c.w << 24;
+}
 
-        auto u_mvp = camera.vpMatrix * translated * glm::scale(glm::vec3(our_w, our_h, 1));
-        // auto u_mvp = camera.projectionMatrix;
-        // auto u_mvp = camera.vpMatrix;
-        glUniformMatrix4fv(renderer.textShader.u_mvp, 1, GL_FALSE, &u_mvp[0][0]);
+void SetTextVertex(TextVertex& vertex, r32 x, r32 y, r32 u, r32 v, u32 color) {
+	vertex.pos = v2(x, y);
+	vertex.uv = v2(u, v);
+	vertex.color = color;
+}
 
-        // render glyph texture over quad
-        // update content of VBO memory
+/**
+ * writes the quads of text with its first baseline starting at position (y goes up) into vertices, '\n' starts a new line
+ * under it, returns how many vertices it took, text past maxVertices is cut off
+ */
+u32 LayoutText(GlyphAtlas& atlas, const char* text, v2 position, r32 scale, u32 color, TextVertex* vertices, u32 maxVertices) {
+	u32 nVertices = 0;
+	v2 pen = position;
+	for(const char* c = text; *c != '\0'; c++) {
+		if(*c == '\n') {
+			pen.x = position.x;
+			pen.y -= atlas.lineHeight * scale;
+			continue;
+		}
+		Glyph& glyph = GetGlyph(atlas, *c);
+		if(glyph.width > 0 && glyph.height > 0) {
+			if(nVertices + 6 > maxVertices) {
+				printf("exceeded max text glyphs\n");
+				break;
+			}
+			r32 left = pen.x + glyph.bearingX * scale;
+			r32 right = left + glyph.width * scale;
+			r32 top = pen.y + glyph.bearingY * scale;
+			r32 bottom = top - glyph.height * scale;
+			// the atlas' rows go down, so the top of the quad gets uvMin.y
+			TextVertex* quad = &vertices[nVertices];
+			SetTextVertex(quad[0], left, top, glyph.uvMin.x, glyph.uvMin.y, color);
+			SetTextVertex(quad[1], left, bottom, glyph.uvMin.x, glyph.uvMax.y, color);
+			SetTextVertex(quad[2], right, bottom, glyph.uvMax.x, glyph.uvMax.y, color);
+			SetTextVertex(quad[3], left, top, glyph.uvMin.x, glyph.uvMin.y, color);
+			SetTextVertex(quad[4], right, bottom, glyph.uvMax.x, glyph.uvMax.y, color);
+			SetTextVertex(quad[5], right, top, glyph.uvMax.x, glyph.uvMin.y, color);
+			nVertices += 6;
+		}
+		pen.x += glyph.advance * scale;
+	}
+	return nVertices;
+}
 
-        // render quad
-        // glDrawArrays(GL_TRIANGLES, 0, 6);
-		glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0);
-        // now advance cursors for next glyph (note that advance is number of 1/64 pixels)
-        position.x += (ch.Advance >> 6) * scale; // bitshift by 6 to get value in pixels (2^6 = 64)
-    }
+/** the cached layout of text at scale, laid out and added to the cache if it isn't there yet */
+TextLayout& GetTextLayout(TextLayoutCache& cache, GlyphAtlas& atlas, const char* text, r32 scale) {
+	u64 hash = HashString(text, HashBytes(&scale, sizeof(scale)));
+	u32 nChars = strlen(text);
+	for(u32 i = 0; i < cache.nLayouts; i++) {
+		TextLayout& layout = cache.layouts[i];
+		if(layout.hash == hash && layout.scale == scale && layout.nChars == nChars && memcmp(&cache.chars[layout.firstChar], text, nChars) == 0) {
+			return layout;
+		}
+	}
+	// a full cache is mostly strings that have stopped showing up, the ones still in use get laid out again
+	if(cache.nLayouts == MAX_TEXT_LAYOUTS || cache.nChars + nChars > MAX_TEXT_GLYPHS || cache.nVertices + nChars * 6 > MAX_TEXT_GLYPHS * 6) {
+		cache.nLayouts = 0;
+		cache.nChars = 0;
+		cache.nVertices = 0;
+	}
+	TextLayout& layout = cache.layouts[cache.nLayouts++];
+	layout.hash = hash;
+	layout.scale = scale;
+	// a string longer than the whole cache is still laid out (and cut off), its copy is cut off too so it never matches
+	layout.nChars = nChars < MAX_TEXT_GLYPHS ? nChars : MAX_TEXT_GLYPHS;
+	layout.firstChar = cache.nChars;
+	memcpy(&cache.chars[cache.nChars], text, layout.nChars);
+	cache.nChars += layout.nChars;
+	layout.firstVertex = cache.nVertices;
+	layout.nVertices = LayoutText(atlas, text, v2(0, 0), scale, 0, &cache.vertices[cache.nVertices], MAX_TEXT_GLYPHS * 6 - cache.nVertices);
+	cache.nVertices += layout.nVertices;
+	return layout;
+}
 
-    glDisable(GL_BLEND);
+/**
+ * queues text with its first baseline starting at position (y goes up), '\n' starts a new line under it
+ * text that changes every frame (timers, counters) should pass cacheLayout false, so it doesn't churn the layout cache
+ */
+void QueueText(TextRenderer& renderer, const char* text, v2 position, r32 scale = 1.0f, vec4 color = vec4(1, 1, 1, 1),
+bool cacheLayout = true) {
+	if(renderer.atlas.texture == 0) return;
+	u32 packedColor = PackTextColor(color);
+	TextVertex* vertices = &renderer.vertices[renderer.nVertices];
+	u32 maxVertices = MAX_TEXT_GLYPHS * 6 - renderer.nVertices;
+	if(!cacheLayout) {
+		renderer.nVertices += LayoutText(renderer.atlas, text, position, scale, packedColor, vertices, maxVertices);
+		return;
+	}
+	TextLayout& layout = GetTextLayout(renderer.layoutCache, renderer.atlas, text, scale);
+	u32 nVertices = layout.nVertices;
+	if(nVertices > maxVertices) {
+		printf("exceeded max text glyphs\n");
+		nVertices = maxVertices - maxVertices % 6;
+	}
+	TextVertex* cached = &renderer.layoutCache.vertices[layout.firstVertex];
+	for(u32 i = 0; i < nVertices; i++) {
+		vertices[i].pos = cached[i].pos + position;
+		vertices[i].uv = cached[i].uv;
+		vertices[i].color = packedColor;
+	}
+	renderer.nVertices += nVertices;
+}
 
-    // glBindVertexArray(0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glEnable(GL_DEPTH_TEST);
+/** pixels with the origin at the bottom left of the window, for hud text */
+mat4 GetTextScreenMatrix(u32 windowWidth, u32 windowHeight) {
+	return glm::ortho(0.0f, (r32)windowWidth, 0.0f, (r32)windowHeight, -1.0f, 1.0f);
+}
 
+/**
+ * draws everything queued since the last call with one draw call, over whatever is in the bound framebuffer
+ * mvp takes the queued positions to clip space, GetTextScreenMatrix for hud text or a camera's vpMatrix for text in the world
+ */
+void DrawQueuedText(TextRenderer& renderer, RenderState& state, mat4& mvp) {
+	if(renderer.nVertices == 0) return;
+	SetProgram(state, renderer.textShader.program);
+	SetUniformMatrix4fv(state, renderer.textShader.u_mvp, 1, &mvp[0][0]);
+	SetSampler(state, renderer.textShader.u_texture, renderer.atlas.texture, 0);
+	SetVertexArray(state, renderer.vao);
+
+	// orphaned first, so this never waits on the previous frame's draw
+	glBindBuffer(GL_ARRAY_BUFFER, renderer.vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(renderer.vertices), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, renderer.nVertices * sizeof(TextVertex), renderer.vertices);
+
+	glDisable(GL_DEPTH_TEST);
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	DrawArrays(state, 0, renderer.nVertices);
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	renderer.nVertices = 0;
 }
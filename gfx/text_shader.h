@@ -4,9 +4,8 @@
 
 struct TextShader {
     GLuint program;
-    GLuint u_mvp;
-    GLuint u_texture;
-    GLuint u_color;
+    GLuint u_mvp; // from the text's pixel coordinates to clip space
+    GLuint u_texture; // the glyph atlas
 };
 
 void InitTextShader(TextShader& shader) {
@@ -15,7 +14,4 @@ void InitTextShader(TextShader& shader) {
     shader.u_mvp = glGetUniformLocation(shader.program, "u_mvp");
     
     shader.u_texture = glGetUniformLocation(shader.program, "u_texture");
-
-    shader.u_color = glGetUniformLocation(shader.program, "u_color");
-
 }
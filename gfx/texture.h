@@ -1,13 +1,137 @@
 #pragma once
 #include <GL/glew.h>
 #include "stb_image.cpp"
+#include "cooked_texture.h"
+#include "../core/fileio.h"
+
+#define TEXTURE_MAX_ANISOTROPY 8.0f
 
 struct Texture {
 	GLuint texture; // returned from glGenTextures
 	int width, height;
+	s32 layer; // -1 for a plain GL_TEXTURE_2D, otherwise texture is a GL_TEXTURE_2D_ARRAY shared with others (see texture_array.h)
+};
+
+enum TextureFilter {
+	TEXTURE_FILTER_BILINEAR, // no mips, only for textures that are never minified much
+	TEXTURE_FILTER_TRILINEAR,
+	TEXTURE_FILTER_ANISOTROPIC // trilinear plus up to TEXTURE_MAX_ANISOTROPY samples along the view direction, for surfaces seen at an angle
 };
 
-bool InitTexture(Texture& texture, const char* texturePath, GLint internalFormat = GL_RGBA) {
+/** sets the min / mag filter of the texture bound to target, nMips is how many mips it has */
+void SetTextureFilter(GLenum target, TextureFilter filter, u32 nMips) {
+	bool mipmapped = filter != TEXTURE_FILTER_BILINEAR && nMips > 1;
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, mipmapped ? nMips - 1 : 0);
+	if(filter == TEXTURE_FILTER_ANISOTROPIC && GLEW_EXT_texture_filter_anisotropic) {
+		GLfloat maxAnisotropy = 1.0f;
+		glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+		glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY_EXT, maxAnisotropy < TEXTURE_MAX_ANISOTROPY ? maxAnisotropy : TEXTURE_MAX_ANISOTROPY);
+	}
+}
+
+// internal format to upload a cooked texture as, rgba8 ones use whatever the caller asked for
+GLenum GetCookedTextureGLFormat(u32 format, GLint rgbaInternalFormat) {
+	switch(format) {
+		case CTEX_FORMAT_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case CTEX_FORMAT_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		case CTEX_FORMAT_BC4: return GL_COMPRESSED_RED_RGTC1;
+		case CTEX_FORMAT_BC5: return GL_COMPRESSED_RG_RGTC2;
+		default: return rgbaInternalFormat;
+	}
+}
+
+// rgtc (BC4 / BC5) is core since GL 3.0, s3tc (BC1 / BC3) is an extension every desktop driver has
+bool IsCookedTextureFormatSupported(u32 format) {
+	return (format != CTEX_FORMAT_BC1 && format != CTEX_FORMAT_BC3) || GLEW_EXT_texture_compression_s3tc;
+}
+
+/**
+ * uploads rows [firstRow, firstRow + nRows) of a mip, rows of 4x4 blocks for compressed formats, data can be a pbo offset
+ * into the bound GL_TEXTURE_2D, or into a layer of the bound GL_TEXTURE_2D_ARRAY when layer isn't -1
+ */
+void UploadCookedRows(CookedTextureHeader& header, u32 mip, u32 firstRow, u32 nRows, const void* data, s32 layer = -1) {
+	u32 width = GetMipSize(header.width, mip), height = GetMipSize(header.height, mip);
+	u32 y = firstRow * GetCookedRowTexels(header.format);
+	u32 rowsHeight = nRows * GetCookedRowTexels(header.format);
+	if(y + rowsHeight > height) rowsHeight = height - y;
+	if(IsBlockCompressed(header.format)) {
+		GLenum glFormat = GetCookedTextureGLFormat(header.format, GL_RGBA);
+		u32 size = nRows * GetCookedRowSize(header.format, width);
+		if(layer >= 0)
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, mip, 0, y, layer, width, rowsHeight, 1, glFormat, size, data);
+		else
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, mip, 0, y, width, rowsHeight, glFormat, size, data);
+	}
+	else {
+		if(layer >= 0)
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, mip, 0, y, layer, width, rowsHeight, 1, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		else
+			glTexSubImage2D(GL_TEXTURE_2D, mip, 0, y, width, rowsHeight, GL_RGBA, GL_UNSIGNED_BYTE, data);
+	}
+}
+
+/**
+ * reads imagePath's cooked texture, cooking it from the image first if it's missing or older than the image
+ * safe to call from any thread, free with DeinitCookedTexture
+ */
+bool LoadCookedTexture(CookedTexture& cooked, const char* imagePath, TextureUsage usage) {
+	string cookedPath = string(imagePath) + CTEX_EXTENSION;
+	time_t imageTime = LastModifiedOfFile(imagePath);
+	bool cookedAlready = false;
+	if(LastModifiedOfFile(cookedPath.c_str()) >= imageTime && ReadCookedTexture(cooked, cookedPath.c_str())) {
+		cookedAlready = cooked.header.usage == (u32)usage;
+		// otherwise it was cooked for something else, normal maps are filtered and compressed differently
+		if(!cookedAlready) DeinitCookedTexture(cooked);
+	}
+	if(!cookedAlready) {
+		int width, height, numComponents;
+		stbi_set_flip_vertically_on_load_thread(true);
+		unsigned char* data = stbi_load(imagePath, &width, &height, &numComponents, 4);
+		if(data == NULL) {
+			cooked.data = NULL;
+			return false;
+		}
+		CookTexture(cooked, data, width, height, usage);
+		stbi_image_free(data);
+		WriteCookedTexture(cooked, cookedPath.c_str()); // still fine to use if it can't be saved
+	}
+	if(!IsCookedTextureFormatSupported(cooked.header.format)) {
+		DecompressCookedTexture(cooked);
+	}
+	return true;
+}
+
+/** filters other than TEXTURE_FILTER_BILINEAR load the texture's cooked (block compressed) mips, see LoadCookedTexture */
+bool InitTexture(Texture& texture, const char* texturePath, GLint internalFormat = GL_RGBA, TextureFilter filter = TEXTURE_FILTER_BILINEAR, TextureUsage usage = TEXTURE_USAGE_COLOR) {
+	if(filter != TEXTURE_FILTER_BILINEAR) {
+		CookedTexture cooked;
+		if(!LoadCookedTexture(cooked, texturePath, usage)) {
+			printf("Unable to load texture: %s\n", texturePath);
+			return false;
+		}
+		CookedTextureHeader& header = cooked.header;
+		texture.width = header.width;
+		texture.height = header.height;
+		texture.layer = -1;
+		glGenTextures(1, &texture.texture);
+		glBindTexture(GL_TEXTURE_2D, texture.texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		SetTextureFilter(GL_TEXTURE_2D, filter, header.nMips);
+		GLenum glFormat = GetCookedTextureGLFormat(header.format, internalFormat);
+		for(u32 mip = 0; mip < header.nMips; mip++) {
+			u32 width = GetMipSize(header.width, mip), height = GetMipSize(header.height, mip);
+			if(IsBlockCompressed(header.format))
+				glCompressedTexImage2D(GL_TEXTURE_2D, mip, glFormat, width, height, 0, header.mipSizes[mip], cooked.data + header.mipOffsets[mip]);
+			else
+				glTexImage2D(GL_TEXTURE_2D, mip, glFormat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, cooked.data + header.mipOffsets[mip]);
+		}
+		DeinitCookedTexture(cooked);
+		return true;
+	}
+
 	int width, height, numComponents;
 	stbi_set_flip_vertically_on_load(true);
     unsigned char* data = stbi_load(texturePath, &width, &height, &numComponents, 4);
@@ -19,6 +143,7 @@ bool InitTexture(Texture& texture, const char* texturePath, GLint internalFormat
 
 	texture.width = width;
 	texture.height = height;
+	texture.layer = -1;
     
     glGenTextures(1, &texture.texture);
     glBindTexture(GL_TEXTURE_2D, texture.texture);
@@ -47,6 +172,7 @@ void DeinitTexture(GLuint texture) {
 struct FBO {
 	GLuint id; // frame buffer to write shadow map to
 	GLuint texture; // returned from glGenTextures
+	GLuint rbo; // depth and stencil renderbuffer of color fbos, 0 for shadow maps
     GLuint uniformLocation;
 	int width, height;
 };
@@ -54,6 +180,7 @@ struct FBO {
 bool InitShadowMap(FBO& shadowMap, int width, int height) {
 	shadowMap.width = width;
 	shadowMap.height = height;
+	shadowMap.rbo = 0;
 	glGenTextures(1, &shadowMap.texture);
 	glBindTexture(GL_TEXTURE_2D, shadowMap.texture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
@@ -79,18 +206,64 @@ bool InitShadowMap(FBO& shadowMap, int width, int height) {
 	return true;
 }
 
-bool InitFBO(FBO& fbo, int width, int height) {
-	fbo.width = width;
-	fbo.height = height;
-	glGenTextures(1, &fbo.texture);
-	glBindTexture(GL_TEXTURE_2D, fbo.texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_FLOAT, 0);
+// depth texture array with one layer per shadow map, the fbo renders to layer 0 until ShadowRender picks another
+bool InitShadowMapArray(FBO& shadowMap, int width, int height, int layers) {
+	shadowMap.width = width;
+	shadowMap.height = height;
+	shadowMap.rbo = 0;
+	glGenTextures(1, &shadowMap.texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMap.texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, width, height, layers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+
+	glGenFramebuffers(1, &shadowMap.id);
+	glBindFramebuffer(GL_FRAMEBUFFER, shadowMap.id);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowMap.texture, 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		printf("error with glCheckFramebufferStatus: %d\n", status);
+		return false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return true;
+}
+
+/** copies one layer of a shadow map array into the same layer of another of the same size */
+void CopyShadowMapLayer(FBO& src, FBO& dst, int layer) {
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, src.id);
+	glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, src.texture, 0, layer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, dst.id);
+	glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, dst.texture, 0, layer);
+	glBlitFramebuffer(0, 0, src.width, src.height, 0, 0, dst.width, dst.height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+}
+
+// unfiltered texture to render into, reads outside of it return 1s
+void InitRenderTexture(GLuint& texture, GLint internalFormat, GLenum format, GLenum type, int width, int height) {
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, 0);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 	float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
 	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+}
+
+bool InitFBO(FBO& fbo, int width, int height, GLint internalFormat = GL_RGBA) {
+	fbo.width = width;
+	fbo.height = height;
+	InitRenderTexture(fbo.texture, internalFormat, GL_RGBA, GL_FLOAT, width, height);
 
 	glGenFramebuffers(1, &fbo.id);
 	glBindFramebuffer(GL_FRAMEBUFFER, fbo.id);
@@ -101,14 +274,13 @@ bool InitFBO(FBO& fbo, int width, int height) {
 	glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
 
 	// create depth an stencil renderbuffer
-	unsigned int rbo;
-	glGenRenderbuffers(1, &rbo);
-	glBindRenderbuffer(GL_RENDERBUFFER, rbo);
+	glGenRenderbuffers(1, &fbo.rbo);
+	glBindRenderbuffer(GL_RENDERBUFFER, fbo.rbo);
 	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);  
 	glBindRenderbuffer(GL_RENDERBUFFER, 0);
 
 	// attach depth n stencil renderbuffer to the framebuffer
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, fbo.rbo);
 
 	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
 	if(status != GL_FRAMEBUFFER_COMPLETE) {
@@ -119,4 +291,57 @@ bool InitFBO(FBO& fbo, int width, int height) {
 	return true;
 }
 
+void DeinitFBO(FBO& fbo) {
+	glDeleteFramebuffers(1, &fbo.id);
+	DeinitTexture(fbo.texture);
+	if(fbo.rbo != 0) {
+		glDeleteRenderbuffers(1, &fbo.rbo);
+	}
+}
+
+// render targets of the deferred renderer's geometry pass (see deferred_renderer.h)
+struct GBuffer {
+	GLuint id;
+	GLuint albedo; // material color with its texture applied
+	GLuint normal; // world space, scaled and biased into 0 to 1
+	GLuint material; // index into the material table / 255
+	GLuint depth; // positions are rebuilt from this
+	int width, height;
+};
+
+bool InitGBuffer(GBuffer& gbuffer, int width, int height) {
+	gbuffer.width = width;
+	gbuffer.height = height;
+	InitRenderTexture(gbuffer.albedo, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+	InitRenderTexture(gbuffer.normal, GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+	InitRenderTexture(gbuffer.material, GL_R8, GL_RED, GL_UNSIGNED_BYTE, width, height);
+	// same format as the fbo depth renderbuffer
+	InitRenderTexture(gbuffer.depth, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, width, height);
+
+	glGenFramebuffers(1, &gbuffer.id);
+	glBindFramebuffer(GL_FRAMEBUFFER, gbuffer.id);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, gbuffer.albedo, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, gbuffer.normal, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, gbuffer.material, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, gbuffer.depth, 0);
+	GLenum drawBuffers[3] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+	glDrawBuffers(3, drawBuffers);
+
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		printf("error with glCheckFramebufferStatus: %d\n", status);
+		return false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return true;
+}
+
+void DeinitGBuffer(GBuffer& gbuffer) {
+	glDeleteFramebuffers(1, &gbuffer.id);
+	DeinitTexture(gbuffer.albedo);
+	DeinitTexture(gbuffer.normal);
+	DeinitTexture(gbuffer.material);
+	DeinitTexture(gbuffer.depth);
+}
+
 // TODO: InitShadowCubeMap
@@ -0,0 +1,80 @@
+#pragma once
+#include <GL/glew.h>
+#include "texture.h"
+#include "render_state.h"
+
+/**
+ * material textures are layers of GL_TEXTURE_2D_ARRAYs grouped by size, format, mips and filter, so materials whose maps
+ * share arrays draw without rebinding anything, only their layers in the material table differ
+ * storage for TEXTURE_ARRAY_LAYERS layers is allocated when an array is created (gl 4.1 can't grow one without a round
+ * trip through the cpu), once it's full the next texture of its kind starts another array
+ */
+
+#define MAX_TEXTURE_ARRAYS 16
+#define TEXTURE_ARRAY_LAYERS 8
+
+struct TextureArray {
+	GLuint id;
+	GLenum internalFormat;
+	u32 width, height;
+	u32 nMips;
+	TextureFilter filter;
+	u32 nLayers; // handed out so far
+};
+
+struct TextureArrays {
+	u32 nArrays;
+	TextureArray arrays[MAX_TEXTURE_ARRAYS];
+};
+
+void InitTextureArrays(TextureArrays& arrays) {
+	arrays.nArrays = 0;
+}
+
+void DeinitTextureArrays(TextureArrays& arrays) {
+	for(u32 i = 0; i < arrays.nArrays; i++) {
+		glDeleteTextures(1, &arrays.arrays[i].id);
+	}
+	arrays.nArrays = 0;
+}
+
+/**
+ * hands out a layer of an array matching the texture, creating the array if none has room, returns NULL past MAX_TEXTURE_ARRAYS
+ * the array is left bound to texture unit 0, and it mustn't be called while a pixel unpack buffer is bound
+ * (the storage is allocated with NULL data, which would then be an offset into it)
+ */
+TextureArray* AllocTextureArrayLayer(TextureArrays& arrays, RenderState& state, GLenum internalFormat, u32 width, u32 height, u32 nMips,
+TextureFilter filter, u32& layer) {
+	for(u32 i = 0; i < arrays.nArrays; i++) {
+		TextureArray& array = arrays.arrays[i];
+		if(array.internalFormat == internalFormat && array.width == width && array.height == height && array.nMips == nMips
+			&& array.filter == filter && array.nLayers < TEXTURE_ARRAY_LAYERS) {
+			SetTexture(state, 0, array.id, GL_TEXTURE_2D_ARRAY);
+			layer = array.nLayers++;
+			return &array;
+		}
+	}
+	if(arrays.nArrays >= MAX_TEXTURE_ARRAYS) {
+		printf("exceeded max texture arrays\n");
+		return NULL;
+	}
+
+	TextureArray& array = arrays.arrays[arrays.nArrays++];
+	array.internalFormat = internalFormat;
+	array.width = width;
+	array.height = height;
+	array.nMips = nMips;
+	array.filter = filter;
+	array.nLayers = 0;
+	glGenTextures(1, &array.id);
+	SetTexture(state, 0, array.id, GL_TEXTURE_2D_ARRAY);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	SetTextureFilter(GL_TEXTURE_2D_ARRAY, filter, nMips);
+	for(u32 mip = 0; mip < nMips; mip++) {
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, mip, internalFormat, GetMipSize(width, mip), GetMipSize(height, mip), TEXTURE_ARRAY_LAYERS, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	}
+	layer = array.nLayers++;
+	return &array;
+}
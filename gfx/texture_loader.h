@@ -0,0 +1,352 @@
+#pragma once
+#include <GL/glew.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <new>
+#include "texture.h"
+#include "texture_array.h"
+#include "render_state.h"
+#include "../core/jobs.h"
+#include "../core/profiler.h"
+
+/**
+ * loads textures without stalling the frame, worker threads read (or cook, see LoadCookedTexture) their cooked mips
+ * and the main thread uploads the rows through a ring of pixel buffer objects, at most TEXTURE_UPLOAD_BUDGET bytes a frame
+ * textures go into layers of the loader's texture arrays, the shaders sample material maps from arrays (see texture_array.h)
+ * until a texture is ready its Texture holds a shared 1x1 placeholder layer, so materials can point at it straight away
+ * workers only exist while there are files to decode, JoinTextureLoaderWorkers stops them before the game dll is
+ * unloaded for a hot reload, and the next PumpTextureLoader starts new ones for whatever is still queued
+ */
+
+#define MAX_TEXTURE_LOADS 64
+#define MAX_TEXTURE_LOAD_PATH 256
+#define MAX_TEXTURE_LOADER_THREADS 4
+#define TEXTURE_UPLOAD_PBOS 3 // frames an upload buffer gets before it's written again
+#define TEXTURE_UPLOAD_BUDGET (4 MB) // bytes uploaded per frame, also the size of each pbo
+#define TEXTURE_LOADER_PROFILE_THREAD 64 // profiler track of the first worker, past any ParallelFor thread
+
+enum TextureLoadState {
+	TEXTURE_LOAD_EMPTY,
+	TEXTURE_LOAD_QUEUED,
+	TEXTURE_LOAD_DECODING,
+	TEXTURE_LOAD_DECODED,
+	TEXTURE_LOAD_UPLOADING,
+	TEXTURE_LOAD_DONE,
+	TEXTURE_LOAD_FAILED
+};
+
+struct TextureLoad {
+	Texture* texture; // gets the real array and layer once every row is uploaded
+	char path[MAX_TEXTURE_LOAD_PATH];
+	TextureUsage usage;
+	TextureFilter filter;
+	GLint internalFormat;
+	std::atomic<u32> state; // TextureLoadState, workers claim QUEUED loads and hand them back DECODED or FAILED
+
+	// written by the worker that decodes it
+	CookedTexture cooked; // freed once uploaded
+
+	// main thread only
+	TextureArray* uploadArray;
+	u32 uploadLayer;
+	u32 nMips; // just the first without mip filtering
+	u32 uploadMip;
+	u32 uploadedRows; // of uploadMip
+};
+
+struct TextureLoader {
+	GLuint placeholders; // 1x1 array with a layer per TextureUsage, shown until the texture is ready
+	TextureArrays arrays;
+	TextureLoad loads[MAX_TEXTURE_LOADS];
+	std::atomic<u32> nLoads;
+	u32 nPending; // loads not DONE or FAILED yet
+
+	// a worker slot can be reused once its thread has stopped and been joined
+	std::thread workers[MAX_TEXTURE_LOADER_THREADS];
+	std::atomic<bool> workerRunning[MAX_TEXTURE_LOADER_THREADS];
+	std::atomic<bool> stopWorkers; // workers exit after the load they're on instead of claiming another
+
+	GLuint pbos[TEXTURE_UPLOAD_PBOS];
+	GLsync fences[TEXTURE_UPLOAD_PBOS];
+	u32 pboIndex;
+};
+
+// picked so the material looks plain rather than broken while it loads
+void InitPlaceholderTextures(GLuint& placeholders) {
+	u8 pixels[NUM_TEXTURE_USAGES][4] = {
+		{ 255, 255, 255, 255 }, // TEXTURE_USAGE_COLOR
+		{ 128, 128, 255, 255 }, // TEXTURE_USAGE_NORMAL_MAP, straight up in tangent space
+		{ 128, 128, 128, 255 } // TEXTURE_USAGE_DISP_MAP, about no offset with the default bias
+	};
+	glGenTextures(1, &placeholders);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, placeholders);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, 1, 1, NUM_TEXTURE_USAGES, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+}
+
+void InitTextureLoader(TextureLoader& loader) {
+	InitPlaceholderTextures(loader.placeholders);
+	InitTextureArrays(loader.arrays);
+	loader.nLoads = 0;
+	loader.nPending = 0;
+	// the loader lives in game memory, which is never constructed
+	for(u32 i = 0; i < MAX_TEXTURE_LOADER_THREADS; i++) {
+		new (&loader.workers[i]) std::thread();
+		loader.workerRunning[i] = false;
+	}
+	loader.stopWorkers = false;
+	for(u32 i = 0; i < MAX_TEXTURE_LOADS; i++) {
+		loader.loads[i].state = TEXTURE_LOAD_EMPTY;
+	}
+
+	glGenBuffers(TEXTURE_UPLOAD_PBOS, loader.pbos);
+	for(u32 i = 0; i < TEXTURE_UPLOAD_PBOS; i++) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, loader.pbos[i]);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, TEXTURE_UPLOAD_BUDGET, NULL, GL_STREAM_DRAW);
+		loader.fences[i] = 0;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	loader.pboIndex = 0;
+}
+
+/** lets each worker finish the load it's decoding and joins it, the loads still queued stay queued */
+void JoinTextureLoaderWorkers(TextureLoader& loader) {
+	loader.stopWorkers = true;
+	for(u32 i = 0; i < MAX_TEXTURE_LOADER_THREADS; i++) {
+		if(loader.workers[i].joinable()) loader.workers[i].join();
+	}
+	loader.stopWorkers = false;
+}
+
+/** joins the workers, deletes the texture arrays and the placeholders textures still loading point at */
+void DeinitTextureLoader(TextureLoader& loader) {
+	JoinTextureLoaderWorkers(loader);
+	for(u32 i = 0; i < loader.nLoads; i++) {
+		TextureLoad& load = loader.loads[i];
+		if(load.state == TEXTURE_LOAD_DECODED || load.state == TEXTURE_LOAD_UPLOADING) {
+			DeinitCookedTexture(load.cooked);
+		}
+	}
+	DeinitTextureArrays(loader.arrays);
+	glDeleteTextures(1, &loader.placeholders);
+	for(u32 i = 0; i < TEXTURE_UPLOAD_PBOS; i++) {
+		if(loader.fences[i] != 0) glDeleteSync(loader.fences[i]);
+	}
+	glDeleteBuffers(TEXTURE_UPLOAD_PBOS, loader.pbos);
+}
+
+// worker loop, decodes queued loads until there are none left or it's told to stop
+void DecodeTextures(TextureLoader* loader, u32 workerIndex) {
+	gProfileThreadIndex = TEXTURE_LOADER_PROFILE_THREAD + workerIndex;
+	while(!loader->stopWorkers) {
+		TextureLoad* load = NULL;
+		u32 nLoads = loader->nLoads;
+		for(u32 i = 0; i < nLoads && load == NULL; i++) {
+			u32 expected = TEXTURE_LOAD_QUEUED;
+			if(loader->loads[i].state.compare_exchange_strong(expected, TEXTURE_LOAD_DECODING)) {
+				load = &loader->loads[i];
+			}
+		}
+		if(load == NULL) break;
+
+		PROFILE_SCOPE("decode texture");
+		bool loaded = LoadCookedTexture(load->cooked, load->path, (TextureUsage)load->usage);
+		load->state = loaded ? TEXTURE_LOAD_DECODED : TEXTURE_LOAD_FAILED;
+	}
+	loader->workerRunning[workerIndex] = false;
+}
+
+/** points texture at a placeholder and queues the file to be decoded, call PumpTextureLoader every frame to finish it */
+bool LoadTextureAsync(TextureLoader& loader, Texture& texture, const char* texturePath, TextureUsage usage = TEXTURE_USAGE_COLOR,
+TextureFilter filter = TEXTURE_FILTER_ANISOTROPIC, GLint internalFormat = GL_RGBA) {
+	texture.texture = loader.placeholders;
+	texture.width = 1;
+	texture.height = 1;
+	texture.layer = usage;
+	if(loader.nLoads >= MAX_TEXTURE_LOADS || strlen(texturePath) >= MAX_TEXTURE_LOAD_PATH) {
+		printf("Unable to queue texture: %s\n", texturePath);
+		return false;
+	}
+	TextureLoad& load = loader.loads[loader.nLoads];
+	load.texture = &texture;
+	strcpy(load.path, texturePath);
+	load.usage = usage;
+	load.filter = filter;
+	load.internalFormat = internalFormat;
+	load.cooked.data = NULL;
+	load.uploadArray = NULL;
+	load.uploadLayer = 0;
+	load.nMips = 0;
+	load.uploadMip = 0;
+	load.uploadedRows = 0;
+	// the load has to be filled in before a worker can see it
+	load.state = TEXTURE_LOAD_QUEUED;
+	loader.nLoads++;
+	loader.nPending++;
+	return true;
+}
+
+/** true once every queued texture is uploaded or failed */
+bool TexturesLoaded(TextureLoader& loader) {
+	return loader.nPending == 0;
+}
+
+// a run of rows (of blocks for compressed textures) copied into this frame's pbo
+struct TextureUploadChunk {
+	TextureLoad* load;
+	u32 mip;
+	u32 firstRow;
+	u32 nRows;
+	u32 offset; // into the pbo
+};
+
+/**
+ * starts workers for newly queued loads and uploads up to TEXTURE_UPLOAD_BUDGET bytes of decoded rows, largest mip first,
+ * swapping finished textures in for their placeholders
+ * never waits on the gpu, if this frame's pbo is still being read the uploads wait for the next frame
+ * returns how many textures were swapped in, their layers changed so the material table needs uploading again
+ */
+u32 PumpTextureLoader(TextureLoader& loader, RenderState& state) {
+	if(loader.nPending == 0) return 0;
+	PROFILE_FUNCTION();
+
+	u32 nQueued = 0;
+	for(u32 i = 0; i < loader.nLoads; i++) {
+		if(loader.loads[i].state == TEXTURE_LOAD_QUEUED) nQueued++;
+	}
+	u32 maxWorkers = GetNumWorkerThreads() < MAX_TEXTURE_LOADER_THREADS ? GetNumWorkerThreads() : MAX_TEXTURE_LOADER_THREADS;
+	for(u32 i = 0; i < maxWorkers && nQueued > 0; i++) {
+		if(loader.workerRunning[i]) continue;
+		// a stopped worker still has to be joined before its slot is reused
+		if(loader.workers[i].joinable()) loader.workers[i].join();
+		loader.workerRunning[i] = true;
+		loader.workers[i] = std::thread(DecodeTextures, &loader, i);
+		nQueued--;
+	}
+
+	GLsync& fence = loader.fences[loader.pboIndex];
+	if(fence != 0) {
+		GLenum result = glClientWaitSync(fence, 0, 0);
+		if(result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) return 0;
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	// find layers for newly decoded textures before a pbo is bound, new arrays allocate their storage with NULL data,
+	// which would then mean offset 0 into the pbo
+	for(u32 i = 0; i < loader.nLoads; i++) {
+		TextureLoad& load = loader.loads[i];
+		if(load.state != TEXTURE_LOAD_DECODED) continue;
+		CookedTextureHeader& header = load.cooked.header;
+		load.nMips = load.filter == TEXTURE_FILTER_BILINEAR ? 1 : header.nMips;
+		load.uploadArray = AllocTextureArrayLayer(loader.arrays, state, GetCookedTextureGLFormat(header.format, load.internalFormat),
+			header.width, header.height, load.nMips, load.filter, load.uploadLayer);
+		if(load.uploadArray == NULL) {
+			DeinitCookedTexture(load.cooked);
+			load.state = TEXTURE_LOAD_FAILED;
+			continue;
+		}
+		load.state = TEXTURE_LOAD_UPLOADING;
+	}
+
+	TextureUploadChunk chunks[MAX_TEXTURE_LOADS * MAX_TEXTURE_MIPS];
+	u32 nChunks = 0;
+	u32 used = 0;
+	u8* mapped = NULL;
+	for(u32 i = 0; i < loader.nLoads && used < TEXTURE_UPLOAD_BUDGET; i++) {
+		TextureLoad& load = loader.loads[i];
+		u32 loadState = load.state;
+		if(loadState == TEXTURE_LOAD_FAILED && load.texture != NULL) {
+			printf("Unable to load texture: %s\n", load.path);
+			load.texture = NULL;
+			loader.nPending--;
+			continue;
+		}
+		if(loadState != TEXTURE_LOAD_UPLOADING) continue;
+
+		CookedTextureHeader& header = load.cooked.header;
+		while(load.uploadMip < load.nMips) {
+			// rows of 4x4 blocks for compressed textures
+			u32 rowSize = GetCookedRowSize(header.format, GetMipSize(header.width, load.uploadMip));
+			u32 mipRows = GetCookedNumRows(header.format, GetMipSize(header.height, load.uploadMip));
+			u32 nRows = (TEXTURE_UPLOAD_BUDGET - used) / rowSize;
+			if(nRows == 0) break;
+			if(nRows > mipRows - load.uploadedRows) nRows = mipRows - load.uploadedRows;
+
+			if(mapped == NULL) {
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, loader.pbos[loader.pboIndex]);
+				// unsynchronized since the fence already says the gpu is done with this pbo
+				mapped = (u8*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, TEXTURE_UPLOAD_BUDGET,
+					GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+				if(mapped == NULL) {
+					printf("failed to map texture upload buffer\n");
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+					return 0;
+				}
+			}
+			memcpy(mapped + used, load.cooked.data + header.mipOffsets[load.uploadMip] + load.uploadedRows * rowSize, nRows * rowSize);
+			TextureUploadChunk& chunk = chunks[nChunks++];
+			chunk.load = &load;
+			chunk.mip = load.uploadMip;
+			chunk.firstRow = load.uploadedRows;
+			chunk.nRows = nRows;
+			chunk.offset = used;
+			used += nRows * rowSize;
+			load.uploadedRows += nRows;
+			if(load.uploadedRows == mipRows) {
+				load.uploadMip++;
+				load.uploadedRows = 0;
+			}
+		}
+		if(load.uploadMip < load.nMips) break; // out of budget
+	}
+	if(mapped == NULL) return 0;
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	u32 nSwapped = 0;
+	for(u32 i = 0; i < nChunks; i++) {
+		TextureUploadChunk& chunk = chunks[i];
+		TextureLoad& load = *chunk.load;
+		CookedTextureHeader& header = load.cooked.header;
+		SetTexture(state, 0, load.uploadArray->id, GL_TEXTURE_2D_ARRAY);
+		UploadCookedRows(header, chunk.mip, chunk.firstRow, chunk.nRows, (void*)(u64)chunk.offset, load.uploadLayer);
+		if(chunk.mip == load.nMips - 1 && chunk.firstRow + chunk.nRows == GetCookedNumRows(header.format, GetMipSize(header.height, chunk.mip))) {
+			load.texture->texture = load.uploadArray->id;
+			load.texture->width = header.width;
+			load.texture->height = header.height;
+			load.texture->layer = load.uploadLayer;
+			DeinitCookedTexture(load.cooked);
+			load.state = TEXTURE_LOAD_DONE;
+			loader.nPending--;
+			nSwapped++;
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	loader.pboIndex = (loader.pboIndex + 1) % TEXTURE_UPLOAD_PBOS;
+	return nSwapped;
+}
+
+// simple unit test
+// int main() {
+// 	static TextureLoader loader;
+// 	static RenderState state;
+// 	InitRenderState(state);
+// 	InitTextureLoader(loader);
+// 	Texture textures[3];
+// 	LoadTextureAsync(loader, textures[0], "textures/bricks.jpg");
+// 	LoadTextureAsync(loader, textures[1], "textures/bricks_normal.jpg", TEXTURE_USAGE_NORMAL_MAP);
+// 	LoadTextureAsync(loader, textures[2], "textures/missing.jpg");
+// 	u32 frames = 0;
+// 	while(!TexturesLoaded(loader)) {
+// 		PumpTextureLoader(loader, state);
+// 		frames++;
+// 	}
+// 	printf("loaded in %d frames, %dx%d layer %d\n", frames, textures[0].width, textures[0].height, textures[0].layer);
+// 	DeinitTextureLoader(loader);
+// 	return 0;
+// }
@@ -0,0 +1,230 @@
+#pragma once
+#include <GL/glew.h>
+#include <string.h>
+#include "../core/types.h"
+#include "key_frame.h"
+#include "material.h"
+#include "light.h"
+
+// uniform block binding points, shaders attach their blocks to these in their Init function
+#define FRAME_CONSTANTS_BINDING  0
+#define MATERIAL_TABLE_BINDING   1
+#define OBJECT_CONSTANTS_BINDING 2
+#define JOINT_PALETTE_BINDING    3
+
+// has to match MAX_MATERIALS in shaders/include/material_table.glsl
+#define MAX_MATERIAL_TABLE_ENTRIES 256
+
+#define UNIFORM_RING_FRAMES 3 // frames the gpu can be behind before we wait on it
+#define UNIFORM_RING_FRAME_SIZE (8 MB)
+
+// std140 layouts, vec3s are stored as vec4s so the c++ structs line up with the glsl blocks
+
+struct FrameConstants {
+	mat4 vpMatrix;
+	mat4 cascadeMatrices[MAX_SHADOW_CASCADES]; // vp matrix of each shadow cascade's camera
+	vec4 cascadeSplits; // view depth each cascade ends at
+	vec4 cameraPos;
+	vec4 cameraDir;
+	vec4 lightDir;
+	vec4 lightColor;
+	vec4 clusterParams; // see GetClusterParams
+	s32 nCascades;
+	s32 padding[3];
+};
+
+struct MaterialConstants {
+	vec4 color; // w is shininess
+	r32 dispMapScale;
+	r32 dispMapBias;
+	// layers of the material's maps in the texture arrays bound for it (see texture_array.h)
+	s32 textureLayer;
+	s32 normalMapLayer;
+	s32 dispMapLayer;
+	s32 padding[3];
+};
+
+struct ObjectConstants {
+	mat4 modelMatrix;
+	mat4 normalMatrix;
+	mat4 mvpMatrix;
+};
+
+struct JointPalette {
+	mat4 jointTransforms[MAX_JOINTS_PER_MODEL];
+};
+
+/**
+ * per object data for the frames the gpu may still be reading is kept apart by splitting the buffer into
+ * UNIFORM_RING_FRAMES segments, each guarded by a fence
+ * with ARB_buffer_storage the buffer stays mapped, otherwise it's mapped unsynchronized around each batch of writes
+ */
+struct UniformRing {
+	GLuint id;
+	bool persistent;
+	u32 alignment; // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+
+	u8* mapped; // NULL while unmapped
+	u32 mappedStart; // buffer offset mapped points at
+
+	u32 frameIndex;
+	u32 offset; // buffer offset of the next allocation
+	GLsync fences[UNIFORM_RING_FRAMES];
+};
+
+struct UniformBuffers {
+	GLuint frameConstants;
+	GLuint materialTable;
+	UniformRing ring;
+};
+
+void InitUniformRing(UniformRing& ring) {
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	ring.alignment = alignment;
+	ring.frameIndex = 0;
+	ring.offset = 0;
+	ring.mapped = NULL;
+	ring.mappedStart = 0;
+	for(u32 i = 0; i < UNIFORM_RING_FRAMES; i++) {
+		ring.fences[i] = 0;
+	}
+
+	u32 size = UNIFORM_RING_FRAMES * UNIFORM_RING_FRAME_SIZE;
+	glGenBuffers(1, &ring.id);
+	glBindBuffer(GL_UNIFORM_BUFFER, ring.id);
+	ring.persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+	if(ring.persistent) {
+		// coherent, so writes are visible to the next draw without flushing
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_UNIFORM_BUFFER, size, NULL, flags);
+		ring.mapped = (u8*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags);
+		if(ring.mapped == NULL) {
+			printf("failed to persistently map the uniform ring\n");
+			exit(1);
+		}
+	}
+	else {
+		glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_STREAM_DRAW);
+	}
+}
+
+void DeinitUniformRing(UniformRing& ring) {
+	for(u32 i = 0; i < UNIFORM_RING_FRAMES; i++) {
+		if(ring.fences[i] != 0) glDeleteSync(ring.fences[i]);
+	}
+	if(ring.persistent) {
+		glBindBuffer(GL_UNIFORM_BUFFER, ring.id);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+	}
+	glDeleteBuffers(1, &ring.id);
+}
+
+/** moves on to the next segment, waiting for the gpu if it's still reading that segment from UNIFORM_RING_FRAMES frames ago */
+void BeginUniformRingFrame(UniformRing& ring) {
+	ring.frameIndex = (ring.frameIndex + 1) % UNIFORM_RING_FRAMES;
+	ring.offset = ring.frameIndex * UNIFORM_RING_FRAME_SIZE;
+	GLsync& fence = ring.fences[ring.frameIndex];
+	if(fence != 0) {
+		GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while(result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED && result != GL_WAIT_FAILED) {
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms
+		}
+		glDeleteSync(fence);
+		fence = 0;
+	}
+}
+
+/** call after the last draw that reads this frame's segment */
+void EndUniformRingFrame(UniformRing& ring) {
+	ring.fences[ring.frameIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/** call before writing with AllocUniforms, nothing written can be drawn with until EndUniformWrites */
+void BeginUniformWrites(UniformRing& ring) {
+	if(ring.persistent) return;
+	// unsynchronized since the fence already guarantees the gpu is done with this segment
+	u32 frameEnd = (ring.frameIndex + 1) * UNIFORM_RING_FRAME_SIZE;
+	glBindBuffer(GL_UNIFORM_BUFFER, ring.id);
+	ring.mapped = (u8*)glMapBufferRange(GL_UNIFORM_BUFFER, ring.offset, frameEnd - ring.offset,
+		GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+	ring.mappedStart = ring.offset;
+}
+
+void EndUniformWrites(UniformRing& ring) {
+	if(ring.persistent || ring.mapped == NULL) return;
+	glBindBuffer(GL_UNIFORM_BUFFER, ring.id);
+	glUnmapBuffer(GL_UNIFORM_BUFFER);
+	ring.mapped = NULL;
+}
+
+/** returns the buffer offset of size bytes in this frame's segment (write them through GetUniformPtr) or -1 if the segment is full */
+s32 AllocUniforms(UniformRing& ring, u32 size) {
+	u32 start = (ring.offset + ring.alignment - 1) / ring.alignment * ring.alignment;
+	if(ring.mapped == NULL || start + size > (ring.frameIndex + 1) * UNIFORM_RING_FRAME_SIZE) {
+		printf("uniform ring out of space\n");
+		return -1;
+	}
+	ring.offset = start + size;
+	return start;
+}
+
+void* GetUniformPtr(UniformRing& ring, s32 offset) {
+	return ring.mapped + (offset - ring.mappedStart);
+}
+
+void InitUniformBuffers(UniformBuffers& buffers) {
+	glGenBuffers(1, &buffers.frameConstants);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffers.frameConstants);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameConstants), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_CONSTANTS_BINDING, buffers.frameConstants);
+
+	glGenBuffers(1, &buffers.materialTable);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffers.materialTable);
+	glBufferData(GL_UNIFORM_BUFFER, MAX_MATERIAL_TABLE_ENTRIES * sizeof(MaterialConstants), NULL, GL_STATIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_TABLE_BINDING, buffers.materialTable);
+
+	InitUniformRing(buffers.ring);
+}
+
+void DeinitUniformBuffers(UniformBuffers& buffers) {
+	glDeleteBuffers(1, &buffers.frameConstants);
+	glDeleteBuffers(1, &buffers.materialTable);
+	DeinitUniformRing(buffers.ring);
+}
+
+void UploadFrameConstants(UniformBuffers& buffers, FrameConstants& constants) {
+	glBindBuffer(GL_UNIFORM_BUFFER, buffers.frameConstants);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameConstants), &constants);
+}
+
+/** materials are looked up by their id, so call this again after creating materials or when their textures change layers */
+void UploadMaterialTable(UniformBuffers& buffers, Material* materials, u32 nMaterials) {
+	MaterialConstants table[MAX_MATERIAL_TABLE_ENTRIES];
+	u32 n = 0;
+	for(u32 i = 0; i < nMaterials; i++) {
+		Material& material = materials[i];
+		if(material.id >= MAX_MATERIAL_TABLE_ENTRIES) {
+			printf("material id %d doesn't fit in the material table\n", material.id);
+			continue;
+		}
+		MaterialConstants& entry = table[material.id];
+		entry.color = vec4(material.color, material.shininess);
+		entry.dispMapScale = material.dispMapScale;
+		entry.dispMapBias = material.dispMapBias;
+		entry.textureLayer = material.texture != NULL ? material.texture->layer : 0;
+		entry.normalMapLayer = material.normalMap != NULL ? material.normalMap->layer : 0;
+		entry.dispMapLayer = material.dispMap != NULL ? material.dispMap->layer : 0;
+		if(material.id + 1 > n) n = material.id + 1;
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, buffers.materialTable);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, n * sizeof(MaterialConstants), table);
+}
+
+/** points a shader's uniform block at a binding point, blocks the shader doesn't use are ignored */
+void BindUniformBlock(GLuint program, const char* blockName, GLuint binding) {
+	GLuint index = glGetUniformBlockIndex(program, blockName);
+	if(index != GL_INVALID_INDEX) {
+		glUniformBlockBinding(program, index, binding);
+	}
+}
@@ -1,11 +1,19 @@
 #pragma once
 #include "../core/types.h"
 
+// attribute locations, have to match the layouts in defaultVS.glsl and shadowVS.glsl
+#define VERTEX_POSITION_LOC 0
+#define VERTEX_UV_COORDS_LOC 1
+#define VERTEX_NORMAL_LOC 2
+#define VERTEX_TANGENT_LOC 3
+#define VERTEX_JOINT_INDICES_LOC 5
+#define VERTEX_JOINT_WEIGHTS_LOC 6
+
 struct Vertex {
     v3 pos;
     v2 uvCoords;
     v3 normal;
-    v3 tangent;
+    vec4 tangent; // w is the bitangent handedness (1 or -1)
     // v3 bitangent;
     vec4 jointIndices;
     vec4  jointWeights;
@@ -83,7 +83,7 @@ int main() {
 #else
 	while(running) {
 #endif
-		int status = ReloadDLLIfUpdated(rdll);
+		int status = ReloadDLLIfUpdated(rdll, mem);
 		if(status == 0) {
 			DeinitMemory(mem);
 			return 1;
@@ -1,7 +1,7 @@
 #version 410
 
-#define MAX_JOINTS_PER_MODEL 100
-#define MAX_WEIGHTS 4
+#include "include/frame_constants.glsl"
+#include "include/object_constants.glsl"
 
 // in
 layout(location=0) in vec4 a_position;
@@ -11,6 +11,10 @@ layout(location=3) in vec4 a_tangent;
 // layout(location=4) in vec4 a_bitangent;
 layout(location=5) in vec4 a_jointIndices;
 layout(location=6) in vec4 a_jointWeights;
+// per instance, only read by the INSTANCING variant
+layout(location=7) in mat4 a_instanceModelMatrix;
+layout(location=11) in mat4 a_instanceNormalMatrix;
+layout(location=15) in int a_instanceMaterialIndex;
 
 // out
 out vec4 v_position;
@@ -19,63 +23,52 @@ out vec4 v_normal;
 // out vec4 v_tangent;
 // out vec4 v_bitangent;
 out mat3 TBN;
-out vec4 v_positionFromLight;
+flat out int v_materialIndex; // into the material table
 
-// matrices
-uniform mat4 u_modelMatrix;
-uniform mat4 u_normalMatrix;
-uniform mat4 u_mvpMatrix;
-uniform mat4 u_mvpMatrixFromLight;
-uniform mat4 u_jointTransforms[MAX_JOINTS_PER_MODEL];
+// features are #defined per variant of the shader (see VARIANT_FEATURE_NAMES in default_shader.h)
 
-// flags
-uniform bool lighting_enabled;
-uniform bool diffuse_lighting_enabled;
-uniform bool specular_lighting_enabled;
-uniform bool ambient_lighting_enabled;
-uniform bool texture_mapping_enabled;
-uniform bool normal_mapping_enabled;
-uniform bool displacement_mapping_enabled;
-uniform bool shadow_mapping_enabled;
-uniform bool shadow_cube_mapping_enabled;
-uniform bool skeletal_animations_enabled;
+uniform int u_materialIndex; // instanced draws take theirs from the instance attributes instead
 
 // mat4 inverse(mat4 m);
 
 void main() {
-	mat4 jointTransform = mat4(1.0);
-	if(skeletal_animations_enabled) {
-		jointTransform = mat4(0);
-		for(int i = 0; i < MAX_WEIGHTS; i++) {
-			if(a_jointWeights[i] <= 0.0f) continue;
-			jointTransform += u_jointTransforms[int(a_jointIndices[i])] * a_jointWeights[i];
-		}
-	}
+#ifdef INSTANCING
+	mat4 modelMatrix = a_instanceModelMatrix;
+	mat4 normalMatrix = a_instanceNormalMatrix;
+	mat4 mvpMatrix = u_vpMatrix * modelMatrix;
+	v_materialIndex = a_instanceMaterialIndex;
+#else
+	mat4 modelMatrix = u_modelMatrix;
+	mat4 normalMatrix = u_normalMatrix;
+	mat4 mvpMatrix = u_mvpMatrix;
+	v_materialIndex = u_materialIndex;
+#endif
+
+#ifdef SKELETAL_ANIMATIONS
+	mat4 jointTransform = CalcJointTransform(a_jointIndices, a_jointWeights);
 	// TODO: supposedly we can just transpose if we're only doing translation and rotation
 		// according to https://community.khronos.org/t/new-challenge-inverse-transpose-matrix-under-glsl-120/67627/3
 	mat4 jointNormalTransform = transpose(inverse(jointTransform));
+#else
+	mat4 jointTransform = mat4(1.0);
+	mat4 jointNormalTransform = mat4(1.0);
+#endif
 
-	gl_Position = u_mvpMatrix * jointTransform * a_position;
-	v_position = u_modelMatrix * jointTransform * a_position;
+	gl_Position = mvpMatrix * jointTransform * a_position;
+	v_position = modelMatrix * jointTransform * a_position;
+	v_uvCoords = a_uvCoords;
+	v_normal = normalMatrix * jointNormalTransform * a_normal;
 
-	if(texture_mapping_enabled) {
-		v_uvCoords = a_uvCoords;
-	}
-	if(lighting_enabled) {
-		v_normal = u_normalMatrix * jointNormalTransform * a_normal;
-	}
-	if(normal_mapping_enabled || displacement_mapping_enabled) {
-		// v_tangent = u_normalMatrix * a_tangent;
-		// v_bitangent = u_normalMatrix * a_bitangent;
-		vec3 N = normalize((u_normalMatrix * jointNormalTransform * vec4(a_normal.xyz, 0)).xyz);
-		vec3 T = normalize((u_normalMatrix * jointNormalTransform * vec4(a_tangent.xyz, 0)).xyz);
-		T = normalize(T - dot(T, N) * N);
-	    vec3 B = cross(T, N);
-		TBN = mat3(T, B, N);
-	}
-	if(shadow_mapping_enabled) {
-		v_positionFromLight = u_mvpMatrixFromLight * jointTransform * a_position;
-	}
+#if defined(NORMAL_MAPPING) || defined(DISPLACEMENT_MAPPING)
+	// v_tangent = u_normalMatrix * a_tangent;
+	// v_bitangent = u_normalMatrix * a_bitangent;
+	vec3 N = normalize((normalMatrix * jointNormalTransform * vec4(a_normal.xyz, 0)).xyz);
+	vec3 T = normalize((normalMatrix * jointNormalTransform * vec4(a_tangent.xyz, 0)).xyz);
+	T = normalize(T - dot(T, N) * N);
+	// a_tangent.w flips the bitangent for mirrored uvs
+	vec3 B = cross(T, N) * a_tangent.w;
+	TBN = mat3(T, B, N);
+#endif
 }
 
 // mat4 inverse(mat4 m) {
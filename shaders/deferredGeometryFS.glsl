@@ -0,0 +1,47 @@
+#version 410
+
+// geometry pass of the deferred renderer, runs after defaultVS.glsl and only writes what the lighting pass needs
+
+#include "include/frame_constants.glsl"
+#include "include/material_table.glsl"
+#include "include/surface.glsl"
+
+in vec4 v_position;
+in vec4 v_uvCoords;
+in vec4 v_normal;
+in mat3 TBN;
+flat in int v_materialIndex;
+
+// the mappings are #defined per variant of the shader (see VARIANT_FEATURE_NAMES in default_shader.h)
+
+// material, its maps are layers of these texture arrays (see texture_array.h)
+uniform sampler2DArray u_texture;
+uniform sampler2DArray u_normalMap;
+uniform sampler2DArray u_dispMap;
+
+// has to match the GBuffer attachments in texture.h
+layout(location=0) out vec4 g_albedo;
+layout(location=1) out vec4 g_normal;
+layout(location=2) out vec4 g_material;
+
+void main() {
+	Material material = u_materials[v_materialIndex];
+
+	vec3 viewVec = normalize(u_cameraPos.xyz - v_position.xyz);
+	vec2 uvCoords = v_uvCoords.xy;
+	vec3 normal = normalize(v_normal.xyz);
+#ifdef DISPLACEMENT_MAPPING
+	uvCoords = CalcDisplacedUVCoords(TBN, u_dispMap, material.dispMapLayer, uvCoords, viewVec, material.dispMapScale, material.dispMapBias);
+#endif
+#ifdef NORMAL_MAPPING
+	normal = CalcBumpedNormal(TBN, u_normalMap, material.normalMapLayer, uvCoords);
+#endif
+	vec3 materialColor = material.color.rgb;
+#ifdef TEXTURE_MAPPING
+	materialColor *= texture(u_texture, vec3(uvCoords, material.textureLayer)).xyz;
+#endif
+
+	g_albedo = vec4(materialColor, 1.0);
+	g_normal = vec4(normal * 0.5 + 0.5, 0.0);
+	g_material = vec4(v_materialIndex / 255.0, 0.0, 0.0, 0.0);
+}
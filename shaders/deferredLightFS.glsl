@@ -0,0 +1,42 @@
+#version 410
+
+// lighting pass of the deferred renderer, drawn as a full screen quad over the g-buffer
+// point / spot lights come from the same froxel grid as the forward path, each screen tile only loops over its own lights
+
+#include "include/frame_constants.glsl"
+#include "include/material_table.glsl"
+#include "include/lighting.glsl"
+
+// the lighting settings are #defined per variant of the shader (see deferred_shader.h)
+
+// g-buffer
+uniform sampler2D u_albedoMap;
+uniform sampler2D u_normalMap;
+uniform sampler2D u_materialMap;
+uniform sampler2D u_depthMap;
+uniform mat4 u_invVpMatrix; // back from depth to world space
+
+out vec4 fragColor;
+
+void main() {
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(u_depthMap, texel, 0).r;
+	// nothing was drawn here, keep the clear color
+	if(depth == 1.0) discard;
+	gl_FragDepth = depth;
+
+	vec2 screenPos = gl_FragCoord.xy / vec2(textureSize(u_depthMap, 0));
+	vec4 position = u_invVpMatrix * vec4(vec3(screenPos, depth) * 2.0 - 1.0, 1.0);
+	position /= position.w;
+	vec3 materialColor = texelFetch(u_albedoMap, texel, 0).rgb;
+	vec3 normal = normalize(texelFetch(u_normalMap, texel, 0).xyz * 2.0 - 1.0);
+	Material material = u_materials[int(texelFetch(u_materialMap, texel, 0).r * 255.0 + 0.5)];
+	vec3 viewVec = normalize(u_cameraPos.xyz - position.xyz);
+
+	vec3 currentColor = CalcLighting(position, normal, viewVec, materialColor, material.color.w);
+
+	// store depth in alpha to merge with fractal objects, same as defaultFS.glsl
+	float fractalDepth = length(u_cameraPos.xyz - position.xyz) / 10.0;
+
+	fragColor = vec4(min(vec3(1.0), currentColor), fractalDepth);
+}
@@ -1,5 +1,7 @@
 #version 410
 
+#include "include/sdf.glsl"
+
 const int MAX_MARCHING_STEPS = 256;
 const float MIN_DIST = 0.0;
 const float MAX_DIST = 100.0;
@@ -31,73 +33,6 @@ float orbFractalSDF( vec3 p, float s )
 
 
 
-/**
- * Signed distance function for a cube centered at the origin
- * with width = height = length = 2.0
- */
-float cubeSDF(vec3 samplePoint, vec3 cubeCenter, vec3 sideLengths) {
-    // If d.x < 0, then -1 < p.x < 1, and same logic applies to p.y, p.z
-    // So if all components of d are negative, then p is inside the unit cube
-    vec3 d = abs(samplePoint - cubeCenter) - sideLengths;
-    
-    // Assuming p is inside the cube, how far is it from the surface?
-    // Result will be negative or zero.
-    float insideDistance = min(max(d.x, max(d.y, d.z)), 0.0);
-    
-    // Assuming p is outside the cube, how far is it from the surface?
-    // Result will be positive or zero.
-    float outsideDistance = length(max(d, 0.0));
-    
-    return insideDistance + outsideDistance;
-}
-
-/**
- * Signed distance function for a sphere centered at the origin with radius 1.0;
- */
-float sphereSDF(vec3 samplePoint, vec3 sphereCenter, float radius) {
-    return length(samplePoint - sphereCenter) - radius;
-}
-
-/** pass in the result of a sdf and this will round the edges of the geometry */
-float opRound( float fb, float rad ) { return fb - rad; }
-/** pass in the result of 2 sdfs and this will return the union of the geometry */
-float opUnion( float d1, float d2 ) { return min(d1,d2); }
-/** pass in the result of 2 sdfs and this will return the subtraction of the geometry */
-float opSubtraction( float d1, float d2 ) { return max(-d1,d2); }
-/** pass in the result of 2 sdfs and this will return the intersection of the geometry */
-float opIntersection( float d1, float d2 ) { return max(d1,d2); }
-
-
-float opSmoothUnion( float d1, float d2, float k ) {
-    float h = clamp( 0.5 + 0.5*(d2-d1)/k, 0.0, 1.0 );
-    return mix( d2, d1, h ) - k*h*(1.0-h); }
-
-float opSmoothSubtraction( float d1, float d2, float k ) {
-    float h = clamp( 0.5 - 0.5*(d2+d1)/k, 0.0, 1.0 );
-    return mix( d2, -d1, h ) + k*h*(1.0-h); }
-
-float opSmoothIntersection( float d1, float d2, float k ) {
-    float h = clamp( 0.5 - 0.5*(d2-d1)/k, 0.0, 1.0 );
-    return mix( d2, d1, h ) + k*h*(1.0-h); }
-
-// symmetry funcs need more testing dont seem to work as intended
-vec3 opSymX( in vec3 p ) {
-    p.x = abs(p.x);
-    return p;
-}
-vec3 opSymXZ( in vec3 p ) {
-    p.xz = abs(p.xz);
-    return p;
-}
-
-vec3 opRep( in vec3 p, in vec3 c ) {
-    return mod(p, c)-0.5*c;
-}
-
-vec3 opTranslate(vec3 samplePoint, vec3 translation) {
-    return samplePoint - translation;
-}
-
 float testSDF( vec3 samplePoint ) {
     float fb = sphereSDF(samplePoint, vec3(0.0, 1.0, 0.0), 0.5);
     // fb = opSmoothUnion(fb, opRound(cubeSDF(samplePoint, vec3(-0.5, 1.0, 0.0), vec3(0.5, 0.5, 0.5)), 0.1), 0.2);
@@ -274,20 +209,14 @@ mat4 viewMatrix(vec3 eye, vec3 center, vec3 up) {
 
 uniform vec3 u_cameraPos;
 uniform vec3 u_cameraDir;
-// uniform vec2 iResolution;
-
-uniform sampler2D u_renderMap;
-uniform sampler2D u_depthMap;
+uniform vec2 u_resolution; // of the target, which is scaled to keep the pass in its time budget (see raymarch_renderer.h)
 
-uniform mat4 u_vpMatrix;
-
-out vec4 fragColor;
+// the scene is merged in by raymarchCompositeFS.glsl at full resolution
+out vec4 fragColor; // the fractal's color, and the distance along the ray in alpha, negative where it missed
 
 void main()
 {
-    vec2 iResolution = vec2(1200, 800);
-
-	vec3 viewDir = rayDirection(45.0, iResolution.xy, gl_FragCoord.xy);
+	vec3 viewDir = rayDirection(45.0, u_resolution, gl_FragCoord.xy);
     vec3 eye = u_cameraPos;
     
     mat4 viewToWorld = viewMatrix(eye, u_cameraPos + u_cameraDir, vec3(0.0, 1.0, 0.0));
@@ -297,14 +226,7 @@ void main()
     float dist = shortestDistanceToSurface(eye, worldDir, MIN_DIST, MAX_DIST);
     
     if (dist == -1.0) {
-        vec4 renderMapColor = texture(u_renderMap, gl_FragCoord.xy / iResolution.xy);
-        float depthMapDepth = renderMapColor.a * 10.0;
-        if((depthMapDepth < dist && renderMapColor.a != 1.0) || (dist == -1.0 && renderMapColor.a != 1.0)) {
-            fragColor = renderMapColor;
-        }
-        else {
-            fragColor = vec4(0.0, 0.0, 0.0, 0.0);
-        }
+        fragColor = vec4(0.0, 0.0, 0.0, -1.0);
 		return;
     }
     
@@ -317,17 +239,7 @@ void main()
     float shininess = 10.0;
     
     vec3 color = phongIllumination(K_a, K_d, K_s, shininess, p, eye);
-    // fragColor = vec4(color, 1.0);
-    
-    vec4 renderMapColor = texture(u_renderMap, gl_FragCoord.xy / iResolution.xy);
-    float depthMapDepth = renderMapColor.a * 10.0;
-    // float depthMapDepth = texture(u_depthMap, gl_FragCoord.xy / iResolution.xy).r;
-    if((depthMapDepth < dist && renderMapColor.a != 1.0) || (dist == -1.0 && renderMapColor.a != 1.0)) {
-        fragColor = renderMapColor;
-    }
-    else {
-    	fragColor = vec4(color, 1.0);
-    }
+    fragColor = vec4(color, dist);
 
     // const float near = EPSILON;
     // const float far = MAX_DIST;
@@ -335,15 +247,4 @@ void main()
     // const float b = 2.0*far*near/(far-near);
     // float z = length((u_cameraPos + viewDir * dist) - u_cameraPos);
     // gl_FragDepth = a + b/z;
-
-    // if(dist != -1.0) {
-    //     vec3 intersectionPoint = u_cameraPos + viewDir * dist;
-    //     vec4 projectedPoint = (u_vpMatrix * vec4(intersectionPoint, 1.0));
-    //     float zc = projectedPoint.z;
-    //     float wc = projectedPoint.w;
-    //     gl_FragDepth = zc / wc;
-    // }
-    // else {
-    //     // gl_FragDepth = MAX_DIST;
-    // }
 }
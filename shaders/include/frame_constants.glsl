@@ -0,0 +1,15 @@
+// per frame uniform block, the layout has to match uniform_buffers.h
+
+#define MAX_SHADOW_CASCADES 4 // has to match light.h
+
+layout(std140) uniform FrameConstants {
+	mat4 u_vpMatrix; // instanced draws take the model matrix from the instance attributes, so they need the view projection on its own
+	mat4 u_cascadeMatrices[MAX_SHADOW_CASCADES];
+	vec4 u_cascadeSplits;
+	vec4 u_cameraPos;
+	vec4 u_cameraDir;
+	vec4 u_lightDir;
+	vec4 u_lightColor;
+	vec4 u_clusterParams; // x cluster near, y slices per log of depth, zw screen size
+	int u_nCascades;
+};
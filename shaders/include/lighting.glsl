@@ -0,0 +1,172 @@
+// the directional light and the clustered point / spot lights, shared by the forward and deferred lighting passes
+// the lighting settings are #defined per variant of the shader (see VARIANT_FEATURE_NAMES in default_shader.h)
+
+#include "frame_constants.glsl"
+
+// have to match light_clusters.h
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+
+// directional light
+uniform sampler2DArray u_shadowMap; // one layer per cascade
+
+// point / spot lights, binned into a froxel grid on the cpu (see light_clusters.h)
+uniform samplerBuffer u_lightData; // 4 texels per light: pos and radius, color and spot cos, spot dir and constant, linear and quadratic
+uniform usamplerBuffer u_clusterRanges; // per cluster: offset into u_clusterLightIndices and light count
+uniform usamplerBuffer u_clusterLightIndices;
+
+vec3 CalcDiffuse(vec3 lightColor, vec3 materialColor, float nDotL) {
+	return lightColor * materialColor * nDotL;
+}
+
+vec3 CalcSpecular(vec3 lightColor, vec3 materialColor, vec3 lightDir, vec3 normal, vec3 viewVec, float shine) {
+	// halfway vector reflecting
+	vec3 halfwayVec = (lightDir + viewVec) / length(lightDir + viewVec);
+	return materialColor * lightColor * pow(max(0.0, dot(normal, halfwayVec)), shine);
+
+	// perfect reflecting
+	// vec3 reflectionVec = normalize(reflect(lightDir, normal));
+	// return materialColor * lightColor * pow(max(0.0, dot(viewVec, reflectionVec)), shine);
+}
+
+float CalcShadow(vec4 position, sampler2DArray shadowMap) {
+	// the first cascade that reaches this far into the view frustum
+	float viewDepth = dot(position.xyz - u_cameraPos.xyz, u_cameraDir.xyz);
+	int cascade = 0;
+	while(cascade < u_nCascades && viewDepth > u_cascadeSplits[cascade]) {
+		cascade++;
+	}
+	// past the last cascade nothing is in shadow
+	if(cascade >= u_nCascades)
+		return 0.0;
+
+	vec4 posFromLight = u_cascadeMatrices[cascade] * position;
+	vec3 shadowCoord = ((posFromLight.xyz)/posFromLight.w)*vec3(0.5) + vec3(0.5);
+
+	// this makes things outside the light's 'camera' view not in shadow
+	if(shadowCoord.z > 1.0)
+		return 0.0;
+
+	float curDepth = shadowCoord.z;
+	float bias = 0.005;
+
+	float shadow = 0.0;
+#ifdef PCF
+	// pcf (percentage-closer filtering)
+	vec2 texelSize = 1.0 / textureSize(shadowMap, 0).xy;
+	for(int x = -1; x <= 1; ++x) {
+		for(int y = -1; y <= 1; ++y) {
+			float pcfDepth = texture(shadowMap, vec3(shadowCoord.xy + vec2(x, y) * texelSize, cascade)).r;
+			if(curDepth - bias > pcfDepth) {
+				shadow += 1.0;
+			}
+		}
+	}
+	// TODO: do 2 passes, first where we get the average depth
+		// and a second where we weight the shadow contribution by the distance from the average depth
+	shadow /= 9.0;
+#else
+	// hard shadows
+	float closestDepth = texture(shadowMap, vec3(shadowCoord.xy, cascade)).r;
+	if(curDepth - bias > closestDepth) {
+		shadow = 0.9;
+	}
+#endif
+
+	return shadow;
+}
+
+//float CalcCubeShadow(vec3 posDiff, float distance, float far_plane, samplerCube shadowMap) {
+//	float shadow = 0.0;
+//
+//	// hard shadows
+//	float closestDepth = texture(shadowMap, posDiff).r;
+//	closestDepth *= far_plane;
+//	if((distance - 0.005) > closestDepth) {
+//		shadow = 0.9;
+//	}
+//
+//	// TODO: pcf
+//
+//	return shadow;
+//}
+
+int GetCluster(vec4 position) {
+	float viewDepth = dot(position.xyz - u_cameraPos.xyz, u_cameraDir.xyz);
+	int slice = viewDepth <= u_clusterParams.x ? 0 : int(log(viewDepth / u_clusterParams.x) * u_clusterParams.y);
+	ivec2 tile = ivec2(gl_FragCoord.xy / u_clusterParams.zw * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y));
+	tile = clamp(tile, ivec2(0), ivec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+	slice = clamp(slice, 0, CLUSTER_GRID_Z - 1);
+	return (slice * CLUSTER_GRID_Y + tile.y) * CLUSTER_GRID_X + tile.x;
+}
+
+// the lit color of a surface at position (in world space), drawn to the pixel at gl_FragCoord
+vec3 CalcLighting(vec4 position, vec3 normal, vec3 viewVec, vec3 materialColor, float shine) {
+	vec3 currentColor = vec3(0.0, 0.0, 0.0);
+#ifndef LIGHTING
+	currentColor = materialColor;
+#else
+	// directional light
+	float visibility = 1.0;
+	vec3 lightContribution = vec3(0.0, 0.0, 0.0);
+	vec3 lightDir = -normalize(u_lightDir.xyz);
+	float nDotL = dot(lightDir, normal);
+	if(nDotL > 0.0) {
+#ifdef DIFFUSE_LIGHTING
+		lightContribution += CalcDiffuse(u_lightColor.rgb, materialColor, nDotL);
+#endif
+#ifdef SPECULAR_LIGHTING
+		lightContribution += CalcSpecular(u_lightColor.rgb, materialColor, lightDir, normal, viewVec, shine);
+#endif
+#ifdef SHADOW_MAPPING
+		float shadow = CalcShadow(position, u_shadowMap);
+		visibility = 1.0 - shadow;
+#endif
+	}
+	currentColor += lightContribution * visibility;
+
+	// point / spot lights, only the ones whose range reaches this pixel's cluster
+	uvec2 clusterRange = texelFetch(u_clusterRanges, GetCluster(position)).xy;
+	for(uint i = 0u; i < clusterRange.y; i++) {
+		int light = int(texelFetch(u_clusterLightIndices, int(clusterRange.x + i)).r) * 4;
+		vec4 posRadius = texelFetch(u_lightData, light);
+		vec4 colorSpotCos = texelFetch(u_lightData, light + 1);
+		vec4 dirConstant = texelFetch(u_lightData, light + 2);
+		vec4 attenuationCoefficients = texelFetch(u_lightData, light + 3);
+
+		vec3 posDiff = posRadius.xyz - position.xyz;
+		float distance = length(posDiff);
+		if(distance >= posRadius.w) continue;
+		lightDir = posDiff / distance;
+		// outside a spot light's cone
+		if(colorSpotCos.w > -1.0 && dot(-lightDir, dirConstant.xyz) < colorSpotCos.w) continue;
+
+		lightContribution = vec3(0.0, 0.0, 0.0);
+		nDotL = dot(lightDir, normal);
+		if(nDotL > 0.0) {
+#ifdef DIFFUSE_LIGHTING
+			lightContribution += CalcDiffuse(colorSpotCos.rgb, materialColor, nDotL);
+#endif
+#ifdef SPECULAR_LIGHTING
+			lightContribution += CalcSpecular(colorSpotCos.rgb, materialColor, lightDir, normal, viewVec, shine);
+#endif
+			//if(shadow_cube_mapping_enabled) {
+			//	float shadow = CalcCubeShadow(posDiff, distance, u_lights[i].far_plane, u_lights[i].shadowMap);
+			//	visibility = 1.0 - shadow;
+			//}
+			float attenuation = 1 / (dirConstant.w + attenuationCoefficients.x * distance + attenuationCoefficients.y * distance * distance);
+			// fade to 0 at the radius so there's no seam where the light stops being binned
+			float fade = clamp(1.0 - pow(distance / posRadius.w, 4.0), 0.0, 1.0);
+			lightContribution = attenuation * fade * fade * lightContribution;
+		}
+		currentColor += lightContribution;
+	}
+
+#ifdef AMBIENT_LIGHTING
+	// TODO: maybe make a uniform for this 0.1
+	currentColor += materialColor * 0.1;
+#endif
+#endif // LIGHTING
+	return currentColor;
+}
@@ -0,0 +1,16 @@
+// every material's values, the layout has to match uniform_buffers.h
+
+#define MAX_MATERIALS 256 // has to match MAX_MATERIAL_TABLE_ENTRIES in uniform_buffers.h
+
+struct Material {
+	vec4 color; // w is shininess
+	float dispMapScale;
+	float dispMapBias;
+	// layers of the maps in the texture arrays (see texture_array.h), only the forward and geometry passes sample them
+	int textureLayer;
+	int normalMapLayer;
+	int dispMapLayer;
+};
+layout(std140) uniform MaterialTable {
+	Material u_materials[MAX_MATERIALS];
+};
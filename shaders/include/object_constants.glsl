@@ -0,0 +1,23 @@
+// per object uniform blocks, the layouts have to match uniform_buffers.h
+
+#define MAX_JOINTS_PER_MODEL 32 // has to match key_frame.h
+#define MAX_WEIGHTS 4
+
+layout(std140) uniform ObjectConstants {
+	mat4 u_modelMatrix;
+	mat4 u_normalMatrix;
+	mat4 u_mvpMatrix;
+};
+layout(std140) uniform JointPalette {
+	mat4 u_jointTransforms[MAX_JOINTS_PER_MODEL];
+};
+
+// the vertex's joint transforms blended by its weights
+mat4 CalcJointTransform(vec4 jointIndices, vec4 jointWeights) {
+	mat4 jointTransform = mat4(0);
+	for(int i = 0; i < MAX_WEIGHTS; i++) {
+		if(jointWeights[i] <= 0.0f) continue;
+		jointTransform += u_jointTransforms[int(jointIndices[i])] * jointWeights[i];
+	}
+	return jointTransform;
+}
@@ -0,0 +1,15 @@
+// normal and displacement mapping, shared by the forward and deferred geometry passes
+
+vec2 CalcDisplacedUVCoords(mat3 TBN, sampler2DArray dispMap, int layer, vec2 uvCoords, vec3 viewVec, float dispMapScale, float dispMapBias) {
+	float height = texture(dispMap, vec3(uvCoords, layer)).r * dispMapScale + dispMapBias;
+	vec3 tbndViewVec = viewVec * TBN;
+	return uvCoords + vec2(tbndViewVec.x * height, -tbndViewVec.y * height);
+}
+
+vec3 CalcBumpedNormal(mat3 TBN, sampler2DArray normalMap, int layer, vec2 uvCoords) {
+    // z is rebuilt from xy since normal maps are cooked to two channels (BC5)
+    vec2 BumpMapXY = 2.0 * texture(normalMap, vec3(uvCoords.xy, layer)).xy - vec2(1.0, 1.0);
+    vec3 BumpMapNormal = vec3(BumpMapXY, sqrt(max(0.0, 1.0 - dot(BumpMapXY, BumpMapXY))));
+    vec3 NewNormal = normalize(TBN * BumpMapNormal);
+    return NewNormal;
+}
@@ -0,0 +1,35 @@
+#version 410
+
+// merges the fractal, raymarched at a scaled resolution by fractalFS3.glsl, with the full resolution scene
+// a depth aware bilinear upsample: each of the 4 fractal texels around the pixel is depth tested against the pixel's own
+// scene depth before they're blended, so where scene geometry covers the fractal its edges stay at full resolution
+
+uniform sampler2D u_sceneMap; // the scene with its depth / 10 in alpha, 1 where nothing was drawn (see defaultFS.glsl)
+uniform sampler2D u_raymarchMap; // the fractal's color with the distance along the ray in alpha, negative where it missed
+
+out vec4 fragColor;
+
+// what the pixel shows with the fractal texel at it
+vec4 Merge(vec4 scene, vec4 fractal) {
+	bool sceneDrawn = scene.a != 1.0;
+	bool fractalHit = fractal.a >= 0.0;
+	if(sceneDrawn && (!fractalHit || scene.a * 10.0 < fractal.a)) {
+		return scene;
+	}
+	return fractalHit ? vec4(fractal.rgb, 1.0) : vec4(0.0, 0.0, 0.0, 0.0);
+}
+
+void main() {
+	vec4 scene = texelFetch(u_sceneMap, ivec2(gl_FragCoord.xy), 0);
+
+	ivec2 raymarchSize = textureSize(u_raymarchMap, 0);
+	vec2 pos = gl_FragCoord.xy / vec2(textureSize(u_sceneMap, 0)) * vec2(raymarchSize) - 0.5;
+	ivec2 texel = ivec2(floor(pos));
+	vec2 f = pos - vec2(texel);
+	ivec2 maxTexel = raymarchSize - 1;
+	vec4 s00 = Merge(scene, texelFetch(u_raymarchMap, clamp(texel, ivec2(0), maxTexel), 0));
+	vec4 s10 = Merge(scene, texelFetch(u_raymarchMap, clamp(texel + ivec2(1, 0), ivec2(0), maxTexel), 0));
+	vec4 s01 = Merge(scene, texelFetch(u_raymarchMap, clamp(texel + ivec2(0, 1), ivec2(0), maxTexel), 0));
+	vec4 s11 = Merge(scene, texelFetch(u_raymarchMap, clamp(texel + ivec2(1, 1), ivec2(0), maxTexel), 0));
+	fragColor = mix(mix(s00, s10, f.x), mix(s01, s11, f.x), f.y);
+}
@@ -1,7 +1,6 @@
 #version 410
 
-#define MAX_JOINTS_PER_MODEL 100
-#define MAX_WEIGHTS 4
+#include "include/object_constants.glsl"
 
 // attribute vec4 a_position;
 // uniform mat4 u_mvpMatrix;
@@ -12,19 +11,22 @@
 layout(location=0) in vec4 a_position;
 layout(location=5) in vec4 a_jointIndices;
 layout(location=6) in vec4 a_jointWeights;
+layout(location=7) in mat4 a_instanceModelMatrix; // only read by the INSTANCING variant
 
-uniform mat4 u_mvpMatrix;
-uniform mat4 u_jointTransforms[MAX_JOINTS_PER_MODEL];
-uniform bool skeletal_animations_enabled;
+uniform mat4 u_vpMatrix;
+
+// SKELETAL_ANIMATIONS and INSTANCING are #defined per variant of the shader (see shadow_shader.h)
 
 void main() {
+#ifdef SKELETAL_ANIMATIONS
+	mat4 jointTransform = CalcJointTransform(a_jointIndices, a_jointWeights);
+#else
 	mat4 jointTransform = mat4(1.0);
-	if(skeletal_animations_enabled) {
-		jointTransform = mat4(0);
-		for(int i = 0; i < MAX_WEIGHTS; i++) {
-			if(a_jointWeights[i] <= 0.0f) continue;
-			jointTransform += u_jointTransforms[int(a_jointIndices[i])] * a_jointWeights[i];
-		}
-	}
-	gl_Position = u_mvpMatrix * jointTransform * a_position;
+#endif
+#ifdef INSTANCING
+	mat4 mvpMatrix = u_vpMatrix * a_instanceModelMatrix;
+#else
+	mat4 mvpMatrix = u_mvpMatrix;
+#endif
+	gl_Position = mvpMatrix * jointTransform * a_position;
 }
@@ -1,16 +1,16 @@
 #version 410
 
 in vec2 texCoords;
-// varying vec4 color;
+in vec4 color;
 out vec4 fragColor;
 
-uniform sampler2D text;
-uniform vec3 u_color;
+uniform sampler2D u_texture; // glyph atlas, signed distance to the outline in red, 0.5 on it
 
 void main()
 {    
-    // vec4 sampled = vec4(1.0, 1.0, 1.0, texture(text, texCoords).r);
-    vec2 flipped_coords = texCoords;
-    flipped_coords.y = 1-flipped_coords.y;
-    fragColor = vec4(u_color, texture(text, flipped_coords.xy).r);
-}  
\ No newline at end of file
+    // the edge is antialiased over about a pixel whatever the scale, by how fast the distance changes across the screen
+    float distance = texture(u_texture, texCoords).r;
+    float width = 0.7 * fwidth(distance);
+    float alpha = smoothstep(0.5 - width, 0.5 + width, distance);
+    fragColor = vec4(color.rgb, color.a * alpha);
+}